@@ -0,0 +1,39 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <httplib.h>
+#include <chrono>
+#include <functional>
+#include <string>
+
+// Ограниченная очередь соединений вместо безразмерной очереди ThreadPool.
+// Если очередь заполнена до shedDepth, запросы получают быстрый 503,
+// при достижении maxDepth новые соединения сразу закрываются.
+class AdmissionControl {
+public:
+    static void configure(size_t threads, size_t maxDepth, size_t shedDepth,
+                          int maxWaitMs, int retryAfterSec);
+
+    static httplib::TaskQueue* createQueue();
+    // Работа уже принятого запроса (продолжение корутины) в пул сервера, без
+    // предела глубины. false - пула нет (сервер не запущен или остановлен).
+    static bool post(std::function<void()> job);
+
+    // Вызывается из pre-routing для каждого запроса ровно один раз, даже если
+    // запрос не отклоняется (иначе ожидание соединения достанется следующему):
+    // true, если запрос нужно отклонить с 503
+    static bool shouldShed();
+    static void recordShed();
+    static int retryAfterSeconds();
+
+    static std::string statsJson();
+
+private:
+    static size_t threads_;
+    static size_t max_depth_;
+    static size_t shed_depth_;
+    static std::chrono::milliseconds max_wait_;
+    static int retry_after_sec_;
+};
+
+#endif
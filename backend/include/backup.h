@@ -0,0 +1,28 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <string>
+
+// Горячие резервные копии базы: по расписанию и по запросу администратора.
+// Каждый снимок - каталог <dir>/<YYYYMMDD-HHMMSS> с копиями всех файлов базы,
+// старые снимки сверх retention удаляются.
+class Backup {
+public:
+    static void configure(const std::string& dir, int intervalSec, int retention,
+                          int pagesPerStep, int pauseMs);
+    static void start();
+    static void stop();
+
+    // Запускает снимок в фоновом потоке; false, если копирование уже идёт
+    static bool requestSnapshot();
+    static std::string statsJson();
+
+private:
+    static std::string dir_;
+    static int interval_sec_;
+    static int retention_;
+    static int pages_per_step_;
+    static int pause_ms_;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <httplib.h>
+#include <string>
+
+// Сжатие JSON-ответов и потоковой выгрузки NDJSON по Accept-Encoding (br, gzip, deflate).
+// Алгоритмы доступны, только если библиотеки найдены при сборке.
+class Compression {
+public:
+    static void configure(bool enabled, size_t minSize, int level);
+
+    // Вызывается из post-routing handler после формирования тела ответа или провайдера
+    static void apply(const httplib::Request& req, httplib::Response& res);
+
+    static std::string chooseEncoding(const std::string& acceptEncoding);
+    // level < 0 - уровень из configure; для br это 0..11, для gzip/deflate 0..9
+    static bool compress(const std::string& encoding, const std::string& input, std::string& output,
+                         int level = -1);
+
+    static std::string statsJson();
+
+private:
+    static bool enabled_;
+    static size_t min_size_;
+    static int level_;
+};
+
+#endif
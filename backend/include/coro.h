@@ -0,0 +1,234 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <httplib.h>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "db_executor.h"
+
+// Обработчики маршрутов на корутинах C++20 (сборка с TODOMANAGER_HAVE_COROUTINES).
+// Обработчик возвращает CoTask<void> и ждёт базу и таймеры через co_await
+// Coro::read/write/sleep. С движком epoll поток пула на время ожидания
+// освобождается (EventServer::defer), в обычном режиме httplib ждёт, как
+// синхронный обработчик. После co_await корутина продолжается в пуле HTTP
+// (AdmissionControl::post), в обычном режиме - в ждущем её потоке пула, но не
+// в потоке БД или таймера: их очередь не задерживается кодом обработчика.
+template <typename T>
+class CoTask {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+        std::function<void()> on_done;
+        std::exception_ptr error;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+                auto& promise = handle.promise();
+                if (promise.continuation) {
+                    return promise.continuation;
+                }
+                // on_done может освободить кадр корутины, поэтому забираем его заранее
+                std::function<void()> done = std::move(promise.on_done);
+                if (done) {
+                    done();
+                }
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    struct promise_type : PromiseBase {
+        std::optional<T> value;
+
+        CoTask get_return_object() { return CoTask(Handle::from_promise(*this)); }
+        template <typename U>
+        void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+        T take() {
+            if (this->error) {
+                std::rethrow_exception(this->error);
+            }
+            return std::move(*value);
+        }
+    };
+
+    CoTask() = default;
+    explicit CoTask(Handle handle) : handle_(handle) {}
+    CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    CoTask& operator=(CoTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+    ~CoTask() { reset(); }
+
+    // co_await вложенной задачи: запускает её, по завершении продолжает вызвавшую
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().take(); }
+
+    // Запуск задачи верхнего уровня: done вызывается в потоке, где она закончилась
+    void start(std::function<void()> done) {
+        handle_.promise().on_done = std::move(done);
+        handle_.resume();
+    }
+    // Результат или исключение завершившейся задачи
+    T result() { return handle_.promise().take(); }
+
+private:
+    void reset() {
+        if (handle_) {
+            handle_.destroy();
+            handle_ = {};
+        }
+    }
+
+    Handle handle_;
+};
+
+template <>
+struct CoTask<void>::promise_type : CoTask<void>::PromiseBase {
+    CoTask get_return_object() { return CoTask(Handle::from_promise(*this)); }
+    void return_void() {}
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+class Coro {
+public:
+    using Handler = std::function<CoTask<void>(const httplib::Request&, httplib::Response&)>;
+
+    // Маршруты с обработчиком-корутиной, pattern - как у httplib::Server::Get и т.д.
+    // Обработчик получает копию запроса: она живёт, пока корутина приостановлена.
+    static void get(httplib::Server& server, const std::string& pattern, Handler handler);
+    static void post(httplib::Server& server, const std::string& pattern, Handler handler);
+    static void put(httplib::Server& server, const std::string& pattern, Handler handler);
+    static void del(httplib::Server& server, const std::string& pattern, Handler handler);
+
+    // Продолжение корутины после ожидания: передаётся туда, где выполняется её вызов
+    // (см. комментарий к CoTask). Берётся в await_suspend, до постановки в очередь.
+    using Resumer = std::function<void(std::coroutine_handle<>)>;
+    static Resumer resumer();
+
+    // co_await Coro::read([&] { return Database::...; }): вызов в потоке чтения
+    // DbExecutor; без исполнителя - сразу в текущем потоке
+    template <typename F>
+    class DbCall {
+    public:
+        using Result = std::invoke_result_t<F&>;
+
+        DbCall(bool write, int shard, F fn) : write_(write), shard_(shard), fn_(std::move(fn)) {}
+
+        bool await_ready() const { return !DbExecutor::enabled(); }
+        bool await_suspend(std::coroutine_handle<> caller) {
+            // После постановки в очередь кадр может уже продолжиться,
+            // поэтому к полям здесь больше не обращаемся
+            return DbExecutor::enqueue(write_, [this, caller, resume = Coro::resumer()] {
+                run();
+                resume(caller);
+            }, shard_);
+        }
+        Result await_resume() {
+            if (!ran_) {
+                run();
+            }
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            if constexpr (!std::is_void_v<Result>) {
+                return std::move(*result_);
+            }
+        }
+
+    private:
+        using Stored = std::conditional_t<std::is_void_v<Result>, bool, Result>;
+
+        void run() {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    fn_();
+                } else {
+                    result_.emplace(fn_());
+                }
+            } catch (...) {
+                error_ = std::current_exception();
+            }
+            ran_ = true;
+        }
+
+        bool write_;
+        int shard_;
+        F fn_;
+        bool ran_ = false;
+        std::optional<Stored> result_;
+        std::exception_ptr error_;
+    };
+
+    template <typename F>
+    static DbCall<F> read(F fn) {
+        return DbCall<F>(false, 0, std::move(fn));
+    }
+
+    // Как DbExecutor::write: без шарда - писатель каталога
+    template <typename F>
+    static DbCall<F> write(F fn) {
+        return DbCall<F>(true, 0, std::move(fn));
+    }
+
+    template <typename F>
+    static DbCall<F> write(int shard, F fn) {
+        return DbCall<F>(true, shard, std::move(fn));
+    }
+
+    // co_await Coro::sleep(...): поток таймеров передаёт продолжение в resumer
+    class Sleep {
+    public:
+        explicit Sleep(std::chrono::milliseconds delay) : delay_(delay) {}
+        bool await_ready() const { return delay_.count() <= 0; }
+        void await_suspend(std::coroutine_handle<> caller) { Coro::schedule(delay_, caller, Coro::resumer()); }
+        void await_resume() const {}
+
+    private:
+        std::chrono::milliseconds delay_;
+    };
+
+    static Sleep sleep(std::chrono::milliseconds delay) { return Sleep(delay); }
+
+    // Останавливает поток таймеров, ещё не сработавшие продолжаются сразу
+    static void stop();
+
+    static std::string statsJson();
+
+private:
+    static httplib::Server::Handler adapt(const std::string& pattern, Handler handler);
+    static void schedule(std::chrono::milliseconds delay, std::coroutine_handle<> caller, Resumer resume);
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef CORS_H
+#define CORS_H
+
+#include <httplib.h>
+#include <string>
+
+// CORS для фронтенда на другом источнике. Заголовки собираются один раз в configure;
+// preflight отвечается в pre-routing handler без маршрутизатора и кэшируется
+// браузером на Access-Control-Max-Age секунд.
+class Cors {
+public:
+    // origins - список источников через запятую или "*"; maxAgeSec <= 0 - без Max-Age
+    static void configure(const std::string& origins, int maxAgeSec);
+
+    // Вызывается из post-routing handler для всех ответов, кроме preflight
+    static void apply(const httplib::Request& req, httplib::Response& res);
+    // Ответ на OPTIONS: 204 и разрешённые методы/заголовки для своего источника
+    static void preflight(const httplib::Request& req, httplib::Response& res);
+
+    static std::string statsJson();
+};
+
+#endif
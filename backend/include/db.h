@@ -1,27 +1,163 @@
 #ifndef DB_H
 #define DB_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <string>
 #include <vector>
 #include "task.h"
 #include "user.h"
 
+// Пользователи хранятся в каталоговом файле dbPath, задачи разнесены по файлам-шардам
+// по хешу user_id (шард 0 - сам каталоговый файл). Маршрутизация скрыта внутри API:
+// id задачи содержит корзину пользователя, по ней находится шард.
+struct BackupProgress {
+    long long pages = 0;      // страниц во всех скопированных файлах
+    long long steps = 0;
+    int restarts = 0;         // копирование файла начиналось заново из-за записи в него
+    std::string error;
+};
+
+// Сводка по задачам пользователя из таблицы task_stats. Счётчики меняются в той же
+// транзакции, что и задачи, поэтому чтение не зависит от числа задач.
+struct TaskStats {
+    int total = 0;
+    int pending = 0;
+    int in_progress = 0;
+    int completed = 0;
+    int priority_low = 0;
+    int priority_medium = 0;
+    int priority_high = 0;
+    int overdue = 0;              // невыполненные со сроком раньше сегодняшнего дня UTC
+    int completed_this_week = 0;  // выполненные с понедельника текущей недели UTC
+};
+
+// Изменения PUT /api/tasks/:id: заданные поля заменяют хранимые
+struct TaskPatch {
+    std::optional<std::string> title;
+    std::optional<std::string> description;
+    std::optional<int32_t> due_date;   // Task::kNoDate - убрать срок
+    std::optional<TaskPriority> priority;
+    std::optional<TaskStatus> status;
+};
+
+enum class TaskWriteResult {
+    Ok,
+    NotFound,
+    Forbidden,   // задача другого пользователя
+    PreconditionFailed,   // версия задачи не совпала с ожидаемой (If-Match)
+    Failed
+};
+
+// Сохранённый ответ на запись с заголовком Idempotency-Key (таблица idempotency_keys
+// каталогового файла)
+struct IdempotentResponse {
+    int user_id = 0;
+    std::string key;
+    uint64_t fingerprint = 0;   // хеш метода, пути и тела исходного запроса
+    int status = 0;             // 0 - запрос ещё выполняется, ответа нет
+    std::string content_type;
+    std::string etag;
+    std::string body;
+    int64_t created_ts = 0;     // секунды UTC
+};
+
+enum class IdempotencyClaim {
+    Claimed,     // ключ свободен и занят этим вызовом
+    Found,       // ключ уже занят, его строка - в response
+    Failed
+};
+
 class Database {
 public:
-    static bool initDatabase(const std::string& dbPath);
-    static void closeDatabase();
+    // shards применяется только к новой базе; у существующей раскладка хранится
+    // в каталоге и меняется утилитой todomanager-rebalance
+    static bool initDatabase(const std::string& dbPath, int shards = 1);
+    // Останавливает фоновую миграцию и делает checkpoint WAL всех шардов.
+    // false - checkpoint не удался (база занята), журнал догонится при следующем запуске.
+    static bool closeDatabase();
+    
+    // Соединения потока открываются один раз на файл и переиспользуются всеми
+    // вызовами API из этого потока до releaseThreadConnections. Для DbExecutor.
+    static void pinThreadConnections();
+    static void releaseThreadConnections();
+    
+    static int shardCount();
+    // Шард с задачами пользователя и шард задачи: по ним DbExecutor выбирает писателя
+    static int shardForUser(int user_id);
+    static int shardForTask(int64_t task_id);
+    static std::string shardStatsJson(bool countRows = false);
+    // Переносит половину корзин шарда в новый файл. Только при остановленном сервере.
+    // false и после переключения корзин, если не удалось удалить перенесённые строки
+    // из исходного шарда: их дочищает cleanupShard.
+    static bool splitShard(int shard, std::string& report);
+    // Удаляет из шарда строки пользователей, чьи корзины отнесены к другим шардам.
+    // Можно запускать повторно. Только при остановленном сервере.
+    static bool cleanupShard(int shard, std::string& report);
+    
+    // Фоновое заполнение целочисленных колонок времени для старых строк
+    static void startBackfill(int batchSize, int pauseMs);
+    static std::string migrationStatsJson();
+    
+    // Онлайн-копия каталога и всех шардов в targetDir через backup API SQLite:
+    // pagesPerStep страниц за шаг, между шагами пауза pauseMs. Каждый файл
+    // согласован сам по себе; между шардами снимок не атомарен.
+    static bool backupTo(const std::string& targetDir, int pagesPerStep, int pauseMs,
+                         const std::atomic<bool>& cancel, BackupProgress& progress);
     
     static bool createUser(const std::string& username, const std::string& password_hash);
     static User getUserByUsername(const std::string& username);
     static User getUserById(int id);
     
-    static int createTask(const Task& task);
+    // id новой задачи или -1
+    static int64_t createTask(const Task& task);
+    // Пакет задач пользователя одной транзакцией; id записываются в tasks.
+    // При ошибке пакет откатывается целиком.
+    static bool importTasks(int user_id, std::vector<Task>& tasks);
+    // Отдаёт задачи пользователя по одной прямо из курсора, пока consumer возвращает true
+    static bool exportTasks(int user_id, const std::function<bool(const Task&)>& consumer);
     static std::vector<Task> getTasksByUserId(int user_id);
-    static Task getTaskById(int task_id);
-    static bool updateTask(const Task& task);
-    static bool deleteTask(int task_id);
+    static std::vector<Task> getTasksByDueRange(int user_id, int32_t fromDay, int32_t toDay);
+    // Невыполненные задачи со сроком раньше today (дни от эпохи)
+    static std::vector<Task> getOverdueTasks(int user_id, int32_t today);
+    // Первые limit невыполненных задач: выше приоритет, раньше срок (без срока - последними)
+    static std::vector<Task> getNextTasks(int user_id, int limit);
+    // Невыполненные задачи всех пользователей со сроком в [fromDay, toDay], для планировщика
+    static std::vector<Task> getPendingTasksDueBetween(int32_t fromDay, int32_t toDay);
+    static Task getTaskById(int64_t task_id);
+    // Проверка владельца, изменение и чтение результата - одна транзакция;
+    // updated - строка после изменения. versions - ожидаемые версии задачи (подходит
+    // любая, пустой список - без проверки), проверяются в том же UPDATE/DELETE.
+    static TaskWriteResult updateTask(int64_t task_id, int user_id, const TaskPatch& patch,
+                                      const std::vector<int>& versions, Task& updated);
+    static TaskWriteResult deleteTask(int64_t task_id, int user_id, const std::vector<int>& versions);
+    
+    static bool getTaskStats(int user_id, TaskStats& stats);
+    // Пересчитывает task_stats всех шардов по tasks и сравнивает с хранимыми;
+    // repair - заменяет хранимые пересчитанными. report - JSON с итогами.
+    static bool checkTaskStats(bool repair, std::string& report);
+    
+    // Проверка и захват ключа одной транзакцией: свободный ключ получает строку
+    // со status 0 и created_ts now, которую видят все воркеры. Ключ свободен, если
+    // строки нет, она старше since или это заглушка старше staleBefore (процесс,
+    // занявший ключ, упал, не ответив).
+    static IdempotencyClaim claimIdempotencyKey(int user_id, const std::string& key, uint64_t fingerprint,
+                                                int64_t now, int64_t since, int64_t staleBefore,
+                                                IdempotentResponse& response);
+    // Удаляет заглушку (status 0) ключа, запрос по которому не завершился
+    static bool releaseIdempotencyKey(int user_id, const std::string& key);
+    // Пакет ответов одной транзакцией, заменяет заглушки
+    static bool saveIdempotentResponses(const std::vector<IdempotentResponse>& responses);
+    // Удаляет ответы старше before; число удалённых или -1
+    static int purgeIdempotentResponses(int64_t before);
     
 private:
+    static std::string shardPath(int shard);
+    // Фоновая миграция дошла до всех строк, due_day заполнен везде
+    static bool dueDayReady();
+    
     static std::string db_path_;
 };
 
@@ -0,0 +1,59 @@
+#ifndef DB_EXECUTOR_H
+#define DB_EXECUTOR_H
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+// Отдельные потоки для работы с SQLite: по писателю на шард и readers читателей, у каждого
+// свои соединения (Database::pinThreadConnections). Обработчики HTTP отправляют вызовы
+// Database сюда и ждут future, поэтому пул HTTP и число потоков БД настраиваются
+// независимо, а записи в один файл не толкаются между собой за его блокировку.
+// Пока исполнитель не запущен, read/write выполняют функцию в вызывающем потоке.
+class DbExecutor {
+public:
+    static void start(int readers);
+    // Дожидается уже поставленных задач и закрывает соединения потоков
+    static void stop();
+    static bool enabled();
+
+    template <typename F>
+    static auto read(F fn) -> std::future<decltype(fn())> {
+        return submit(false, 0, std::move(fn));
+    }
+
+    // Запись в каталог (пользователи, ключи идемпотентности) и обслуживание всех шардов
+    // идут через писателя шарда 0
+    template <typename F>
+    static auto write(F fn) -> std::future<decltype(fn())> {
+        return submit(true, 0, std::move(fn));
+    }
+
+    // Запись в задачи одного шарда (Database::shardForUser/shardForTask): очередь
+    // своя у каждого шарда, долгий импорт в один файл не задерживает записи в другие
+    template <typename F>
+    static auto write(int shard, F fn) -> std::future<decltype(fn())> {
+        return submit(true, shard, std::move(fn));
+    }
+
+    // Задача без future, о завершении сообщает сама (Coro::read/write).
+    // false - исполнитель не запущен, задачу выполняет вызывающий.
+    static bool enqueue(bool write, std::function<void()> job, int shard = 0);
+
+    static std::string statsJson();
+
+private:
+    template <typename F>
+    static auto submit(bool write, int shard, F fn) -> std::future<decltype(fn())> {
+        using Result = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+        std::future<Result> result = task->get_future();
+        if (!enqueue(write, [task] { (*task)(); }, shard)) {
+            (*task)();
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef EVENT_HUB_H
+#define EVENT_HUB_H
+
+#include <memory>
+#include <string>
+
+struct EventSubscriber;
+
+// Рассылка событий задач подписчикам Server-Sent Events.
+// Кадр события собирается один раз и разделяется между подписчиками пользователя;
+// у каждого подписчика ограниченный буфер, переполнивший его клиент отключается.
+class EventHub {
+public:
+    static void configure(size_t maxSubscribers, size_t bufferEvents, int heartbeatSec);
+
+    // nullptr, если достигнут лимит одновременных подписок или сервер останавливается
+    static std::shared_ptr<EventSubscriber> subscribe(int user_id);
+    static void unsubscribe(const std::shared_ptr<EventSubscriber>& subscriber);
+
+    // Ждёт события не дольше heartbeat и дописывает готовые кадры в out
+    // (при простое - комментарий-пинг). false - подписка закрыта.
+    static bool next(const std::shared_ptr<EventSubscriber>& subscriber, std::string& out);
+
+    static void publish(int user_id, const char* event, const std::string& data);
+    // Закрывает все подписки и перестаёт принимать новые, потоки стримов завершаются
+    static void closeAll();
+
+    static std::string statsJson();
+
+private:
+    static size_t max_subscribers_;
+    static size_t buffer_events_;
+    static int heartbeat_sec_;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <httplib.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// httplib::Server с сетевым фронтендом на epoll (edge-triggered) вместо потока пула
+// на каждое соединение. Потоки event loop принимают соединения, читают и пишут
+// сокеты; в пул (AdmissionControl) уходит только пришедший целиком запрос, который
+// разбирается и обрабатывается обычными маршрутами httplib поверх буфера в памяти.
+// Простаивающие keep-alive соединения потоков пула не занимают, стримы (SSE,
+// экспорт) занимают поток пула, как и раньше. Только Linux, иначе - обычный listen.
+class EventServer : public httplib::Server {
+public:
+    EventServer();
+    ~EventServer();
+
+    // loops <= 0 - обычный режим httplib (поток пула на соединение)
+    void configure(int loops, int maxConnections, int idleTimeoutSec);
+    static bool supported();
+
+    // Блокирует до shutdown, как listen
+    bool run(const std::string& host, int port);
+    // Из любого потока: перестать принимать соединения и дождаться текущих запросов
+    void shutdown();
+
+    // Отложенный ответ для асинхронных обработчиков (coro.h). Вызванный внутри
+    // обработчика defer() освобождает поток пула: записанный ответ отбрасывается,
+    // соединение ждёт. Вызов возвращённой функции заново проводит тот же запрос
+    // через маршруты в пуле, и там resumed() отдаёт переданное состояние.
+    // Пустая функция - отложить нельзя (обычный режим httplib, тело читалось
+    // частями), обработчик ждёт результат сам.
+    using Resume = std::function<void(std::shared_ptr<void> state)>;
+    static Resume defer();
+    static std::shared_ptr<void> resumed();
+
+    static std::string statsJson();
+
+private:
+    struct Connection;
+    struct Loop;
+    class ConnectionStream;
+
+    void loopMain(Loop& loop);
+    void acceptConnections(Loop& loop);
+    void readConnection(Loop& loop, const std::shared_ptr<Connection>& conn);
+    void flushConnection(Loop& loop, const std::shared_ptr<Connection>& conn);
+    void dispatch(Loop& loop, const std::shared_ptr<Connection>& conn);
+    void handle(const std::shared_ptr<Connection>& conn, std::shared_ptr<void> resumed = nullptr);
+    void resume(const std::shared_ptr<Connection>& conn, std::shared_ptr<void> state);
+    void complete(const std::shared_ptr<Connection>& conn);
+    void closeConnection(Loop& loop, const std::shared_ptr<Connection>& conn);
+    void sweep(Loop& loop, bool draining);
+
+    int loop_count_ = 0;
+    int max_connections_ = 10000;
+    int idle_timeout_sec_ = 60;
+
+    // 0 - ещё не запущен, 1 - работает, 2 - остановлен или не запустился
+    std::atomic<int> state_{0};
+    std::atomic<bool> stopping_{false};
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::unique_ptr<httplib::TaskQueue> queue_;
+};
+
+#endif
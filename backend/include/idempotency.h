@@ -0,0 +1,54 @@
+#ifndef IDEMPOTENCY_H
+#define IDEMPOTENCY_H
+
+#include <cstdint>
+#include <string>
+#include "db.h"
+
+// Повторы записей с заголовком Idempotency-Key. Ключ занимается в базе до выполнения
+// запроса (Database::claimIdempotencyKey), поэтому повтор в другом воркере не выполнит
+// запись второй раз. Ответ хранится ttl секунд: в памяти (шардированная таблица
+// ограниченного размера, старые готовые ключи вытесняются) и в базе
+// (Database::saveIdempotentResponses, до ответа клиенту), откуда его найдут другие
+// воркеры и сервер после перезапуска. Повтор получает сохранённый ответ, запись
+// второй раз не выполняется. Ключ действует в пределах пользователя.
+class Idempotency {
+public:
+    enum class Outcome {
+        Proceed,      // ключ новый: выполнить запрос и передать ответ в finish
+        Replay,       // ответ уже есть, он в response
+        InProgress,   // запрос с этим ключом ещё выполняется
+        Mismatch,     // ключ уже использован для другого запроса
+        Busy          // ключ негде занять: в шарде памяти только выполняющиеся ключи
+                      // или база недоступна
+    };
+
+    // ttlSec <= 0 отключает обработку заголовка
+    static void configure(int ttlSec, size_t maxKeys);
+    static bool enabled();
+
+    // Ключ клиента: 1..255 видимых ASCII-символов
+    static bool validKey(const std::string& key);
+    // Хеш метода, пути и тела (FNV-1a), одинаковый во всех процессах и сборках
+    static uint64_t fingerprint(const std::string& method, const std::string& path, const std::string& body);
+    // Тот же хеш по частям для тела, читаемого потоком:
+    // fingerprintFinish(fingerprintAppend(fingerprintStart(m, p), body)) == fingerprint(m, p, body)
+    static uint64_t fingerprintStart(const std::string& method, const std::string& path);
+    static uint64_t fingerprintAppend(uint64_t hash, const char* data, size_t size);
+    static uint64_t fingerprintFinish(uint64_t hash);
+
+    // Proceed занимает ключ до finish или release. fingerprint 0 - тело ещё не прочитано:
+    // отпечатки не сравниваются, Replay отдаёт ответ с сохранённым отпечатком
+    // (response.fingerprint), и сравнивает его вызывающий, дочитав тело.
+    static Outcome begin(int user_id, const std::string& key, uint64_t fingerprint,
+                         IdempotentResponse& response);
+    // Сохраняет ответ на запрос, начатый begin (user_id и key - в response),
+    // возвращает после записи в базу
+    static void finish(IdempotentResponse response);
+    // Освобождает ключ без ответа (ошибка сервера): повтор выполнит запрос заново
+    static void release(int user_id, const std::string& key);
+
+    static std::string statsJson();
+};
+
+#endif
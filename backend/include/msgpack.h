@@ -0,0 +1,38 @@
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Минимальная реализация MessagePack для API задач.
+// Writer пишет сразу в итоговый буфер без промежуточных строк.
+class MsgpackWriter {
+public:
+    explicit MsgpackWriter(std::string& out);
+
+    void beginMap(uint32_t size);
+    void beginArray(uint32_t size);
+    void string(const char* data, size_t size);
+    void string(const char* value);
+    void string(const std::string& value);
+    void integer(int64_t value);
+    void boolean(bool value);
+    void nil();
+
+private:
+    void put8(uint8_t value);
+    void putBig(uint64_t value, int bytes);
+
+    std::string& out_;
+};
+
+class MsgpackReader {
+public:
+    // Разбирает map верхнего уровня в пары ключ-значение (строки и целые числа),
+    // как parseSimpleJson для JSON; nil даёт пустую строку, как null в JSON.
+    // Возвращает false при ошибке формата.
+    static bool readFlatMap(const std::string& data, std::map<std::string, std::string>& result);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef NDJSON_H
+#define NDJSON_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+
+// Построчный разбор NDJSON из тела, которое приходит кусками произвольной длины.
+// Целиком в памяти держится только незаконченная строка.
+class NdjsonReader {
+public:
+    // Номер строки (с 1), её содержимое без "\n" и "\r". Пустые строки пропускаются.
+    using LineHandler = std::function<bool(size_t line, const char* data, size_t size)>;
+
+    explicit NdjsonReader(size_t maxLineBytes);
+
+    // false - строка длиннее maxLineBytes или обработчик вернул false
+    bool feed(const char* data, size_t size, const LineHandler& onLine);
+    // Отдаёт последнюю строку, если тело не закончилось переводом строки
+    bool finish(const LineHandler& onLine);
+
+    bool lineTooLong() const { return line_too_long_; }
+
+    // Плоский JSON-объект: строковые значения с разбором escape-последовательностей,
+    // числа, true/false и null (как пустая строка). Вложенные объекты и массивы - ошибка.
+    static bool readFlatObject(const char* data, size_t size,
+                               std::map<std::string, std::string>& result);
+
+private:
+    bool emit(const char* data, size_t size, const LineHandler& onLine);
+
+    std::string pending_;
+    size_t max_line_bytes_;
+    size_t line_ = 0;
+    bool line_too_long_ = false;
+};
+
+#endif
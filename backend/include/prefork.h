@@ -0,0 +1,34 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <functional>
+#include <string>
+
+// Многопроцессный режим: супервизор запускает воркеры, каждый слушает тот же порт
+// с SO_REUSEPORT, и ядро распределяет между ними соединения. Упавший воркер
+// перезапускается. Воркеры сообщают друг другу об изменениях задач через
+// AF_UNIX-сокеты, а снимки метрик кладут в общую память.
+class Prefork {
+public:
+    // Вызывать до создания любых потоков. В воркере возвращает true (номер - workerIndex()),
+    // в супервизоре возвращает false, когда все воркеры остановлены по SIGTERM/SIGINT.
+    // Если режим недоступен, возвращает true и процесс работает один.
+    static bool run(int workers);
+
+    static bool enabled();
+    static int workerIndex();
+
+    // Поток воркера: раз в секунду публикует snapshot() в общую память и передаёт
+    // receiver сообщения от других воркеров
+    static void startWorker(std::function<std::string()> snapshot,
+                            std::function<void(const std::string&)> receiver);
+    static void stopWorker();
+
+    // Сообщение всем остальным воркерам; при переполнении очереди получателя теряется
+    static void broadcast(const std::string& message);
+
+    // Снимки всех воркеров; для текущего берётся ownSnapshot, а не копия из памяти
+    static std::string workersJson(const std::string& ownSnapshot);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <string>
+
+// Token bucket по ключу (user id или IP клиента) с отдельными лимитами
+// для каждого класса маршрутов. Состояние хранится в шардированной таблице
+// ограниченного размера, давно не использованные ключи вытесняются.
+class RateLimiter {
+public:
+    enum class RouteClass {
+        Auth,
+        Read,
+        Write,
+        Count
+    };
+
+    struct Decision {
+        bool allowed;
+        int limit;
+        int remaining;
+        int retryAfterSec;
+    };
+
+    // ratePerSec <= 0 отключает ограничение для класса
+    static void configure(RouteClass routeClass, double ratePerSec, double burst);
+    static void setMaxKeys(size_t maxKeys);
+
+    static Decision check(RouteClass routeClass, const std::string& key);
+
+    // Адреса прокси, которым можно верить в X-Forwarded-For: IP или сети CIDR
+    // (IPv4 и IPv6) через запятую. "*" - доверять любому отправителю соединения (один
+    // прокси перед сервером, адрес его подсети неизвестен): клиентом станет самый правый
+    // адрес заголовка. Пустая строка - заголовок не используется. false - в списке есть нераспознанный элемент, он пропущен.
+    static bool setTrustedProxies(const std::string& proxies);
+    // Адрес клиента для ключа лимита. Если соединение пришло от доверенного прокси,
+    // это самый правый адрес X-Forwarded-For, который не является доверенным прокси:
+    // левую часть заголовка клиент может подделать, правую дописали наши прокси.
+    static std::string clientAddress(const std::string& remoteAddr, const std::string& forwardedFor);
+
+    static std::string statsJson();
+};
+
+#endif
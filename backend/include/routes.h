@@ -3,7 +3,14 @@
 
 #include <httplib.h>
 
-void setupRoutes(httplib::Server& server);
+#include <string>
+
+// adminToken - значение заголовка X-Admin-Token для /api/admin/*; пустой отключает эти маршруты.
+// authFailureDelayMs - задержка ответа на неверный логин или пароль.
+void setupRoutes(httplib::Server& server, const std::string& adminToken = "", int authFailureDelayMs = 0);
+
+// Метрики текущего процесса, тело ответа /api/metrics без раздела prefork
+std::string metricsJson();
 
 #endif
 
@@ -0,0 +1,41 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "task.h"
+
+struct DueEvent {
+    enum class Kind {
+        Reminder,
+        Overdue
+    };
+
+    Kind kind;
+    int64_t task_id;
+    int user_id;
+    int32_t due_date;
+};
+
+// Планировщик событий по сроку задач на иерархическом timer wheel
+// (4 уровня по 64 слота, шаг 1 секунда). Задачи подгружаются из индекса
+// по сроку только на горизонт в несколько дней вперёд, дальше - по одному дню.
+class DueScheduler {
+public:
+    static void start(int horizonDays, int reminderLeadSec);
+    static void stop();
+
+    // Слушатели вызываются из потока планировщика
+    static void addListener(std::function<void(const DueEvent&)> listener);
+
+    static void onTaskChanged(const Task& task);
+    static void onTaskDeleted(int64_t task_id);
+    // Перечитать горизонт из базы целиком: после массовых изменений,
+    // о которых планировщик не получал onTaskChanged
+    static void reload();
+
+    static std::string statsJson();
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include <functional>
+
+// Плавная остановка по SIGTERM/SIGINT. Сигнал принимается отдельным потоком,
+// а не асинхронным обработчиком, поэтому onSignal может останавливать сервер и брать блокировки.
+class Shutdown {
+public:
+    // Вызывать в начале main, до создания потоков: они наследуют маску сигналов
+    static void blockSignals();
+    // По первому сигналу вызывает onSignal и ждёт drained() не дольше drainTimeoutSec,
+    // иначе завершает процесс с кодом 1. Повторный сигнал завершает процесс сразу.
+    static void start(std::function<void()> onSignal, int drainTimeoutSec);
+    // Запросы дообработаны, дальше main сам закрывает ресурсы
+    static void drained();
+};
+
+#endif
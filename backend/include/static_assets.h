@@ -0,0 +1,23 @@
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+#include <httplib.h>
+#include <string>
+
+// Раздача собранного фронтенда (frontend/dist) из памяти. Файлы читаются один раз
+// при старте и сразу сжимаются в br/gzip с максимальным уровнем; готовые .br/.gz
+// рядом с файлом берутся как есть. Файлы из assets/ с хешем в имени кэшируются
+// навсегда, остальные (index.html) - с проверкой по ETag.
+class StaticAssets {
+public:
+    static bool load(const std::string& rootDir);
+    static bool enabled();
+
+    // Для GET/HEAD вне /api/: отвечает файлом, 304 или index.html для маршрутов SPA.
+    // false - запрос не к статике, его обрабатывают маршруты API.
+    static bool serve(const httplib::Request& req, httplib::Response& res);
+
+    static std::string statsJson();
+};
+
+#endif
@@ -1,39 +1,87 @@
 #ifndef TASK_H
 #define TASK_H
 
+#include <cstdint>
 #include <ctime>
 #include <string>
+#include <vector>
+
+class MsgpackWriter;
+
+enum class TaskPriority : uint8_t {
+    Low,
+    Medium,
+    High
+};
+
+enum class TaskStatus : uint8_t {
+    Pending,
+    InProgress,
+    Completed
+};
 
 class Task {
 public:
-    int id;
+    // Маркеры отсутствующих значений для due_date и created_at/updated_at
+    static const int32_t kNoDate = INT32_MIN;
+    static const int64_t kNoTime = INT64_MIN;
+
+    // Младшие 6 бит - корзина шарда: каждая вставка расходует 64 номера,
+    // поэтому id не помещается в 32 бита за время жизни шарда
+    int64_t id;
     int user_id;
     std::string title;
     std::string description;
-    std::string due_date;
-    std::string priority;
-    std::string status;
-    std::string created_at;
-    std::string updated_at;
+    int64_t created_at;   // секунды UTC от эпохи
+    int64_t updated_at;
+    int32_t due_date;     // дни от 1970-01-01
+    TaskPriority priority;
+    TaskStatus status;
+    bool overdue;         // вычисляется refreshStatus при чтении, не хранится
+    int version;          // растёт с каждым изменением строки, отдаётся как ETag
 
     Task();
     Task(int user_id,
          const std::string& title,
          const std::string& description,
-         const std::string& due_date,
-         const std::string& priority);
+         int32_t due_date,
+         TaskPriority priority);
 
     std::string toJson() const;
+    void toMsgpack(MsgpackWriter& writer) const;
     bool isValid() const;
     void refreshStatus(bool keepCompleted = true);
     static Task fromJson(const std::string& json);
 
+    // Преобразования на границе с БД и JSON
+    static const char* priorityName(TaskPriority priority);
+    static const char* statusName(TaskStatus status);
+    static bool parsePriority(const std::string& value, TaskPriority& out);
+    static bool parseStatus(const std::string& value, TaskStatus& out);
+
+    // Дата в формате parseTimestamp; время и пояс проверяются, но день берётся из даты
+    static bool parseDay(const std::string& value, int32_t& days);
+    // "YYYY-MM-DD" или "YYYY-MM-DD HH:MM[:SS[.дробь]]" (разделитель ' ' или 'T'), время
+    // UTC или с поясом "Z"/"+HH:MM"/"-HH:MM"; прочие символы после даты - ошибка
+    static bool parseTimestamp(const std::string& value, int64_t& seconds);
+    static std::string formatDay(int32_t days);
+    static std::string formatTimestamp(int64_t seconds);
+    // Текущий день UTC в днях от эпохи
+    static int32_t today();
+    // Понедельник недели, в которую попадает день
+    static int32_t weekStart(int32_t day);
+    // Ожидаемые версии из значения If-Match (метки через запятую, подходит любая):
+    // пустой список - "*", любая версия. Метка, которая не совпадёт ни с одной версией
+    // (слабая или не наша), даёт -1. Сжатый ответ несёт метку с суффиксом кодировки
+    // ("N-gzip"), она означает ту же версию.
+    static std::vector<int> ifMatchVersions(const std::string& value);
+
 private:
     static std::string currentTimestamp();
     static std::string normalizePriority(const std::string& value);
     static std::string normalizeStatus(const std::string& value);
-    static bool parseDate(const std::string& dateString, std::tm& outTm);
+    static bool parseDate(const std::string& dateString, std::tm& outTm, int& offsetSec);
     static std::time_t toUtcTimestamp(std::tm tm);
 };
 
-#endif // TASK_H
\ No newline at end of file
+#endif // TASK_H
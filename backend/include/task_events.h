@@ -0,0 +1,23 @@
+#ifndef TASK_EVENTS_H
+#define TASK_EVENTS_H
+
+#include <cstddef>
+#include <string>
+#include "task.h"
+
+// Уведомления об изменении задач: планировщик сроков, подписчики SSE и,
+// в prefork-режиме, остальные воркеры. Между воркерами передаются только
+// событие и id, получатель перечитывает задачу из базы.
+class TaskEvents {
+public:
+    // event - "task.created" или "task.updated"
+    static void changed(const char* event, const Task& task);
+    static void deleted(int user_id, int64_t task_id);
+    // Планировщик текущего процесса уже получил каждую задачу через onTaskChanged
+    static void imported(int user_id, size_t count);
+
+    // Сообщение от другого воркера
+    static void applyRemote(const std::string& message);
+};
+
+#endif
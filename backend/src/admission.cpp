@@ -0,0 +1,181 @@
+#include "../include/admission.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+size_t AdmissionControl::threads_ = CPPHTTPLIB_THREAD_POOL_COUNT;
+size_t AdmissionControl::max_depth_ = 256;
+size_t AdmissionControl::shed_depth_ = 128;
+std::chrono::milliseconds AdmissionControl::max_wait_(500);
+int AdmissionControl::retry_after_sec_ = 1;
+
+namespace {
+
+std::atomic<size_t> g_pending{0};
+std::atomic<size_t> g_peak_pending{0};
+std::atomic<unsigned long long> g_accepted{0};
+std::atomic<unsigned long long> g_rejected{0};
+std::atomic<unsigned long long> g_shed{0};
+std::atomic<unsigned long long> g_posted{0};
+
+// Сколько задача, которую выполняет поток, ждала в очереди. В обычном режиме задача -
+// соединение, и ожидание относится только к его первому запросу: shouldShed
+// сбрасывает значение при первой проверке.
+thread_local std::chrono::steady_clock::duration t_queue_wait{};
+
+class AdmissionQueue;
+
+// Очередь работающего сервера для AdmissionControl::post; обнуляется в shutdown
+std::mutex g_queue_mutex;
+AdmissionQueue* g_queue = nullptr;
+
+class AdmissionQueue final : public httplib::TaskQueue {
+public:
+    AdmissionQueue(size_t threads, size_t maxDepth)
+        : max_depth_(maxDepth), shutdown_(false) {
+        threads_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this] { work(); });
+        }
+        std::lock_guard<std::mutex> lock(g_queue_mutex);
+        g_queue = this;
+    }
+
+    bool enqueue(std::function<void()> fn) override {
+        return push(std::move(fn), false);
+    }
+
+    // admitted - работа уже принятого запроса: предел глубины не применяется
+    bool push(std::function<void()> fn, bool admitted) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (shutdown_) {
+                return false;
+            }
+            if (!admitted && max_depth_ > 0 && jobs_.size() >= max_depth_) {
+                g_rejected++;
+                return false;
+            }
+            jobs_.push_back({std::move(fn), std::chrono::steady_clock::now()});
+            size_t depth = jobs_.size();
+            g_pending = depth;
+            if (depth > g_peak_pending) {
+                g_peak_pending = depth;
+            }
+        }
+        if (admitted) {
+            g_posted++;
+        } else {
+            g_accepted++;
+        }
+        cond_.notify_one();
+        return true;
+    }
+
+    void shutdown() override {
+        {
+            std::lock_guard<std::mutex> lock(g_queue_mutex);
+            if (g_queue == this) {
+                g_queue = nullptr;
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        cond_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+private:
+    struct Job {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point enqueued_at;
+    };
+
+    void work() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [&] { return !jobs_.empty() || shutdown_; });
+                if (shutdown_ && jobs_.empty()) {
+                    break;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                g_pending = jobs_.size();
+            }
+            t_queue_wait = std::chrono::steady_clock::now() - job.enqueued_at;
+            job.fn();
+        }
+    }
+
+    size_t max_depth_;
+    bool shutdown_;
+    std::vector<std::thread> threads_;
+    std::deque<Job> jobs_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+}
+
+void AdmissionControl::configure(size_t threads, size_t maxDepth, size_t shedDepth,
+                                 int maxWaitMs, int retryAfterSec) {
+    threads_ = threads > 0 ? threads : 1;
+    max_depth_ = maxDepth;
+    shed_depth_ = shedDepth;
+    max_wait_ = std::chrono::milliseconds(maxWaitMs > 0 ? maxWaitMs : 0);
+    retry_after_sec_ = retryAfterSec > 0 ? retryAfterSec : 1;
+}
+
+httplib::TaskQueue* AdmissionControl::createQueue() {
+    return new AdmissionQueue(threads_, max_depth_);
+}
+
+bool AdmissionControl::shouldShed() {
+    std::chrono::steady_clock::duration waited = t_queue_wait;
+    t_queue_wait = std::chrono::steady_clock::duration::zero();
+    if (shed_depth_ > 0 && g_pending >= shed_depth_) {
+        return true;
+    }
+    // Запрос простоял в очереди дольше допустимого - клиент, скорее всего,
+    // уже ждёт слишком долго, лучше сразу ответить 503
+    return max_wait_.count() > 0 && waited > max_wait_;
+}
+
+bool AdmissionControl::post(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(g_queue_mutex);
+    return g_queue && g_queue->push(std::move(job), true);
+}
+
+void AdmissionControl::recordShed() {
+    g_shed++;
+}
+
+int AdmissionControl::retryAfterSeconds() {
+    return retry_after_sec_;
+}
+
+std::string AdmissionControl::statsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"threads\":" << threads_ << ","
+        << "\"max_depth\":" << max_depth_ << ","
+        << "\"shed_depth\":" << shed_depth_ << ","
+        << "\"pending\":" << g_pending.load() << ","
+        << "\"peak_pending\":" << g_peak_pending.load() << ","
+        << "\"accepted\":" << g_accepted.load() << ","
+        << "\"rejected\":" << g_rejected.load() << ","
+        << "\"shed\":" << g_shed.load() << ","
+        << "\"posted\":" << g_posted.load()
+        << "}";
+    return oss.str();
+}
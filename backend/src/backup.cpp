@@ -0,0 +1,219 @@
+#include "../include/backup.h"
+#include "../include/db.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+std::string Backup::dir_ = "./data/backups";
+int Backup::interval_sec_ = 0;
+int Backup::retention_ = 7;
+int Backup::pages_per_step_ = 64;
+int Backup::pause_ms_ = 10;
+
+namespace {
+
+std::mutex g_mutex;
+std::condition_variable g_cond;
+std::thread g_thread;
+bool g_running = false;
+bool g_requested = false;
+std::atomic<bool> g_stop{false};
+std::atomic<bool> g_in_progress{false};
+
+std::atomic<unsigned long long> g_snapshots{0};
+std::atomic<unsigned long long> g_failures{0};
+std::atomic<unsigned long long> g_pages_total{0};
+std::atomic<unsigned long long> g_restarts_total{0};
+
+// Результат последнего снимка, под g_mutex
+std::string g_last_name;
+std::string g_last_error;
+long long g_last_duration_ms = 0;
+long long g_last_pages = 0;
+long long g_last_steps = 0;
+
+const char* kPartialSuffix = ".partial";
+
+std::string escape(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += (c == '\n' || c == '\r') ? ' ' : c;
+    }
+    return out;
+}
+
+std::string snapshotName() {
+    std::time_t now = std::time(nullptr);
+    std::tm tm = *std::gmtime(&now);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &tm);
+    return buffer;
+}
+
+// Имена снимков сортируются по времени, оставляем последние retention
+void prune(const std::string& dir, int retention) {
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (entry.is_directory(ec) && name.find(kPartialSuffix) == std::string::npos) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; retention > 0 && i + retention < names.size(); ++i) {
+        fs::remove_all(fs::path(dir) / names[i], ec);
+    }
+}
+
+void takeSnapshot(const std::string& dir, int retention, int pagesPerStep, int pauseMs) {
+    auto start = std::chrono::steady_clock::now();
+    std::string name = snapshotName();
+    fs::path partial = fs::path(dir) / (name + kPartialSuffix);
+    fs::path final = fs::path(dir) / name;
+
+    std::error_code ec;
+    fs::remove_all(partial, ec);
+    fs::create_directories(partial, ec);
+
+    BackupProgress progress;
+    bool ok = !ec && Database::backupTo(partial.string(), pagesPerStep, pauseMs, g_stop, progress);
+    if (ok) {
+        // Снимок появляется под своим именем только целиком
+        fs::remove_all(final, ec);
+        fs::rename(partial, final, ec);
+        ok = !ec;
+        if (!ok) {
+            progress.error = ec.message();
+        }
+    } else if (ec) {
+        progress.error = ec.message();
+    }
+    if (!ok) {
+        fs::remove_all(partial, ec);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    (ok ? g_snapshots : g_failures)++;
+    g_pages_total += progress.pages;
+    g_restarts_total += progress.restarts;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_last_name = ok ? name : "";
+        g_last_error = progress.error;
+        g_last_duration_ms = elapsed;
+        g_last_pages = progress.pages;
+        g_last_steps = progress.steps;
+    }
+
+    if (ok) {
+        prune(dir, retention);
+    }
+}
+
+}
+
+void Backup::configure(const std::string& dir, int intervalSec, int retention,
+                       int pagesPerStep, int pauseMs) {
+    dir_ = dir;
+    interval_sec_ = std::max(0, intervalSec);
+    retention_ = std::max(1, retention);
+    pages_per_step_ = pagesPerStep > 0 ? pagesPerStep : 64;
+    pause_ms_ = std::max(0, pauseMs);
+}
+
+void Backup::start() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_running) {
+        return;
+    }
+    g_running = true;
+    g_stop = false;
+    g_thread = std::thread([] {
+        auto next = std::chrono::steady_clock::now() + std::chrono::seconds(interval_sec_);
+        std::unique_lock<std::mutex> lock(g_mutex);
+        while (!g_stop) {
+            auto wake = [] { return g_stop || g_requested; };
+            if (interval_sec_ > 0) {
+                g_cond.wait_until(lock, next, wake);
+            } else {
+                g_cond.wait(lock, wake);
+            }
+            if (g_stop) {
+                break;
+            }
+            bool scheduled = interval_sec_ > 0 && std::chrono::steady_clock::now() >= next;
+            if (!g_requested && !scheduled) {
+                continue;
+            }
+            g_requested = false;
+            g_in_progress = true;
+            lock.unlock();
+            takeSnapshot(dir_, retention_, pages_per_step_, pause_ms_);
+            lock.lock();
+            g_in_progress = false;
+            if (scheduled) {
+                next = std::chrono::steady_clock::now() + std::chrono::seconds(interval_sec_);
+            }
+        }
+    });
+}
+
+void Backup::stop() {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (!g_running) {
+            return;
+        }
+        g_stop = true;
+    }
+    g_cond.notify_all();
+    g_thread.join();
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_running = false;
+}
+
+bool Backup::requestSnapshot() {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (!g_running || g_requested || g_in_progress) {
+            return false;
+        }
+        g_requested = true;
+    }
+    g_cond.notify_all();
+    return true;
+}
+
+std::string Backup::statsJson() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::ostringstream oss;
+    oss << "{"
+        << "\"in_progress\":" << (g_in_progress || g_requested ? "true" : "false") << ","
+        << "\"interval_sec\":" << interval_sec_ << ","
+        << "\"retention\":" << retention_ << ","
+        << "\"snapshots\":" << g_snapshots.load() << ","
+        << "\"failures\":" << g_failures.load() << ","
+        << "\"pages_total\":" << g_pages_total.load() << ","
+        << "\"restarts_total\":" << g_restarts_total.load() << ","
+        << "\"last_snapshot\":\"" << g_last_name << "\","
+        << "\"last_error\":\"" << escape(g_last_error) << "\","
+        << "\"last_duration_ms\":" << g_last_duration_ms << ","
+        << "\"last_pages\":" << g_last_pages << ","
+        << "\"last_steps\":" << g_last_steps
+        << "}";
+    return oss.str();
+}
@@ -0,0 +1,389 @@
+#include "../include/compression.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#ifdef TODOMANAGER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef TODOMANAGER_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+bool Compression::enabled_ = true;
+size_t Compression::min_size_ = 1024;
+int Compression::level_ = 6;
+
+namespace {
+
+std::atomic<unsigned long long> g_compressed{0};
+std::atomic<unsigned long long> g_bytes_in{0};
+std::atomic<unsigned long long> g_bytes_out{0};
+std::atomic<unsigned long long> g_cpu_usec{0};
+std::atomic<unsigned long long> g_streamed{0};
+
+// Порядок - предпочтение сервера при одинаковом q
+const char* const kSupported[] = {
+#ifdef TODOMANAGER_HAVE_BROTLI
+    "br",
+#endif
+#ifdef TODOMANAGER_HAVE_ZLIB
+    "gzip",
+    "deflate",
+#endif
+    nullptr
+};
+
+std::string trim(const std::string& s) {
+    size_t begin = 0;
+    size_t end = s.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(s[begin]))) begin++;
+    while (end > begin && std::isspace(static_cast<unsigned char>(s[end - 1]))) end--;
+    return s.substr(begin, end - begin);
+}
+
+#ifdef TODOMANAGER_HAVE_ZLIB
+bool zlibCompress(const std::string& input, std::string& output, int windowBits, int level) {
+    z_stream strm{};
+    if (deflateInit2(&strm, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    output.resize(deflateBound(&strm, static_cast<uLong>(input.size())));
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    strm.avail_in = static_cast<uInt>(input.size());
+    strm.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    strm.avail_out = static_cast<uInt>(output.size());
+    int ret = deflate(&strm, Z_FINISH);
+    output.resize(strm.total_out);
+    deflateEnd(&strm);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+// Сжатие ответа с chunked content provider: вход приходит порциями, сжатые байты
+// отдаются по мере готовности, память не зависит от размера ответа
+class StreamEncoder {
+public:
+    StreamEncoder() = default;
+    StreamEncoder(const StreamEncoder&) = delete;
+    StreamEncoder& operator=(const StreamEncoder&) = delete;
+
+    ~StreamEncoder() {
+#ifdef TODOMANAGER_HAVE_ZLIB
+        if (zlib_) {
+            deflateEnd(&zstream_);
+        }
+#endif
+#ifdef TODOMANAGER_HAVE_BROTLI
+        if (brotli_) {
+            BrotliEncoderDestroyInstance(brotli_);
+        }
+#endif
+    }
+
+    bool init(const std::string& encoding, int level) {
+#ifdef TODOMANAGER_HAVE_BROTLI
+        if (encoding == "br") {
+            brotli_ = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+            return brotli_ && BrotliEncoderSetParameter(brotli_, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(level)) &&
+                   BrotliEncoderSetParameter(brotli_, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+        }
+#endif
+#ifdef TODOMANAGER_HAVE_ZLIB
+        if (encoding == "gzip" || encoding == "deflate") {
+            int windowBits = encoding == "gzip" ? 15 + 16 : 15;
+            zlib_ = deflateInit2(&zstream_, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            return zlib_;
+        }
+#endif
+        (void)encoding;
+        (void)level;
+        return false;
+    }
+
+    // finish - последняя порция: после неё поток закрыт. Выход дописывается в out
+    bool encode(const char* data, size_t size, bool finish, std::string& out) {
+        if (failed_ || finished_) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        size_t before = out.size();
+        failed_ = !run(data, size, finish, out);
+        finished_ = finish;
+        consumed_ += size;
+        g_bytes_in += size;
+        g_bytes_out += out.size() - before;
+        g_cpu_usec += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return !failed_;
+    }
+
+    size_t consumed() const { return consumed_; }
+    bool failed() const { return failed_; }
+
+private:
+    bool run(const char* data, size_t size, bool finish, std::string& out) {
+#ifdef TODOMANAGER_HAVE_BROTLI
+        if (brotli_) {
+            size_t availIn = size;
+            const uint8_t* nextIn = reinterpret_cast<const uint8_t*>(data);
+            BrotliEncoderOperation op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+            do {
+                size_t availOut = 0;
+                if (!BrotliEncoderCompressStream(brotli_, op, &availIn, &nextIn, &availOut, nullptr, nullptr)) {
+                    return false;
+                }
+                size_t produced = 0;
+                const uint8_t* output = BrotliEncoderTakeOutput(brotli_, &produced);
+                out.append(reinterpret_cast<const char*>(output), produced);
+            } while (availIn > 0 || BrotliEncoderHasMoreOutput(brotli_) ||
+                     (finish && !BrotliEncoderIsFinished(brotli_)));
+            return true;
+        }
+#endif
+#ifdef TODOMANAGER_HAVE_ZLIB
+        if (zlib_) {
+            zstream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zstream_.avail_in = static_cast<uInt>(size);
+            char buffer[16384];
+            int ret;
+            do {
+                zstream_.next_out = reinterpret_cast<Bytef*>(buffer);
+                zstream_.avail_out = sizeof(buffer);
+                ret = deflate(&zstream_, finish ? Z_FINISH : Z_NO_FLUSH);
+                if (ret == Z_STREAM_ERROR) {
+                    return false;
+                }
+                out.append(buffer, sizeof(buffer) - zstream_.avail_out);
+            } while (zstream_.avail_out == 0);
+            return !finish || ret == Z_STREAM_END;
+        }
+#endif
+        (void)data;
+        (void)size;
+        (void)finish;
+        (void)out;
+        return false;
+    }
+
+#ifdef TODOMANAGER_HAVE_ZLIB
+    z_stream zstream_{};
+    bool zlib_ = false;
+#endif
+#ifdef TODOMANAGER_HAVE_BROTLI
+    BrotliEncoderState* brotli_ = nullptr;
+#endif
+    size_t consumed_ = 0;
+    bool failed_ = false;
+    bool finished_ = false;
+};
+
+// Оборачивает провайдер ответа: он пишет в промежуточный DataSink, а в сокет уходит
+// сжатый поток. Провайдер получает смещение в несжатых данных, как без сжатия
+bool compressStream(httplib::Response& res, const std::string& encoding, int level) {
+    auto encoder = std::make_shared<StreamEncoder>();
+    if (!encoder->init(encoding, level)) {
+        return false;
+    }
+    g_streamed++;
+    httplib::ContentProvider inner = std::move(res.content_provider_);
+    res.content_provider_ = [inner, encoder](size_t, size_t length, httplib::DataSink& sink) {
+        // Пустая запись для httplib означает конец данных, поэтому пишем только готовые байты
+        auto forward = [&](const char* data, size_t size, bool finish) {
+            std::string out;
+            return encoder->encode(data, size, finish, out) && (out.empty() || sink.write(out.data(), out.size()));
+        };
+        httplib::DataSink proxy;
+        proxy.write = [&](const char* data, size_t size) { return forward(data, size, false); };
+        proxy.is_writable = [&] { return sink.is_writable(); };
+        proxy.done = [&] {
+            if (forward(nullptr, 0, true)) {
+                sink.done();
+            }
+        };
+        proxy.done_with_trailer = [&](const httplib::Headers& trailer) {
+            if (forward(nullptr, 0, true)) {
+                sink.done_with_trailer(trailer);
+            }
+        };
+        // Ошибка кодировщика обрывает ответ: иначе httplib звал бы провайдер снова
+        return inner(encoder->consumed(), length, proxy) && !encoder->failed();
+    };
+    return true;
+}
+
+// Сильная метка относится к байтам ответа: у сжатого варианта она своя,
+// с суффиксом кодировки, как у статики ("hash-gzip")
+void tagEncoding(httplib::Response& res, const std::string& encoding) {
+    res.set_header("Content-Encoding", encoding);
+    std::string etag = res.get_header_value("ETag");
+    if (etag.size() >= 2 && etag.front() == '"' && etag.back() == '"') {
+        res.headers.erase("ETag");
+        res.set_header("ETag", etag.substr(0, etag.size() - 1) + "-" + encoding + "\"");
+    }
+}
+
+}
+
+void Compression::configure(bool enabled, size_t minSize, int level) {
+    enabled_ = enabled;
+    min_size_ = minSize;
+    level_ = std::min(9, std::max(1, level));
+}
+
+std::string Compression::chooseEncoding(const std::string& acceptEncoding) {
+    std::string best;
+    double bestQ = 0.0;
+    double wildcardQ = -1.0;
+    std::map<std::string, double> explicitQ;
+
+    std::istringstream stream(acceptEncoding);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::string coding = trim(item);
+        double q = 1.0;
+        size_t semi = coding.find(';');
+        if (semi != std::string::npos) {
+            std::string param = trim(coding.substr(semi + 1));
+            coding = trim(coding.substr(0, semi));
+            if (param.rfind("q=", 0) == 0) {
+                q = std::atof(param.c_str() + 2);
+            }
+        }
+        std::transform(coding.begin(), coding.end(), coding.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (coding == "*") {
+            wildcardQ = q;
+        } else {
+            explicitQ[coding] = q;
+        }
+    }
+
+    for (const char* const* p = kSupported; *p; ++p) {
+        const char* coding = *p;
+        auto it = explicitQ.find(coding);
+        double q = it != explicitQ.end() ? it->second : (wildcardQ > 0 ? wildcardQ : 0.0);
+        if (q > bestQ) {
+            bestQ = q;
+            best = coding;
+        }
+    }
+    return best;
+}
+
+bool Compression::compress(const std::string& encoding, const std::string& input, std::string& output,
+                           int level) {
+    if (level < 0) {
+        level = level_;
+    }
+#ifdef TODOMANAGER_HAVE_BROTLI
+    if (encoding == "br") {
+        size_t size = BrotliEncoderMaxCompressedSize(input.size());
+        if (size == 0) {
+            return false;
+        }
+        output.resize(size);
+        if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                   input.size(), reinterpret_cast<const uint8_t*>(input.data()),
+                                   &size, reinterpret_cast<uint8_t*>(&output[0]))) {
+            return false;
+        }
+        output.resize(size);
+        return true;
+    }
+#endif
+#ifdef TODOMANAGER_HAVE_ZLIB
+    if (encoding == "gzip") {
+        return zlibCompress(input, output, 15 + 16, level);
+    }
+    if (encoding == "deflate") {
+        return zlibCompress(input, output, 15, level);
+    }
+#endif
+    (void)input;
+    (void)output;
+    (void)encoding;
+    (void)level;
+    return false;
+}
+
+// Дописывает поле в Vary: CORS к этому моменту мог выставить Vary: Origin
+static void addVary(httplib::Response& res, const std::string& field) {
+    std::string vary = res.get_header_value("Vary");
+    if (vary.find(field) != std::string::npos) {
+        return;
+    }
+    res.headers.erase("Vary");
+    res.set_header("Vary", vary.empty() ? field : vary + ", " + field);
+}
+
+void Compression::apply(const httplib::Request& req, httplib::Response& res) {
+    if (!enabled_ || res.has_header("Content-Encoding")) {
+        return;
+    }
+    // Потоковые ответы (выгрузка NDJSON) сжимаются по мере записи. SSE не сжимается:
+    // событие должно дойти до клиента сразу, а не копиться в буфере кодировщика
+    bool streamed = res.is_chunked_content_provider_ && res.content_provider_;
+    const std::string contentType = res.get_header_value("Content-Type");
+    if (contentType.rfind("application/json", 0) != 0 &&
+        contentType.rfind("application/msgpack", 0) != 0 &&
+        !(streamed && contentType.rfind("application/x-ndjson", 0) == 0)) {
+        return;
+    }
+    // Ответ на тот же URL может прийти сжатым или нет в зависимости от Accept-Encoding
+    // и размера, поэтому кэш должен различать его для любого сжимаемого ответа,
+    // а не только для того, что сжат сейчас
+    addVary(res, "Accept-Encoding");
+    // Размер потокового ответа заранее неизвестен, порог min_size к нему не применяется
+    if (!streamed && res.body.size() < min_size_) {
+        return;
+    }
+
+    std::string encoding = chooseEncoding(req.get_header_value("Accept-Encoding"));
+    if (encoding.empty()) {
+        return;
+    }
+
+    if (streamed) {
+        if (compressStream(res, encoding, level_)) {
+            tagEncoding(res, encoding);
+        }
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string compressed;
+    if (!compress(encoding, res.body, compressed) || compressed.size() >= res.body.size()) {
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    g_compressed++;
+    g_bytes_in += res.body.size();
+    g_bytes_out += compressed.size();
+    g_cpu_usec += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    res.body.swap(compressed);
+    tagEncoding(res, encoding);
+}
+
+std::string Compression::statsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"enabled\":" << (enabled_ ? "true" : "false") << ","
+        << "\"min_size\":" << min_size_ << ","
+        << "\"level\":" << level_ << ","
+        << "\"responses\":" << g_compressed.load() << ","
+        << "\"streamed\":" << g_streamed.load() << ","
+        << "\"bytes_in\":" << g_bytes_in.load() << ","
+        << "\"bytes_out\":" << g_bytes_out.load() << ","
+        << "\"cpu_usec\":" << g_cpu_usec.load()
+        << "}";
+    return oss.str();
+}
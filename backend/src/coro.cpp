@@ -0,0 +1,286 @@
+#include "../include/coro.h"
+#include "../include/event_server.h"
+#include "../include/admission.h"
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<unsigned long long> g_calls{0};
+std::atomic<unsigned long long> g_inline{0};
+std::atomic<unsigned long long> g_deferred{0};
+std::atomic<unsigned long long> g_blocked{0};
+std::atomic<unsigned long long> g_pooled{0};
+std::atomic<long long> g_suspended{0};
+std::atomic<long long> g_peak_suspended{0};
+
+// Где продолжается корутина после ожидания. Пока поток, начавший вызов, не решил,
+// освободиться ему (Deferred) или ждать ответа (Blocking), продолжения копятся в ready.
+enum class Mode { Starting, Blocking, Deferred };
+
+// Состояние одного вызова обработчика: живёт, пока корутина не закончится
+// и повторный проход запроса не заберёт ответ
+struct Call {
+    httplib::Request req;
+    httplib::Response res;
+    CoTask<void> task;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    Mode mode = Mode::Starting;
+    std::deque<std::coroutine_handle<>> ready;
+    EventServer::Resume resume;
+
+    void take(httplib::Response& out) {
+        task.result();
+        out = std::move(res);
+    }
+};
+
+// Вызов, корутина которого выполняется в этом потоке: Coro::resumer привязывает к нему
+// продолжения
+thread_local std::shared_ptr<Call> t_call;
+
+void step(const std::shared_ptr<Call>& call, std::coroutine_handle<> handle) {
+    std::shared_ptr<Call> outer = std::exchange(t_call, call);
+    handle.resume();
+    t_call = std::move(outer);
+}
+
+void toPool(const std::shared_ptr<Call>& call, std::coroutine_handle<> handle) {
+    g_pooled++;
+    if (!AdmissionControl::post([call, handle] { step(call, handle); })) {
+        step(call, handle);
+    }
+}
+
+// Продолжение из потока БД или таймера: в пул HTTP, а если начавший вызов поток
+// ждёт ответа (или ещё не решил) - ему
+void wake(const std::shared_ptr<Call>& call, std::coroutine_handle<> handle) {
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        if (call->mode != Mode::Deferred) {
+            call->ready.push_back(handle);
+            call->cond.notify_all();
+            return;
+        }
+    }
+    toPool(call, handle);
+}
+
+void finish(const std::shared_ptr<Call>& call) {
+    EventServer::Resume resume;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        call->done = true;
+        resume = std::move(call->resume);
+    }
+    if (resume) {
+        g_suspended--;
+        resume(call);
+    } else {
+        call->cond.notify_all();
+    }
+}
+
+struct Timer {
+    std::chrono::steady_clock::time_point at;
+    unsigned long long seq;
+    std::coroutine_handle<> caller;
+    Coro::Resumer resume;
+
+    bool operator>(const Timer& other) const {
+        return at != other.at ? at > other.at : seq > other.seq;
+    }
+};
+
+std::mutex g_timer_mutex;
+std::condition_variable g_timer_cond;
+std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> g_timers;
+std::thread g_timer_thread;
+unsigned long long g_timer_seq = 0;
+bool g_timer_stop = false;
+std::atomic<unsigned long long> g_timers_fired{0};
+
+void timerLoop() {
+    std::unique_lock<std::mutex> lock(g_timer_mutex);
+    for (;;) {
+        if (g_timers.empty()) {
+            if (g_timer_stop) {
+                break;
+            }
+            g_timer_cond.wait(lock);
+            continue;
+        }
+        Timer next = g_timers.top();
+        if (!g_timer_stop && next.at > std::chrono::steady_clock::now()) {
+            g_timer_cond.wait_until(lock, next.at);
+            continue;
+        }
+        g_timers.pop();
+        lock.unlock();
+        g_timers_fired++;
+        next.resume(next.caller);
+        lock.lock();
+    }
+}
+
+}
+
+httplib::Server::Handler Coro::adapt(const std::string& pattern, Handler handler) {
+    // Совпадения req.matches ссылаются на строку исходного запроса, в копии
+    // их нужно найти заново. Шаблоны с :param разбираются в path_params.
+    std::shared_ptr<std::regex> regex;
+    if (pattern.find("/:") == std::string::npos) {
+        regex = std::make_shared<std::regex>(pattern);
+    }
+    return [regex, handler](const httplib::Request& req, httplib::Response& res) {
+        if (auto state = EventServer::resumed()) {
+            std::static_pointer_cast<Call>(state)->take(res);
+            return;
+        }
+        g_calls++;
+
+        auto call = std::make_shared<Call>();
+        call->req = req;
+        if (regex) {
+            std::regex_match(call->req.path, call->req.matches, *regex);
+        }
+        // Заголовки, выставленные pre-routing (X-RateLimit-*)
+        call->res = res;
+        call->task = handler(call->req, call->res);
+        {
+            std::shared_ptr<Call> outer = std::exchange(t_call, call);
+            call->task.start([call] { finish(call); });
+            t_call = std::move(outer);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(call->mutex);
+            if (call->done) {
+                g_inline++;
+                call->take(res);
+                return;
+            }
+        }
+
+        // Пока mode - Starting, продолжения не выполняются, и done не меняется
+        EventServer::Resume resume = EventServer::defer();
+        if (resume) {
+            g_deferred++;
+            long long suspended = ++g_suspended;
+            long long peak = g_peak_suspended.load();
+            while (suspended > peak && !g_peak_suspended.compare_exchange_weak(peak, suspended)) {
+            }
+            // Ответ отправит повторный проход запроса, поток свободен
+            std::deque<std::coroutine_handle<>> ready;
+            {
+                std::lock_guard<std::mutex> lock(call->mutex);
+                call->mode = Mode::Deferred;
+                call->resume = std::move(resume);
+                ready.swap(call->ready);
+            }
+            for (auto handle : ready) {
+                toPool(call, handle);
+            }
+            return;
+        }
+
+        // Без движка epoll поток ждёт ответа и сам выполняет продолжения: через
+        // общий пул они могли бы не дождаться свободного потока
+        g_blocked++;
+        std::unique_lock<std::mutex> lock(call->mutex);
+        call->mode = Mode::Blocking;
+        for (;;) {
+            call->cond.wait(lock, [&] { return call->done || !call->ready.empty(); });
+            if (call->ready.empty()) {
+                break;
+            }
+            std::coroutine_handle<> handle = call->ready.front();
+            call->ready.pop_front();
+            lock.unlock();
+            step(call, handle);
+            lock.lock();
+        }
+        lock.unlock();
+        call->take(res);
+    };
+}
+
+void Coro::get(httplib::Server& server, const std::string& pattern, Handler handler) {
+    server.Get(pattern, adapt(pattern, std::move(handler)));
+}
+
+void Coro::post(httplib::Server& server, const std::string& pattern, Handler handler) {
+    server.Post(pattern, adapt(pattern, std::move(handler)));
+}
+
+void Coro::put(httplib::Server& server, const std::string& pattern, Handler handler) {
+    server.Put(pattern, adapt(pattern, std::move(handler)));
+}
+
+void Coro::del(httplib::Server& server, const std::string& pattern, Handler handler) {
+    server.Delete(pattern, adapt(pattern, std::move(handler)));
+}
+
+Coro::Resumer Coro::resumer() {
+    std::shared_ptr<Call> call = t_call;
+    if (!call) {
+        return [](std::coroutine_handle<> handle) { handle.resume(); };
+    }
+    return [call](std::coroutine_handle<> handle) { wake(call, handle); };
+}
+
+void Coro::schedule(std::chrono::milliseconds delay, std::coroutine_handle<> caller, Resumer resume) {
+    {
+        std::lock_guard<std::mutex> lock(g_timer_mutex);
+        if (!g_timer_stop) {
+            if (!g_timer_thread.joinable()) {
+                g_timer_thread = std::thread(timerLoop);
+            }
+            g_timers.push({std::chrono::steady_clock::now() + delay, g_timer_seq++, caller, std::move(resume)});
+            g_timer_cond.notify_one();
+            return;
+        }
+    }
+    resume(caller);
+}
+
+void Coro::stop() {
+    {
+        std::lock_guard<std::mutex> lock(g_timer_mutex);
+        g_timer_stop = true;
+    }
+    g_timer_cond.notify_one();
+    if (g_timer_thread.joinable()) {
+        g_timer_thread.join();
+    }
+}
+
+std::string Coro::statsJson() {
+    size_t timers;
+    {
+        std::lock_guard<std::mutex> lock(g_timer_mutex);
+        timers = g_timers.size();
+    }
+    std::ostringstream oss;
+    oss << "{"
+        << "\"calls\":" << g_calls.load() << ","
+        << "\"completed_inline\":" << g_inline.load() << ","
+        << "\"deferred\":" << g_deferred.load() << ","
+        << "\"blocked\":" << g_blocked.load() << ","
+        << "\"pooled\":" << g_pooled.load() << ","
+        << "\"suspended\":" << g_suspended.load() << ","
+        << "\"peak_suspended\":" << g_peak_suspended.load() << ","
+        << "\"timers\":" << timers << ","
+        << "\"timers_fired\":" << g_timers_fired.load()
+        << "}";
+    return oss.str();
+}
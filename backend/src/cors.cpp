@@ -0,0 +1,95 @@
+#include "../include/cors.h"
+#include <atomic>
+#include <sstream>
+#include <unordered_set>
+
+namespace {
+
+const char* const kAllowMethods = "GET, POST, PUT, DELETE, OPTIONS";
+const char* const kAllowHeaders = "Content-Type, Authorization, If-Match, Idempotency-Key";
+const char* const kExposeHeaders = "ETag, Idempotent-Replayed";
+
+// Заполняется в configure до запуска сервера, дальше только читается
+bool g_any_origin = true;
+std::unordered_set<std::string> g_origins;
+std::string g_max_age = "7200";
+
+std::atomic<unsigned long long> g_preflights{0};
+std::atomic<unsigned long long> g_rejected{0};
+
+// false - источник не разрешён, CORS-заголовков в ответе не будет
+bool allowOrigin(const httplib::Request& req, httplib::Response& res) {
+    if (g_any_origin) {
+        res.set_header("Access-Control-Allow-Origin", "*");
+        return true;
+    }
+    // Ответ зависит от Origin, общие кэши должны это учитывать
+    res.set_header("Vary", "Origin");
+    if (!req.has_header("Origin")) {
+        return false;
+    }
+    std::string origin = req.get_header_value("Origin");
+    if (g_origins.count(origin) == 0) {
+        g_rejected++;
+        return false;
+    }
+    res.set_header("Access-Control-Allow-Origin", origin);
+    return true;
+}
+
+}
+
+void Cors::configure(const std::string& origins, int maxAgeSec) {
+    g_origins.clear();
+    g_any_origin = false;
+    std::istringstream stream(origins);
+    std::string origin;
+    while (std::getline(stream, origin, ',')) {
+        size_t begin = origin.find_first_not_of(" \t");
+        size_t end = origin.find_last_not_of(" \t/");
+        if (begin == std::string::npos || end < begin) {
+            continue;
+        }
+        origin = origin.substr(begin, end - begin + 1);
+        if (origin == "*") {
+            g_any_origin = true;
+        }
+        g_origins.insert(origin);
+    }
+    if (g_origins.empty()) {
+        g_any_origin = true;
+    }
+    g_max_age = maxAgeSec > 0 ? std::to_string(maxAgeSec) : "";
+}
+
+void Cors::apply(const httplib::Request& req, httplib::Response& res) {
+    // Methods/Headers нужны браузеру только в ответе на preflight. ETag задачи
+    // и признак повтора скрипт другого источника видит, только если они открыты явно.
+    if (allowOrigin(req, res) && (res.has_header("ETag") || res.has_header("Idempotent-Replayed"))) {
+        res.set_header("Access-Control-Expose-Headers", kExposeHeaders);
+    }
+}
+
+void Cors::preflight(const httplib::Request& req, httplib::Response& res) {
+    g_preflights++;
+    res.status = 204;
+    if (!allowOrigin(req, res)) {
+        return;
+    }
+    res.set_header("Access-Control-Allow-Methods", kAllowMethods);
+    res.set_header("Access-Control-Allow-Headers", kAllowHeaders);
+    if (!g_max_age.empty()) {
+        res.set_header("Access-Control-Max-Age", g_max_age);
+    }
+}
+
+std::string Cors::statsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"any_origin\":" << (g_any_origin ? "true" : "false") << ","
+        << "\"origins\":" << (g_any_origin ? 0 : g_origins.size()) << ","
+        << "\"preflights\":" << g_preflights.load() << ","
+        << "\"rejected\":" << g_rejected.load()
+        << "}";
+    return oss.str();
+}
@@ -3,9 +3,140 @@
 #include <sstream>
 #include <ctime>
 #include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
 
 std::string Database::db_path_ = "";
 
+namespace {
+
+std::thread g_backfill_thread;
+std::atomic<bool> g_backfill_stop{false};
+std::atomic<bool> g_backfill_done{false};
+std::atomic<unsigned long long> g_backfill_rows{0};
+std::atomic<unsigned long long> g_backfill_batches{0};
+// Строки с неразбираемым created_at/updated_at: время взято из другой колонки или текущее
+std::atomic<unsigned long long> g_backfill_bad_timestamps{0};
+std::atomic<unsigned long long> g_backfill_stats_repaired{0};
+// Миграцию ведёт только первый воркер, остальные узнают о её конце из базы,
+// проверяя не чаще раза в секунду (steady_clock, секунды)
+std::atomic<int64_t> g_backfill_probe{0};
+
+const char* kTaskColumns =
+    "id, user_id, title, description, due_day, priority, status, created_ts, updated_ts, "
+    "due_date, created_at, updated_at, version";
+
+// Все колонки tasks для переноса строк между шардами
+const char* kTaskCopyColumns =
+    "id, user_id, title, description, due_date, priority, status, created_at, updated_at, "
+    "created_ts, updated_ts, due_day, completed_ts, version";
+
+// due_day из старой TEXT-колонки due_date
+const char* kDueDayFromText =
+    "CASE WHEN due_date GLOB '[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]*' "
+    "THEN CAST(julianday(substr(due_date, 1, 10)) - 2440587.5 AS INTEGER) ELSE NULL END";
+
+// Срок задачи в запросах по due_day, пока миграция не дошла до всех строк
+const std::string kDueDayOrText = std::string("COALESCE(due_day, ") + kDueDayFromText + ")";
+
+// Время из TEXT-колонки; неразбираемое берётся из второй колонки, иначе текущее
+const char* kCreatedTsFromText =
+    "COALESCE(CAST(strftime('%s', created_at) AS INTEGER), "
+    "CAST(strftime('%s', updated_at) AS INTEGER), CAST(strftime('%s', 'now') AS INTEGER))";
+const char* kUpdatedTsFromText =
+    "COALESCE(CAST(strftime('%s', updated_at) AS INTEGER), "
+    "CAST(strftime('%s', created_at) AS INTEGER), CAST(strftime('%s', 'now') AS INTEGER))";
+
+// Младшие kBucketBits бит id задачи - корзина пользователя
+const int kBucketBits = 6;
+const int kBuckets = 1 << kBucketBits;
+
+// Ранг приоритета для сортировки "что делать дальше": high - 0, low - 2.
+// Выражение должно совпадать в индексе idx_tasks_next и в запросе getNextTasks.
+const char* kPriorityRank =
+    "(CASE priority WHEN 'high' THEN 0 WHEN 'medium' THEN 1 ELSE 2 END)";
+
+// Раскладка корзин по шардам, загружается из каталога в initDatabase
+std::vector<int> g_bucket_shard(kBuckets, 0);
+int g_shard_count = 1;
+// id задач, созданных до шардирования, не содержат корзину
+int64_t g_legacy_max_id = 0;
+bool g_has_legacy_routes = false;
+
+// По одному простаивающему соединению на шард. Пока файл открыт, закрытие соединений
+// запросов не запускает checkpoint и не удаляет WAL, иначе каждая запись стоит десятки мс.
+std::vector<sqlite3*> g_keepalive;
+
+}
+
+// Потоки исполнителя БД закрепляют за собой по соединению на файл: openConnection
+// возвращает уже открытое, closeConnection его не закрывает
+static thread_local bool t_pinned = false;
+static thread_local std::unordered_map<std::string, sqlite3*> t_connections;
+
+// Все соединения ждут блокировку вместо немедленного SQLITE_BUSY:
+// фоновая миграция пишет параллельно с запросами
+static bool openConnection(const std::string& path, sqlite3** db) {
+    if (t_pinned) {
+        auto it = t_connections.find(path);
+        if (it != t_connections.end()) {
+            *db = it->second;
+            return true;
+        }
+    }
+    if (sqlite3_open(path.c_str(), db) != SQLITE_OK) {
+        return false;
+    }
+    sqlite3_busy_timeout(*db, 5000);
+    if (t_pinned) {
+        t_connections[path] = *db;
+    }
+    return true;
+}
+
+// Для соединений запросов вместо sqlite3_close
+static void closeConnection(sqlite3* db) {
+    if (!t_pinned) {
+        sqlite3_close(db);
+    }
+}
+
+// Подготовленные запросы закреплённых соединений. Подготовка UPDATE ... RETURNING
+// и запросов task_stats дороже их выполнения, поэтому на горячем пути записи
+// потоки исполнителя готовят их один раз. Без закрепления - обычные prepare/finalize.
+static thread_local std::unordered_map<sqlite3*, std::unordered_map<std::string, sqlite3_stmt*>> t_statements;
+
+static bool prepareStatement(sqlite3* db, const std::string& sql, sqlite3_stmt** stmt) {
+    if (!t_pinned) {
+        return sqlite3_prepare_v2(db, sql.c_str(), -1, stmt, nullptr) == SQLITE_OK;
+    }
+    auto& cache = t_statements[db];
+    auto it = cache.find(sql);
+    if (it != cache.end()) {
+        *stmt = it->second;
+        return true;
+    }
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    cache.emplace(sql, *stmt);
+    return true;
+}
+
+// Вместо sqlite3_finalize для запросов из prepareStatement
+static void finishStatement(sqlite3_stmt* stmt) {
+    if (t_pinned) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    } else {
+        sqlite3_finalize(stmt);
+    }
+}
+
 static std::string getCurrentTimestamp() {
     auto now = std::time(nullptr);
     std::ostringstream oss;
@@ -13,28 +144,468 @@ static std::string getCurrentTimestamp() {
     return oss.str();
 }
 
-bool Database::initDatabase(const std::string& dbPath) {
-    db_path_ = dbPath;
-    sqlite3* db;
+static std::string columnString(sqlite3_stmt* stmt, int col) {
+    const unsigned char* text = sqlite3_column_text(stmt, col);
+    return text ? reinterpret_cast<const char*>(text) : std::string();
+}
+
+// Строка из SELECT kTaskColumns. Пока фоновая миграция не дошла до строки,
+// целочисленные колонки NULL и значения разбираются из старых TEXT-колонок.
+static void readTaskRow(sqlite3_stmt* stmt, Task& task) {
+    task.id = sqlite3_column_int64(stmt, 0);
+    task.user_id = sqlite3_column_int(stmt, 1);
+    task.title = columnString(stmt, 2);
+    task.description = columnString(stmt, 3);
+    Task::parsePriority(columnString(stmt, 5), task.priority);
+    Task::parseStatus(columnString(stmt, 6), task.status);
     
-    if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+    if (sqlite3_column_type(stmt, 4) != SQLITE_NULL) {
+        task.due_date = sqlite3_column_int(stmt, 4);
+    } else if (!Task::parseDay(columnString(stmt, 9), task.due_date)) {
+        task.due_date = Task::kNoDate;
+    }
+    if (sqlite3_column_type(stmt, 7) != SQLITE_NULL) {
+        task.created_at = sqlite3_column_int64(stmt, 7);
+    } else if (!Task::parseTimestamp(columnString(stmt, 10), task.created_at)) {
+        task.created_at = Task::kNoTime;
+    }
+    if (sqlite3_column_type(stmt, 8) != SQLITE_NULL) {
+        task.updated_at = sqlite3_column_int64(stmt, 8);
+    } else if (!Task::parseTimestamp(columnString(stmt, 11), task.updated_at)) {
+        task.updated_at = Task::kNoTime;
+    }
+    task.version = sqlite3_column_int(stmt, 12);
+    task.refreshStatus();
+}
+
+static void bindDay(sqlite3_stmt* stmt, int index, int32_t day) {
+    if (day == Task::kNoDate) {
+        sqlite3_bind_null(stmt, index);
+    } else {
+        sqlite3_bind_int(stmt, index, day);
+    }
+}
+
+static bool hasColumn(sqlite3* db, const char* table, const char* column) {
+    std::string sql = std::string("PRAGMA table_info(") + table + ")";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
         return false;
     }
+    bool found = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (columnString(stmt, 1) == column) {
+            found = true;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Целочисленные колонки времени: created_ts/updated_ts - секунды UTC, due_day - дни от эпохи.
+// TEXT-колонки остаются и продолжают записываться для совместимости со старыми версиями.
+static bool migrateTaskTimeColumns(sqlite3* db) {
+    const char* columns[][2] = {
+        {"created_ts", "ALTER TABLE tasks ADD COLUMN created_ts INTEGER"},
+        {"updated_ts", "ALTER TABLE tasks ADD COLUMN updated_ts INTEGER"},
+        {"due_day", "ALTER TABLE tasks ADD COLUMN due_day INTEGER"},
+    };
+    for (auto& column : columns) {
+        if (!hasColumn(db, "tasks", column[0]) &&
+            sqlite3_exec(db, column[1], nullptr, nullptr, nullptr) != SQLITE_OK) {
+            return false;
+        }
+    }
     
-    const char* createUsersTable = R"(
-        CREATE TABLE IF NOT EXISTS users (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            username TEXT UNIQUE NOT NULL,
-            password_hash TEXT NOT NULL,
-            created_at TEXT NOT NULL
+    const char* createIndexes = R"(
+        CREATE INDEX IF NOT EXISTS idx_tasks_user_created ON tasks(user_id, created_ts DESC);
+        CREATE INDEX IF NOT EXISTS idx_tasks_user_due ON tasks(user_id, due_day);
+        CREATE INDEX IF NOT EXISTS idx_tasks_pending_due ON tasks(user_id, due_day)
+            WHERE status != 'completed' AND due_day IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_tasks_due_pending ON tasks(due_day)
+            WHERE status != 'completed' AND due_day IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_tasks_unconverted ON tasks(id) WHERE created_ts IS NULL;
+    )";
+    return sqlite3_exec(db, createIndexes, nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+// Невыполненные задачи в порядке "что делать дальше": ранг приоритета, срок
+// (без срока - в конце), id. Индекс по выражению поддерживает сама SQLite,
+// поэтому отдельная колонка ранга и её заполнение для старых строк не нужны.
+static bool createNextIndex(sqlite3* db) {
+    std::string sql = std::string("CREATE INDEX IF NOT EXISTS idx_tasks_next ON tasks(user_id, ") +
+                      kPriorityRank + ", due_day IS NULL, due_day) WHERE status != 'completed'";
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+static int userBucket(int user_id) {
+    return static_cast<int>((static_cast<uint32_t>(user_id) * 2654435761u) >> (32 - kBucketBits));
+}
+
+static void userBucketFunction(sqlite3_context* context, int, sqlite3_value** argv) {
+    sqlite3_result_int(context, userBucket(sqlite3_value_int(argv[0])));
+}
+
+static int64_t queryInt(sqlite3* db, const char* sql, int64_t fallback = 0) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return fallback;
+    }
+    int64_t value = fallback;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+// Поля задачи, от которых зависят счётчики task_stats
+struct StatsFacts {
+    TaskStatus status = TaskStatus::Pending;
+    TaskPriority priority = TaskPriority::Medium;
+    int32_t due_day = Task::kNoDate;
+    int64_t completed_ts = Task::kNoTime;
+};
+
+static StatsFacts factsOf(const Task& task, int64_t completedTs) {
+    StatsFacts facts;
+    facts.status = task.status;
+    facts.priority = task.priority;
+    facts.due_day = task.due_date;
+    facts.completed_ts = task.status == TaskStatus::Completed ? completedTs : Task::kNoTime;
+    return facts;
+}
+
+// Строка SELECT status, priority, due_day, completed_ts
+static StatsFacts readStatsFacts(sqlite3_stmt* stmt, int col) {
+    StatsFacts facts;
+    Task::parseStatus(columnString(stmt, col), facts.status);
+    Task::parsePriority(columnString(stmt, col + 1), facts.priority);
+    if (sqlite3_column_type(stmt, col + 2) != SQLITE_NULL) {
+        facts.due_day = sqlite3_column_int(stmt, col + 2);
+    }
+    if (sqlite3_column_type(stmt, col + 3) != SQLITE_NULL) {
+        facts.completed_ts = sqlite3_column_int64(stmt, col + 3);
+    }
+    return facts;
+}
+
+static void countFacts(TaskStats& stats, const StatsFacts& facts, int sign, int32_t today) {
+    stats.total += sign;
+    switch (facts.status) {
+        case TaskStatus::Pending: stats.pending += sign; break;
+        case TaskStatus::InProgress: stats.in_progress += sign; break;
+        case TaskStatus::Completed: stats.completed += sign; break;
+    }
+    switch (facts.priority) {
+        case TaskPriority::Low: stats.priority_low += sign; break;
+        case TaskPriority::Medium: stats.priority_medium += sign; break;
+        case TaskPriority::High: stats.priority_high += sign; break;
+    }
+    if (facts.status != TaskStatus::Completed && facts.due_day != Task::kNoDate && facts.due_day < today) {
+        stats.overdue += sign;
+    }
+    if (facts.status == TaskStatus::Completed && facts.completed_ts != Task::kNoTime &&
+        facts.completed_ts >= static_cast<int64_t>(Task::weekStart(today)) * 86400) {
+        stats.completed_this_week += sign;
+    }
+}
+
+// Невыполненные задачи пользователя со сроком в [fromDay, toDay): по idx_tasks_user_due
+static int countPendingDue(sqlite3* db, int user_id, int32_t fromDay, int32_t toDay) {
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT status FROM tasks WHERE user_id = ? AND due_day >= ? AND due_day < ?";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_int(stmt, 2, fromDay);
+    sqlite3_bind_int(stmt, 3, toDay);
+    int count = 0;
+    TaskStatus status;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (Task::parseStatus(columnString(stmt, 0), status) && status != TaskStatus::Completed) {
+            count++;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+// overdue хранится на день as_of_day, completed_week - на неделю week_start. Сдвиг к today:
+// просроченными становятся задачи со сроком между этими днями, с новой неделей счётчик
+// выполненных начинается с нуля (все выполнения новой недели - записи после сдвига).
+// Сдвиг не O(1): он просматривает по idx_tasks_user_due задачи пользователя со сроком
+// в пропущенных днях. Сдвинутая строка сохраняется (rollTaskStats при записи или первом
+// чтении за день в getTaskStats), поэтому просмотр бывает раз в день на пользователя,
+// а остальные чтения статистики - одна строка task_stats.
+static int rolledOverdue(sqlite3* db, int user_id, int overdue, int32_t asOfDay, int32_t today) {
+    if (asOfDay < today) {
+        return overdue + countPendingDue(db, user_id, asOfDay, today);
+    }
+    if (asOfDay > today) {
+        return overdue - countPendingDue(db, user_id, today, asOfDay);
+    }
+    return overdue;
+}
+
+static const char* kStatsColumns =
+    "total, pending, in_progress, completed, priority_low, priority_medium, priority_high, "
+    "overdue, completed_week, as_of_day, week_start";
+
+// Строка task_stats пользователя, приведённая к today без записи. false - строки нет.
+// stale - строка хранится на другой день или неделю, и приведение её пересчитало.
+static bool readTaskStats(sqlite3* db, int user_id, int32_t today, TaskStats& stats, bool* stale = nullptr) {
+    std::string sql = std::string("SELECT ") + kStatsColumns + " FROM task_stats WHERE user_id = ?";
+    sqlite3_stmt* stmt;
+    if (!prepareStatement(db, sql, &stmt)) {
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, user_id);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    int32_t asOfDay = today;
+    if (found) {
+        stats.total = sqlite3_column_int(stmt, 0);
+        stats.pending = sqlite3_column_int(stmt, 1);
+        stats.in_progress = sqlite3_column_int(stmt, 2);
+        stats.completed = sqlite3_column_int(stmt, 3);
+        stats.priority_low = sqlite3_column_int(stmt, 4);
+        stats.priority_medium = sqlite3_column_int(stmt, 5);
+        stats.priority_high = sqlite3_column_int(stmt, 6);
+        stats.overdue = sqlite3_column_int(stmt, 7);
+        stats.completed_this_week = sqlite3_column_int(stmt, 10) == Task::weekStart(today) ? sqlite3_column_int(stmt, 8) : 0;
+        asOfDay = sqlite3_column_int(stmt, 9);
+        if (stale) {
+            *stale = asOfDay != today || sqlite3_column_int(stmt, 10) != Task::weekStart(today);
+        }
+    }
+    finishStatement(stmt);
+    if (found) {
+        stats.overdue = rolledOverdue(db, user_id, stats.overdue, asOfDay, today);
+    }
+    return found;
+}
+
+// В транзакции записи до изменения задач: создаёт строку пользователя и сдвигает её к today
+static bool rollTaskStats(sqlite3* db, int user_id, int32_t today) {
+    TaskStats stats;
+    if (!readTaskStats(db, user_id, today, stats)) {
+        std::string sql = std::string("INSERT INTO task_stats (user_id, ") + kStatsColumns +
+                          ") VALUES (?, 0, 0, 0, 0, 0, 0, 0, 0, 0, ?, ?)";
+        sqlite3_stmt* stmt;
+        if (!prepareStatement(db, sql, &stmt)) {
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, user_id);
+        sqlite3_bind_int(stmt, 2, today);
+        sqlite3_bind_int(stmt, 3, Task::weekStart(today));
+        bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+        finishStatement(stmt);
+        return ok;
+    }
+    sqlite3_stmt* stmt;
+    const char* sql = "UPDATE task_stats SET overdue = ?, completed_week = ?, as_of_day = ?, week_start = ? "
+                      "WHERE user_id = ? AND (as_of_day != ? OR week_start != ?)";
+    if (!prepareStatement(db, sql, &stmt)) {
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, stats.overdue);
+    sqlite3_bind_int(stmt, 2, stats.completed_this_week);
+    sqlite3_bind_int(stmt, 3, today);
+    sqlite3_bind_int(stmt, 4, Task::weekStart(today));
+    sqlite3_bind_int(stmt, 5, user_id);
+    sqlite3_bind_int(stmt, 6, today);
+    sqlite3_bind_int(stmt, 7, Task::weekStart(today));
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    finishStatement(stmt);
+    return ok;
+}
+
+// После rollTaskStats в той же транзакции
+static bool applyTaskStats(sqlite3* db, int user_id, const TaskStats& delta) {
+    const char* sql = "UPDATE task_stats SET total = total + ?, pending = pending + ?, "
+                      "in_progress = in_progress + ?, completed = completed + ?, "
+                      "priority_low = priority_low + ?, priority_medium = priority_medium + ?, "
+                      "priority_high = priority_high + ?, overdue = overdue + ?, "
+                      "completed_week = completed_week + ? WHERE user_id = ?";
+    sqlite3_stmt* stmt;
+    if (!prepareStatement(db, sql, &stmt)) {
+        return false;
+    }
+    int values[] = {delta.total, delta.pending, delta.in_progress, delta.completed, delta.priority_low,
+                    delta.priority_medium, delta.priority_high, delta.overdue, delta.completed_this_week};
+    for (int i = 0; i < 9; ++i) {
+        sqlite3_bind_int(stmt, i + 1, values[i]);
+    }
+    sqlite3_bind_int(stmt, 10, user_id);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(db) == 1;
+    finishStatement(stmt);
+    return ok;
+}
+
+static bool sameStats(const TaskStats& a, const TaskStats& b) {
+    return a.total == b.total && a.pending == b.pending && a.in_progress == b.in_progress &&
+           a.completed == b.completed && a.priority_low == b.priority_low &&
+           a.priority_medium == b.priority_medium && a.priority_high == b.priority_high &&
+           a.overdue == b.overdue && a.completed_this_week == b.completed_this_week;
+}
+
+// Пересчёт task_stats файла из tasks одним проходом. repair - записать пересчитанное.
+// stale - если передан, сюда попадают пользователи с расходящимися счётчиками.
+static bool checkStatsFile(sqlite3* db, bool repair, int& users, int& mismatched,
+                           std::vector<int>* stale = nullptr) {
+    if (sqlite3_exec(db, repair ? "BEGIN IMMEDIATE" : "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    int32_t today = Task::today();
+    std::map<int, TaskStats> fresh;
+    std::vector<int> stored;
+    sqlite3_stmt* stmt;
+    bool ok = sqlite3_prepare_v2(db, "SELECT user_id, status, priority, due_day, completed_ts FROM tasks",
+                                 -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            countFacts(fresh[sqlite3_column_int(stmt, 0)], readStatsFacts(stmt, 1), 1, today);
+        }
+        sqlite3_finalize(stmt);
+    }
+    ok = ok && sqlite3_prepare_v2(db, "SELECT user_id FROM task_stats", -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            stored.push_back(sqlite3_column_int(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+    }
+    for (int user_id : stored) {
+        fresh.emplace(user_id, TaskStats());
+    }
+    for (auto& entry : fresh) {
+        TaskStats current;
+        readTaskStats(db, entry.first, today, current);
+        users++;
+        if (!sameStats(current, entry.second)) {
+            mismatched++;
+            if (stale) {
+                stale->push_back(entry.first);
+            }
+        }
+    }
+
+    if (ok && repair) {
+        std::string sql = std::string("INSERT INTO task_stats (user_id, ") + kStatsColumns +
+                          ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+        ok = sqlite3_exec(db, "DELETE FROM task_stats", nullptr, nullptr, nullptr) == SQLITE_OK &&
+             sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK;
+        for (auto it = fresh.begin(); ok && it != fresh.end(); ++it) {
+            const TaskStats& stats = it->second;
+            if (stats.total == 0) {
+                continue;
+            }
+            int values[] = {it->first, stats.total, stats.pending, stats.in_progress, stats.completed,
+                            stats.priority_low, stats.priority_medium, stats.priority_high, stats.overdue,
+                            stats.completed_this_week, today, Task::weekStart(today)};
+            for (int i = 0; i < 12; ++i) {
+                sqlite3_bind_int(stmt, i + 1, values[i]);
+            }
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+    ok = ok && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    return ok;
+}
+
+// Пересчёт счётчиков одного пользователя в короткой транзакции записи (задачи
+// читаются по idx_tasks_user_due): запись в файл блокируется только на его задачи
+static bool repairUserStats(sqlite3* db, int user_id) {
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    int32_t today = Task::today();
+    TaskStats stats;
+    sqlite3_stmt* stmt;
+    bool ok = sqlite3_prepare_v2(db, "SELECT status, priority, due_day, completed_ts FROM tasks WHERE user_id = ?",
+                                 -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        sqlite3_bind_int(stmt, 1, user_id);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            countFacts(stats, readStatsFacts(stmt, 0), 1, today);
+        }
+        sqlite3_finalize(stmt);
+    }
+    std::string sql = stats.total == 0
+        ? std::string("DELETE FROM task_stats WHERE user_id = ?")
+        : std::string("INSERT OR REPLACE INTO task_stats (user_id, ") + kStatsColumns +
+          ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    ok = ok && sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        int values[] = {user_id, stats.total, stats.pending, stats.in_progress, stats.completed,
+                        stats.priority_low, stats.priority_medium, stats.priority_high, stats.overdue,
+                        stats.completed_this_week, today, Task::weekStart(today)};
+        int count = stats.total == 0 ? 1 : 12;
+        for (int i = 0; i < count; ++i) {
+            sqlite3_bind_int(stmt, i + 1, values[i]);
+        }
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    ok = ok && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    return ok;
+}
+
+// completed_ts - момент перевода задачи в completed, для счётчика выполненных за неделю.
+// У задач, выполненных до появления колонки, берётся время последнего изменения.
+// Таблица task_stats при создании сразу заполняется по существующим задачам.
+static bool migrateTaskStats(sqlite3* db) {
+    if (!hasColumn(db, "tasks", "completed_ts")) {
+        const char* sql = "ALTER TABLE tasks ADD COLUMN completed_ts INTEGER;"
+                          "UPDATE tasks SET completed_ts = COALESCE(updated_ts, CAST(strftime('%s', updated_at) AS INTEGER)) "
+                          "WHERE status = 'completed';";
+        if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+            return false;
+        }
+    }
+    bool existed = queryInt(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'task_stats'") > 0;
+    const char* createStatsTable = R"(
+        CREATE TABLE IF NOT EXISTS task_stats (
+            user_id INTEGER PRIMARY KEY,
+            total INTEGER NOT NULL,
+            pending INTEGER NOT NULL,
+            in_progress INTEGER NOT NULL,
+            completed INTEGER NOT NULL,
+            priority_low INTEGER NOT NULL,
+            priority_medium INTEGER NOT NULL,
+            priority_high INTEGER NOT NULL,
+            overdue INTEGER NOT NULL,
+            completed_week INTEGER NOT NULL,
+            as_of_day INTEGER NOT NULL,
+            week_start INTEGER NOT NULL
         )
     )";
-    
-    if (sqlite3_exec(db, createUsersTable, nullptr, nullptr, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    if (sqlite3_exec(db, createStatsTable, nullptr, nullptr, nullptr) != SQLITE_OK) {
         return false;
     }
-    
+    int users = 0;
+    int mismatched = 0;
+    return existed || checkStatsFile(db, true, users, mismatched);
+}
+
+// Версия строки для If-Match: у существующих задач начинается с 1
+static bool migrateTaskVersion(sqlite3* db) {
+    return hasColumn(db, "tasks", "version") ||
+           sqlite3_exec(db, "ALTER TABLE tasks ADD COLUMN version INTEGER NOT NULL DEFAULT 1",
+                        nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+static bool createTaskSchema(sqlite3* db) {
     const char* createTasksTable = R"(
         CREATE TABLE IF NOT EXISTS tasks (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -46,273 +617,1448 @@ bool Database::initDatabase(const std::string& dbPath) {
             status TEXT NOT NULL DEFAULT 'pending',
             created_at TEXT NOT NULL,
             updated_at TEXT NOT NULL,
+            created_ts INTEGER,
+            updated_ts INTEGER,
+            due_day INTEGER,
             FOREIGN KEY (user_id) REFERENCES users(id)
         )
     )";
     
     if (sqlite3_exec(db, createTasksTable, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    return migrateTaskTimeColumns(db) && migrateTaskStats(db) && migrateTaskVersion(db) &&
+           createNextIndex(db);
+}
+
+// Счётчик AUTOINCREMENT не должен опускаться ниже seq: иначе новые id
+// попадут в диапазон старых или повторят id удалённых задач
+static bool raiseTaskSequence(sqlite3* db, const char* schema, int64_t seq) {
+    std::string table = std::string(schema) + ".sqlite_sequence";
+    std::string sql = "INSERT INTO " + table + " (name, seq) SELECT 'tasks', 0 "
+                      "WHERE NOT EXISTS (SELECT 1 FROM " + table + " WHERE name = 'tasks');"
+                      "UPDATE " + table + " SET seq = MAX(seq, " + std::to_string(seq) + ") WHERE name = 'tasks';";
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+static bool initShardFile(const std::string& path, int64_t seq) {
+    sqlite3* db;
+    if (!openConnection(path, &db)) {
+        return false;
+    }
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+    bool ok = createTaskSchema(db) && raiseTaskSequence(db, "main", seq);
+    sqlite3_close(db);
+    return ok;
+}
+
+// Раскладка корзин по шардам. При первом запуске создаётся из shards; если в базе
+// уже есть задачи, все корзины остаются в шарде 0, разносить их - задача утилиты.
+static bool loadShardMap(sqlite3* db, int shards) {
+    const char* createTables = R"(
+        CREATE TABLE IF NOT EXISTS shard_map (
+            bucket INTEGER PRIMARY KEY,
+            shard INTEGER NOT NULL
+        );
+        CREATE TABLE IF NOT EXISTS shard_meta (
+            key TEXT PRIMARY KEY,
+            value INTEGER NOT NULL
+        );
+        CREATE TABLE IF NOT EXISTS task_routes (
+            task_id INTEGER PRIMARY KEY,
+            shard INTEGER NOT NULL
+        );
+    )";
+    if (sqlite3_exec(db, createTables, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    
+    if (queryInt(db, "SELECT COUNT(*) FROM shard_map") == 0) {
+        int64_t legacy = std::max(
+            queryInt(db, "SELECT seq FROM sqlite_sequence WHERE name = 'tasks'"),
+            queryInt(db, "SELECT MAX(id) FROM tasks"));
+        std::ostringstream sql;
+        sql << "BEGIN;"
+            << "INSERT INTO shard_meta (key, value) VALUES ('legacy_max_task_id', " << legacy << ");";
+        for (int bucket = 0; bucket < kBuckets; ++bucket) {
+            int shard = legacy > 0 ? 0 : bucket % std::max(1, shards);
+            sql << "INSERT INTO shard_map (bucket, shard) VALUES (" << bucket << ", " << shard << ");";
+        }
+        sql << "COMMIT;";
+        if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+            return false;
+        }
+    }
+    
+    g_legacy_max_id = queryInt(db, "SELECT value FROM shard_meta WHERE key = 'legacy_max_task_id'");
+    g_has_legacy_routes = queryInt(db, "SELECT EXISTS (SELECT 1 FROM task_routes)") != 0;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT bucket, shard FROM shard_map", -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    g_shard_count = 1;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int bucket = sqlite3_column_int(stmt, 0);
+        int shard = sqlite3_column_int(stmt, 1);
+        if (bucket >= 0 && bucket < kBuckets) {
+            g_bucket_shard[bucket] = shard;
+            g_shard_count = std::max(g_shard_count, shard + 1);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+// Один шаг фоновой миграции: конвертирует до batchSize строк в короткой транзакции.
+// Возвращает число обработанных строк или -1 при ошибке.
+static int backfillBatch(sqlite3* db, int batchSize) {
+    std::string sql = std::string("UPDATE tasks SET created_ts = ") + kCreatedTsFromText +
+        ", updated_ts = " + kUpdatedTsFromText + ", due_day = " + kDueDayFromText +
+        " WHERE id IN (SELECT id FROM tasks WHERE created_ts IS NULL LIMIT ?)"
+        " RETURNING strftime('%s', created_at) IS NULL OR strftime('%s', updated_at) IS NULL";
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, batchSize);
+    int rc;
+    int changed = 0;
+    int bad = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        changed++;
+        bad += sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        return -1;
+    }
+    g_backfill_bad_timestamps += bad;
+    return changed;
+}
+
+// Пока у части строк due_day не заполнен, запросы по сроку берут его из due_date
+// (kDueDayOrText, без индекса), иначе такие задачи в выборку не попадут
+bool Database::dueDayReady() {
+    if (g_backfill_done) {
+        return true;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t last = g_backfill_probe.load();
+    if (now - last < 1 || !g_backfill_probe.compare_exchange_strong(last, now)) {
+        return false;
+    }
+    // Частичный индекс idx_tasks_unconverted делает проверку мгновенной
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        sqlite3* db;
+        if (!openConnection(shardPath(shard), &db)) {
+            return false;
+        }
+        bool found = queryInt(db, "SELECT EXISTS (SELECT 1 FROM tasks WHERE created_ts IS NULL)", 1) != 0;
+        closeConnection(db);
+        if (found) {
+            return false;
+        }
+    }
+    g_backfill_done = true;
+    return true;
+}
+
+bool Database::initDatabase(const std::string& dbPath, int shards) {
+    db_path_ = dbPath;
+    sqlite3* db;
+    
+    if (!openConnection(dbPath, &db)) {
+        return false;
+    }
+    
+    // WAL: читатели не блокируются фоновой миграцией и записью
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+    
+    const char* createUsersTable = R"(
+        CREATE TABLE IF NOT EXISTS users (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            username TEXT UNIQUE NOT NULL,
+            password_hash TEXT NOT NULL,
+            created_at TEXT NOT NULL
+        )
+    )";
+    
+    if (sqlite3_exec(db, createUsersTable, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    
+    // Ответы на записи с Idempotency-Key: общие для всех воркеров и переживают
+    // перезапуск. Ключ - пара (пользователь, ключ клиента), шардирование не нужно.
+    const char* createIdempotencyTable = R"(
+        CREATE TABLE IF NOT EXISTS idempotency_keys (
+            user_id INTEGER NOT NULL,
+            key TEXT NOT NULL,
+            fingerprint INTEGER NOT NULL,
+            status INTEGER NOT NULL,
+            content_type TEXT NOT NULL,
+            etag TEXT NOT NULL,
+            body BLOB NOT NULL,
+            created_ts INTEGER NOT NULL,
+            PRIMARY KEY (user_id, key)
+        ) WITHOUT ROWID;
+        CREATE INDEX IF NOT EXISTS idx_idempotency_created ON idempotency_keys(created_ts);
+    )";
+    
+    if (sqlite3_exec(db, createIdempotencyTable, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    
+    if (!createTaskSchema(db) || !loadShardMap(db, shards)) {
         sqlite3_close(db);
         return false;
     }
     
     sqlite3_close(db);
+    
+    for (int shard = 1; shard < g_shard_count; ++shard) {
+        if (!initShardFile(shardPath(shard), g_legacy_max_id)) {
+            return false;
+        }
+    }
+    
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        sqlite3* keeper;
+        if (openConnection(shardPath(shard), &keeper)) {
+            // WAL открывается соединением лениво, при первом чтении
+            sqlite3_exec(keeper, "SELECT COUNT(*) FROM sqlite_master", nullptr, nullptr, nullptr);
+            g_keepalive.push_back(keeper);
+        }
+    }
     return true;
 }
 
-void Database::closeDatabase() {
+void Database::pinThreadConnections() {
+    t_pinned = true;
+}
+
+void Database::releaseThreadConnections() {
+    for (auto& connection : t_statements) {
+        for (auto& entry : connection.second) {
+            sqlite3_finalize(entry.second);
+        }
+    }
+    t_statements.clear();
+    for (auto& entry : t_connections) {
+        sqlite3_close(entry.second);
+    }
+    t_connections.clear();
+    t_pinned = false;
+}
+
+bool Database::closeDatabase() {
+    g_backfill_stop = true;
+    if (g_backfill_thread.joinable()) {
+        g_backfill_thread.join();
+    }
+    // Переносим WAL в основной файл и обрезаем его, чтобы следующий запуск
+    // не начинал с восстановления журнала
+    bool checkpointed = true;
+    for (sqlite3* keeper : g_keepalive) {
+        if (sqlite3_wal_checkpoint_v2(keeper, nullptr, SQLITE_CHECKPOINT_TRUNCATE, nullptr, nullptr) != SQLITE_OK) {
+            checkpointed = false;
+        }
+        sqlite3_close(keeper);
+    }
+    g_keepalive.clear();
+    return checkpointed;
+}
+
+void Database::startBackfill(int batchSize, int pauseMs) {
+    if (g_backfill_thread.joinable()) {
+        return;
+    }
+    g_backfill_stop = false;
+    g_backfill_thread = std::thread([batchSize, pauseMs] {
+        bool done = true;
+        for (int shard = 0; shard < g_shard_count && !g_backfill_stop; ++shard) {
+            sqlite3* db;
+            if (!openConnection(shardPath(shard), &db)) {
+                return;
+            }
+            bool changedShard = false;
+            while (!g_backfill_stop) {
+                int changed = backfillBatch(db, batchSize > 0 ? batchSize : 500);
+                if (changed <= 0) {
+                    done = done && changed == 0;
+                    break;
+                }
+                changedShard = true;
+                g_backfill_rows += changed;
+                g_backfill_batches++;
+                // Пауза между пачками отдаёт блокировку записи обработчикам запросов
+                std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+            }
+            // Заполненный due_day меняет число просроченных. Сверка идёт в транзакции
+            // чтения, расходящиеся пользователи пересчитываются по одному в коротких
+            // транзакциях записи, не блокируя запись в шард на весь проход.
+            if (changedShard) {
+                int users = 0;
+                int mismatched = 0;
+                std::vector<int> stale;
+                checkStatsFile(db, false, users, mismatched, &stale);
+                for (size_t i = 0; i < stale.size() && !g_backfill_stop; ++i) {
+                    if (repairUserStats(db, stale[i])) {
+                        g_backfill_stats_repaired++;
+                    }
+                }
+            }
+            sqlite3_close(db);
+        }
+        g_backfill_done = done && !g_backfill_stop;
+    });
+}
+
+std::string Database::migrationStatsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"backfill_done\":" << (g_backfill_done ? "true" : "false") << ","
+        << "\"backfill_rows\":" << g_backfill_rows.load() << ","
+        << "\"backfill_batches\":" << g_backfill_batches.load() << ","
+        << "\"backfill_bad_timestamps\":" << g_backfill_bad_timestamps.load() << ","
+        << "\"backfill_stats_repaired\":" << g_backfill_stats_repaired.load()
+        << "}";
+    return oss.str();
+}
+
+// После стольких перезапусков из-за конкурентной записи файл докопируется за один шаг.
+// В WAL это держит только транзакцию чтения и не блокирует запись.
+static const int kMaxBackupRestarts = 3;
+
+static bool backupFile(const std::string& sourcePath, const std::string& targetPath,
+                       int pagesPerStep, int pauseMs, const std::atomic<bool>& cancel,
+                       BackupProgress& progress) {
+    sqlite3* source;
+    sqlite3* target;
+    if (!openConnection(sourcePath, &source)) {
+        progress.error = "cannot open " + sourcePath;
+        return false;
+    }
+    if (sqlite3_open(targetPath.c_str(), &target) != SQLITE_OK) {
+        progress.error = "cannot create " + targetPath;
+        sqlite3_close(target);
+        sqlite3_close(source);
+        return false;
+    }
+    
+    sqlite3_backup* backup = sqlite3_backup_init(target, "main", source, "main");
+    if (!backup) {
+        progress.error = sqlite3_errmsg(target);
+        sqlite3_close(target);
+        sqlite3_close(source);
+        return false;
+    }
+    
+    int step = pagesPerStep > 0 ? pagesPerStep : 64;
+    int restarts = 0;
+    int previousRemaining = -1;
+    int rc;
+    do {
+        rc = sqlite3_backup_step(backup, restarts >= kMaxBackupRestarts ? -1 : step);
+        progress.steps++;
+        int remaining = sqlite3_backup_remaining(backup);
+        // Запись в источник другим соединением перезапускает копирование с первой страницы
+        if (previousRemaining >= 0 && remaining > previousRemaining) {
+            restarts++;
+        }
+        previousRemaining = remaining;
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            // Пауза отдаёт диск и блокировки обработчикам запросов
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+        }
+    } while ((rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) && !cancel);
+    
+    if (rc == SQLITE_DONE) {
+        progress.pages += sqlite3_backup_pagecount(backup);
+    }
+    progress.restarts += restarts;
+    int finishRc = sqlite3_backup_finish(backup);
+    bool ok = rc == SQLITE_DONE && finishRc == SQLITE_OK;
+    if (!ok) {
+        progress.error = cancel ? "cancelled" : sqlite3_errmsg(target);
+    }
+    sqlite3_close(target);
+    sqlite3_close(source);
+    return ok;
+}
+
+bool Database::backupTo(const std::string& targetDir, int pagesPerStep, int pauseMs,
+                        const std::atomic<bool>& cancel, BackupProgress& progress) {
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        std::string source = shardPath(shard);
+        size_t slash = source.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+        if (!backupFile(source, targetDir + "/" + name, pagesPerStep, pauseMs, cancel, progress)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Database::createUser(const std::string& username, const std::string& password_hash) {
+    sqlite3* db;
+    if (!openConnection(db_path_, &db)) {
+        return false;
+    }
+    
+    sqlite3_stmt* stmt;
+    const char* sql = "INSERT INTO users (username, password_hash, created_at) VALUES (?, ?, ?)";
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return false;
+    }
+    
+    std::string timestamp = getCurrentTimestamp();
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, password_hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, timestamp.c_str(), -1, SQLITE_STATIC);
+    
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+    sqlite3_finalize(stmt);
+    closeConnection(db);
+    
+    return success;
+}
+
+User Database::getUserByUsername(const std::string& username) {
+    User user;
+    sqlite3* db;
+    
+    if (!openConnection(db_path_, &db)) {
+        return user;
+    }
+    
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT id, username, password_hash, created_at FROM users WHERE username = ?";
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return user;
+    }
+    
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        user.id = sqlite3_column_int(stmt, 0);
+        user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        user.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    }
+    
+    sqlite3_finalize(stmt);
+    closeConnection(db);
+    
+    return user;
+}
+
+User Database::getUserById(int id) {
+    User user;
+    sqlite3* db;
+    
+    if (!openConnection(db_path_, &db)) {
+        return user;
+    }
+    
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT id, username, password_hash, created_at FROM users WHERE id = ?";
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return user;
+    }
+    
+    sqlite3_bind_int(stmt, 1, id);
+    
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        user.id = sqlite3_column_int(stmt, 0);
+        user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        user.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    }
+    
+    sqlite3_finalize(stmt);
+    closeConnection(db);
+    
+    return user;
+}
+
+// id = (следующий номер в шарде << kBucketBits) | корзина пользователя
+static const std::string& insertTaskSql() {
+    static const std::string sql =
+        "INSERT INTO tasks (user_id, title, description, due_date, priority, status, created_at, updated_at, "
+        "due_day, created_ts, updated_ts, completed_ts, id) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
+        "((((SELECT COALESCE(MAX(seq), 0) FROM sqlite_sequence WHERE name = 'tasks') >> " +
+        std::to_string(kBucketBits) + ") + 1) << " + std::to_string(kBucketBits) + ") | ?)";
+    return sql;
+}
+
+static bool insertTask(sqlite3_stmt* stmt, const Task& task, int64_t now) {
+    int64_t created_ts = task.created_at == Task::kNoTime ? now : task.created_at;
+    std::string timestamp = Task::formatTimestamp(now);
+    std::string created_at = Task::formatTimestamp(created_ts);
+    std::string due_date = Task::formatDay(task.due_date);
+    sqlite3_bind_int(stmt, 1, task.user_id);
+    sqlite3_bind_text(stmt, 2, task.title.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, task.description.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, due_date.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, Task::priorityName(task.priority), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, Task::statusName(task.status), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 7, created_at.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 8, timestamp.c_str(), -1, SQLITE_STATIC);
+    bindDay(stmt, 9, task.due_date);
+    sqlite3_bind_int64(stmt, 10, created_ts);
+    sqlite3_bind_int64(stmt, 11, now);
+    if (task.status == TaskStatus::Completed) {
+        sqlite3_bind_int64(stmt, 12, now);
+    } else {
+        sqlite3_bind_null(stmt, 12);
+    }
+    sqlite3_bind_int(stmt, 13, userBucket(task.user_id));
+    
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_reset(stmt);
+    return ok;
+}
+
+// Задача и счётчики task_stats пользователя меняются в одной транзакции
+int64_t Database::createTask(const Task& task) {
+    sqlite3* db;
+    if (!openConnection(shardPath(shardForUser(task.user_id)), &db)) {
+        return -1;
+    }
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return -1;
+    }
+    if (!prepareStatement(db, insertTaskSql(), &stmt)) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return -1;
+    }
+    
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    int32_t today = Task::today();
+    TaskStats delta;
+    countFacts(delta, factsOf(task, now), 1, today);
+    bool ok = rollTaskStats(db, task.user_id, today) && insertTask(stmt, task, now);
+    int64_t task_id = sqlite3_last_insert_rowid(db);
+    finishStatement(stmt);
+    
+    ok = ok && applyTaskStats(db, task.user_id, delta) &&
+         sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    closeConnection(db);
+    
+    return ok ? task_id : -1;
+}
+
+bool Database::importTasks(int user_id, std::vector<Task>& tasks) {
+    if (tasks.empty()) {
+        return true;
+    }
+    sqlite3* db;
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
+        return false;
+    }
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return false;
+    }
+    if (sqlite3_prepare_v2(db, insertTaskSql().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return false;
+    }
+    
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    int32_t today = Task::today();
+    TaskStats delta;
+    bool ok = rollTaskStats(db, user_id, today);
+    for (auto& task : tasks) {
+        if (!ok) {
+            break;
+        }
+        task.user_id = user_id;
+        if (!insertTask(stmt, task, now)) {
+            ok = false;
+            break;
+        }
+        task.id = sqlite3_last_insert_rowid(db);
+        countFacts(delta, factsOf(task, now), 1, today);
+    }
+    sqlite3_finalize(stmt);
+    
+    ok = ok && applyTaskStats(db, user_id, delta) &&
+         sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    closeConnection(db);
+    return ok;
 }
 
-bool Database::createUser(const std::string& username, const std::string& password_hash) {
+bool Database::exportTasks(int user_id, const std::function<bool(const Task&)>& consumer) {
     sqlite3* db;
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
         return false;
     }
     
     sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO users (username, password_hash, created_at) VALUES (?, ?, ?)";
+    // Обход индекса idx_tasks_user_created без сортировки: в памяти одна строка,
+    // сколько бы задач ни было
+    std::string sql = std::string("SELECT ") + kTaskColumns + " FROM tasks WHERE user_id = ? ORDER BY created_ts";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
         return false;
     }
     
-    std::string timestamp = getCurrentTimestamp();
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, password_hash.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, timestamp.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 1, user_id);
+    
+    int rc;
+    Task task;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        readTaskRow(stmt, task);
+        if (!consumer(task)) {
+            break;
+        }
+    }
     
-    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    closeConnection(db);
     
-    return success;
+    return rc == SQLITE_DONE;
 }
 
-User Database::getUserByUsername(const std::string& username) {
-    User user;
+std::vector<Task> Database::getTasksByUserId(int user_id) {
+    std::vector<Task> tasks;
     sqlite3* db;
     
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
-        return user;
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
+        return tasks;
     }
     
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, username, password_hash, created_at FROM users WHERE username = ?";
+    std::string sql = std::string("SELECT ") + kTaskColumns + " FROM tasks WHERE user_id = ? ORDER BY created_ts DESC";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        return user;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return tasks;
     }
     
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 1, user_id);
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        user.id = sqlite3_column_int(stmt, 0);
-        user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        user.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Task task;
+        readTaskRow(stmt, task);
+        tasks.push_back(task);
     }
     
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    closeConnection(db);
     
-    return user;
+    return tasks;
 }
 
-User Database::getUserById(int id) {
-    User user;
+std::vector<Task> Database::getTasksByDueRange(int user_id, int32_t fromDay, int32_t toDay) {
+    std::vector<Task> tasks;
     sqlite3* db;
     
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
-        return user;
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
+        return tasks;
     }
     
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, username, password_hash, created_at FROM users WHERE id = ?";
+    std::string dueDay = dueDayReady() ? "due_day" : kDueDayOrText;
+    std::string sql = std::string("SELECT ") + kTaskColumns +
+                      " FROM tasks WHERE user_id = ? AND " + dueDay + " BETWEEN ? AND ? ORDER BY " + dueDay + ", id";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        return user;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return tasks;
     }
     
-    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_int(stmt, 2, fromDay);
+    sqlite3_bind_int(stmt, 3, toDay);
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        user.id = sqlite3_column_int(stmt, 0);
-        user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        user.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Task task;
+        readTaskRow(stmt, task);
+        tasks.push_back(task);
     }
     
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    closeConnection(db);
     
-    return user;
+    return tasks;
 }
 
-int Database::createTask(const Task& task) {
+std::vector<Task> Database::getOverdueTasks(int user_id, int32_t today) {
+    std::vector<Task> tasks;
     sqlite3* db;
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
-        return -1;
+    
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
+        return tasks;
     }
     
+    // Условие повторяет WHERE частичного индекса idx_tasks_pending_due
     sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO tasks (user_id, title, description, due_date, priority, status, created_at, updated_at) VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
+    std::string dueDay = dueDayReady() ? "due_day" : kDueDayOrText;
+    std::string sql = std::string("SELECT ") + kTaskColumns +
+                      " FROM tasks WHERE user_id = ? AND status != 'completed' AND " + dueDay + " IS NOT NULL"
+                      " AND " + dueDay + " < ? ORDER BY " + dueDay + ", id";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        return -1;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return tasks;
     }
     
-    std::string timestamp = getCurrentTimestamp();
-    std::string created_at = task.created_at.empty() ? timestamp : task.created_at;
-    sqlite3_bind_int(stmt, 1, task.user_id);
-    sqlite3_bind_text(stmt, 2, task.title.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, task.description.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, task.due_date.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, task.priority.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 6, task.status.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 7, created_at.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 8, timestamp.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_int(stmt, 2, today);
     
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return -1;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Task task;
+        readTaskRow(stmt, task);
+        tasks.push_back(task);
     }
     
-    int task_id = static_cast<int>(sqlite3_last_insert_rowid(db));
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    closeConnection(db);
     
-    return task_id;
+    return tasks;
 }
 
-std::vector<Task> Database::getTasksByUserId(int user_id) {
+std::vector<Task> Database::getNextTasks(int user_id, int limit) {
     std::vector<Task> tasks;
     sqlite3* db;
     
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
         return tasks;
     }
     
+    // ORDER BY повторяет колонки idx_tasks_next (id - rowid в конце ключа индекса),
+    // поэтому SQLite читает первые limit записей индекса без сортировки
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, user_id, title, description, due_date, priority, status, created_at, updated_at FROM tasks WHERE user_id = ? ORDER BY created_at DESC";
+    static const std::string sql = std::string("SELECT ") + kTaskColumns +
+                                   " FROM tasks WHERE user_id = ? AND status != 'completed'"
+                                   " ORDER BY " + kPriorityRank + ", due_day IS NULL, due_day, id LIMIT ?";
+    static const std::string migratingSql = std::string("SELECT ") + kTaskColumns +
+                                            " FROM tasks WHERE user_id = ? AND status != 'completed'"
+                                            " ORDER BY " + kPriorityRank + ", " + kDueDayOrText + " IS NULL, " +
+                                            kDueDayOrText + ", id LIMIT ?";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    if (!prepareStatement(db, dueDayReady() ? sql : migratingSql, &stmt)) {
+        closeConnection(db);
         return tasks;
     }
     
     sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_int(stmt, 2, limit);
     
+    tasks.reserve(limit);
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         Task task;
-        task.id = sqlite3_column_int(stmt, 0);
-        task.user_id = sqlite3_column_int(stmt, 1);
-        task.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        task.description = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        task.due_date = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        task.priority = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        task.status = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-        task.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
-        task.updated_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 8));
-        tasks.push_back(task);
+        readTaskRow(stmt, task);
+        tasks.push_back(std::move(task));
     }
     
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    finishStatement(stmt);
+    closeConnection(db);
+    
+    return tasks;
+}
+
+std::vector<Task> Database::getPendingTasksDueBetween(int32_t fromDay, int32_t toDay) {
+    std::vector<Task> tasks;
+    
+    // Условие повторяет WHERE частичного индекса idx_tasks_due_pending
+    std::string dueDay = dueDayReady() ? "due_day" : kDueDayOrText;
+    std::string sql = std::string("SELECT ") + kTaskColumns +
+                      " FROM tasks WHERE status != 'completed' AND " + dueDay + " IS NOT NULL"
+                      " AND " + dueDay + " BETWEEN ? AND ?";
+    
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        sqlite3* db;
+        if (!openConnection(shardPath(shard), &db)) {
+            continue;
+        }
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            closeConnection(db);
+            continue;
+        }
+        
+        sqlite3_bind_int(stmt, 1, fromDay);
+        sqlite3_bind_int(stmt, 2, toDay);
+        
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            Task task;
+            readTaskRow(stmt, task);
+            tasks.push_back(task);
+        }
+        
+        sqlite3_finalize(stmt);
+        closeConnection(db);
+    }
     
     return tasks;
 }
 
-Task Database::getTaskById(int task_id) {
+Task Database::getTaskById(int64_t task_id) {
     Task task;
     sqlite3* db;
     
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
+    if (!openConnection(shardPath(shardForTask(task_id)), &db)) {
         return task;
     }
     
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, user_id, title, description, due_date, priority, status, created_at, updated_at FROM tasks WHERE id = ?";
+    std::string sql = std::string("SELECT ") + kTaskColumns + " FROM tasks WHERE id = ?";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    if (!prepareStatement(db, sql, &stmt)) {
+        closeConnection(db);
         return task;
     }
     
-    sqlite3_bind_int(stmt, 1, task_id);
+    sqlite3_bind_int64(stmt, 1, task_id);
     
     if (sqlite3_step(stmt) == SQLITE_ROW) {
-        task.id = sqlite3_column_int(stmt, 0);
-        task.user_id = sqlite3_column_int(stmt, 1);
-        task.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        task.description = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        task.due_date = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        task.priority = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        task.status = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-        task.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
-        task.updated_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 8));
+        readTaskRow(stmt, task);
     }
     
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    finishStatement(stmt);
+    closeConnection(db);
     
     return task;
 }
 
-bool Database::updateTask(const Task& task) {
+// Поля счётчиков задачи пользователя внутри транзакции записи. Ok - задача есть и
+// его; NotFound, Forbidden (чужая) или Failed (ошибка базы), как в missResult.
+static TaskWriteResult readTaskFacts(sqlite3* db, int64_t task_id, int user_id, StatsFacts& facts) {
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT user_id, status, priority, due_day, completed_ts FROM tasks WHERE id = ?";
+    if (!prepareStatement(db, sql, &stmt)) {
+        return TaskWriteResult::Failed;
+    }
+    sqlite3_bind_int64(stmt, 1, task_id);
+    int rc = sqlite3_step(stmt);
+    TaskWriteResult result = rc == SQLITE_DONE ? TaskWriteResult::NotFound : TaskWriteResult::Failed;
+    if (rc == SQLITE_ROW) {
+        result = sqlite3_column_int(stmt, 0) == user_id ? TaskWriteResult::Ok : TaskWriteResult::Forbidden;
+        facts = readStatsFacts(stmt, 1);
+    }
+    finishStatement(stmt);
+    return result;
+}
+
+// Промах DELETE ... WHERE id = ? AND user_id = ? AND версия: задачи нет, она чужая
+// или изменилась
+static TaskWriteResult missResult(sqlite3* db, int64_t task_id, int user_id) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT user_id FROM tasks WHERE id = ?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return TaskWriteResult::Failed;
+    }
+    sqlite3_bind_int64(stmt, 1, task_id);
+    int rc = sqlite3_step(stmt);
+    int owner = rc == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    if (rc == SQLITE_ROW) {
+        return owner == user_id ? TaskWriteResult::PreconditionFailed : TaskWriteResult::Forbidden;
+    }
+    return rc == SQLITE_DONE ? TaskWriteResult::NotFound : TaskWriteResult::Failed;
+}
+
+// Условие на ожидаемые версии (If-Match) в параметре index: NULL - любая версия,
+// иначе список ",3,4," от bindVersions
+static std::string versionMatches(int index) {
+    std::string param = "?" + std::to_string(index);
+    return "(" + param + " IS NULL OR instr(" + param + ", ',' || version || ',') > 0)";
+}
+
+static void bindVersions(sqlite3_stmt* stmt, int index, const std::vector<int>& versions) {
+    if (versions.empty()) {
+        sqlite3_bind_null(stmt, index);
+        return;
+    }
+    std::string list = ",";
+    for (int version : versions) {
+        list += std::to_string(version) + ",";
+    }
+    sqlite3_bind_text(stmt, index, list.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+static void bindOptionalText(sqlite3_stmt* stmt, int index, const char* value) {
+    if (value) {
+        sqlite3_bind_text(stmt, index, value, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, index);
+    }
+}
+
+// RETURNING отдаёт только новые значения, поэтому прежние поля счётчиков task_stats
+// читаются перед UPDATE в той же транзакции: это поиск по первичному ключу, он же
+// отличает чужую задачу от отсутствующей
+TaskWriteResult Database::updateTask(int64_t task_id, int user_id, const TaskPatch& patch,
+                                     const std::vector<int>& versions, Task& updated) {
     sqlite3* db;
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
-        return false;
+    if (!openConnection(shardPath(shardForTask(task_id)), &db)) {
+        return TaskWriteResult::Failed;
+    }
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return TaskWriteResult::Failed;
+    }
+    
+    StatsFacts before;
+    TaskWriteResult result = readTaskFacts(db, task_id, user_id, before);
+    if (result != TaskWriteResult::Ok) {
+        sqlite3_exec(db, result == TaskWriteResult::Failed ? "ROLLBACK" : "COMMIT", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return result;
     }
     
+    // Не переданные поля остаются прежними; due_day старой строки, ещё не дошедшей
+    // до фоновой миграции, заполняется здесь же. Несовпавшая версия - ноль строк.
     sqlite3_stmt* stmt;
-    const char* sql = "UPDATE tasks SET title = ?, description = ?, due_date = ?, priority = ?, status = ?, updated_at = ? WHERE id = ? AND user_id = ?";
+    static const std::string sql = std::string(
+        "UPDATE tasks SET title = COALESCE(?1, title), description = COALESCE(?2, description), "
+        "due_date = CASE WHEN ?3 THEN ?4 ELSE due_date END, "
+        "due_day = CASE WHEN ?3 THEN ?5 ELSE COALESCE(due_day, ") + kDueDayFromText + ") END, "
+        "priority = COALESCE(?6, priority), status = COALESCE(?7, status), updated_at = ?8, updated_ts = ?9, "
+        "created_ts = COALESCE(created_ts, CAST(strftime('%s', created_at) AS INTEGER), ?9), completed_ts = ?10, "
+        "version = version + 1 "
+        "WHERE id = ?11 AND user_id = ?12 AND " + versionMatches(13) + " RETURNING " + kTaskColumns;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        return false;
+    if (!prepareStatement(db, sql, &stmt)) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return TaskWriteResult::Failed;
     }
     
-    std::string timestamp = getCurrentTimestamp();
-    sqlite3_bind_text(stmt, 1, task.title.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, task.description.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, task.due_date.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, task.priority.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, task.status.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 6, timestamp.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 7, task.id);
-    sqlite3_bind_int(stmt, 8, task.user_id);
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    int32_t today = Task::today();
+    TaskStatus status = patch.status ? *patch.status : before.status;
+    // Момент выполнения сохраняется, пока задача остаётся выполненной
+    int64_t completed_ts = before.status == TaskStatus::Completed && before.completed_ts != Task::kNoTime
+                               ? before.completed_ts : now;
+    std::string timestamp = Task::formatTimestamp(now);
+    std::string due_date = patch.due_date ? Task::formatDay(*patch.due_date) : std::string();
+    bindOptionalText(stmt, 1, patch.title ? patch.title->c_str() : nullptr);
+    bindOptionalText(stmt, 2, patch.description ? patch.description->c_str() : nullptr);
+    sqlite3_bind_int(stmt, 3, patch.due_date ? 1 : 0);
+    sqlite3_bind_text(stmt, 4, due_date.c_str(), -1, SQLITE_STATIC);
+    bindDay(stmt, 5, patch.due_date ? *patch.due_date : Task::kNoDate);
+    bindOptionalText(stmt, 6, patch.priority ? Task::priorityName(*patch.priority) : nullptr);
+    bindOptionalText(stmt, 7, patch.status ? Task::statusName(*patch.status) : nullptr);
+    sqlite3_bind_text(stmt, 8, timestamp.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 9, now);
+    if (status == TaskStatus::Completed) {
+        sqlite3_bind_int64(stmt, 10, completed_ts);
+    } else {
+        sqlite3_bind_null(stmt, 10);
+    }
+    sqlite3_bind_int64(stmt, 11, task_id);
+    sqlite3_bind_int(stmt, 12, user_id);
+    bindVersions(stmt, 13, versions);
     
-    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    bool success = rollTaskStats(db, user_id, today);
+    int rc = success ? sqlite3_step(stmt) : SQLITE_ERROR;
+    if (rc == SQLITE_ROW) {
+        readTaskRow(stmt, updated);
+        success = sqlite3_step(stmt) == SQLITE_DONE;
+    } else {
+        success = false;
+    }
+    finishStatement(stmt);
     
-    return success;
+    if (rc == SQLITE_DONE) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return TaskWriteResult::PreconditionFailed;
+    }
+    if (success) {
+        TaskStats delta;
+        countFacts(delta, before, -1, today);
+        countFacts(delta, factsOf(updated, completed_ts), 1, today);
+        success = applyTaskStats(db, user_id, delta) &&
+                  sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+    if (!success) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    closeConnection(db);
+    
+    return success ? TaskWriteResult::Ok : TaskWriteResult::Failed;
+}
+
+// Удалённая строка сама отдаёт поля для счётчиков через RETURNING
+TaskWriteResult Database::deleteTask(int64_t task_id, int user_id, const std::vector<int>& versions) {
+    sqlite3* db;
+    if (!openConnection(shardPath(shardForTask(task_id)), &db)) {
+        return TaskWriteResult::Failed;
+    }
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return TaskWriteResult::Failed;
+    }
+    
+    sqlite3_stmt* stmt;
+    static const std::string sql = "DELETE FROM tasks WHERE id = ?1 AND user_id = ?2 AND " + versionMatches(3) +
+                                   " RETURNING status, priority, due_day, completed_ts";
+    
+    if (!prepareStatement(db, sql, &stmt)) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        closeConnection(db);
+        return TaskWriteResult::Failed;
+    }
+    
+    sqlite3_bind_int64(stmt, 1, task_id);
+    sqlite3_bind_int(stmt, 2, user_id);
+    bindVersions(stmt, 3, versions);
+    
+    int32_t today = Task::today();
+    TaskWriteResult result = TaskWriteResult::Failed;
+    bool success = rollTaskStats(db, user_id, today);
+    int rc = success ? sqlite3_step(stmt) : SQLITE_ERROR;
+    if (rc == SQLITE_ROW) {
+        TaskStats delta;
+        countFacts(delta, readStatsFacts(stmt, 0), -1, today);
+        success = sqlite3_step(stmt) == SQLITE_DONE && applyTaskStats(db, user_id, delta);
+        result = TaskWriteResult::Ok;
+    } else if (rc == SQLITE_DONE) {
+        result = missResult(db, task_id, user_id);
+        success = result != TaskWriteResult::Failed;
+    } else {
+        success = false;
+    }
+    finishStatement(stmt);
+    
+    success = success && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!success) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        result = TaskWriteResult::Failed;
+    }
+    closeConnection(db);
+    
+    return result;
 }
 
-bool Database::deleteTask(int task_id) {
+// Строка task_stats без записи: день и неделя сдвигаются в памяти
+bool Database::getTaskStats(int user_id, TaskStats& stats) {
     sqlite3* db;
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
+    if (!openConnection(shardPath(shardForUser(user_id)), &db)) {
         return false;
     }
+    int32_t today = Task::today();
+    bool stale = false;
+    bool ok = sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (ok) {
+        stats = TaskStats();
+        readTaskStats(db, user_id, today, stats, &stale);
+        sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+    }
+    // Первое чтение за день сохраняет сдвиг, чтобы следующие не повторяли просмотр
+    // задач. Не удалось (база занята) - ответ уже посчитан, сдвиг сохранит следующий.
+    if (ok && stale && sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) == SQLITE_OK) {
+        TaskStats rolled;
+        if (rollTaskStats(db, user_id, today) && readTaskStats(db, user_id, today, rolled) &&
+            sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK) {
+            stats = rolled;
+        } else {
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+    }
+    closeConnection(db);
+    return ok;
+}
+
+bool Database::checkTaskStats(bool repair, std::string& report) {
+    int users = 0;
+    int mismatched = 0;
+    bool ok = true;
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        sqlite3* db;
+        if (!openConnection(shardPath(shard), &db)) {
+            ok = false;
+            continue;
+        }
+        ok = checkStatsFile(db, repair, users, mismatched) && ok;
+        closeConnection(db);
+    }
+    std::ostringstream oss;
+    oss << "{\"shards\":" << g_shard_count
+        << ",\"users\":" << users
+        << ",\"mismatched\":" << mismatched
+        << ",\"repaired\":" << (repair && ok ? "true" : "false")
+        << "}";
+    report = oss.str();
+    return ok;
+}
+
+IdempotencyClaim Database::claimIdempotencyKey(int user_id, const std::string& key, uint64_t fingerprint,
+                                               int64_t now, int64_t since, int64_t staleBefore,
+                                               IdempotentResponse& response) {
+    sqlite3* db;
+    if (!openConnection(db_path_, &db)) {
+        return IdempotencyClaim::Failed;
+    }
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return IdempotencyClaim::Failed;
+    }
+    sqlite3_stmt* stmt;
+    static const std::string selectSql =
+        "SELECT fingerprint, status, content_type, etag, body, created_ts FROM idempotency_keys "
+        "WHERE user_id = ? AND key = ?";
+    bool ok = prepareStatement(db, selectSql, &stmt);
+    bool found = false;
+    if (ok) {
+        sqlite3_bind_int(stmt, 1, user_id);
+        sqlite3_bind_text(stmt, 2, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            response.user_id = user_id;
+            response.key = key;
+            response.fingerprint = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+            response.status = sqlite3_column_int(stmt, 1);
+            response.content_type = columnString(stmt, 2);
+            response.etag = columnString(stmt, 3);
+            const void* body = sqlite3_column_blob(stmt, 4);
+            response.body.assign(body ? static_cast<const char*>(body) : "",
+                                 static_cast<size_t>(sqlite3_column_bytes(stmt, 4)));
+            response.created_ts = sqlite3_column_int64(stmt, 5);
+            found = response.created_ts >= since &&
+                    (response.status != 0 || response.created_ts >= staleBefore);
+        }
+        finishStatement(stmt);
+    }
     
+    // Устаревшая строка с тем же ключом ещё могла не попасть под очистку
+    static const std::string claimSql =
+        "INSERT OR REPLACE INTO idempotency_keys "
+        "(user_id, key, fingerprint, status, content_type, etag, body, created_ts) "
+        "VALUES (?, ?, ?, 0, '', '', x'', ?)";
+    if (ok && !found) {
+        ok = prepareStatement(db, claimSql, &stmt);
+        if (ok) {
+            sqlite3_bind_int(stmt, 1, user_id);
+            sqlite3_bind_text(stmt, 2, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 3, static_cast<int64_t>(fingerprint));
+            sqlite3_bind_int64(stmt, 4, now);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            finishStatement(stmt);
+        }
+    }
+    ok = ok && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    closeConnection(db);
+    if (!ok) {
+        return IdempotencyClaim::Failed;
+    }
+    return found ? IdempotencyClaim::Found : IdempotencyClaim::Claimed;
+}
+
+bool Database::releaseIdempotencyKey(int user_id, const std::string& key) {
+    sqlite3* db;
+    if (!openConnection(db_path_, &db)) {
+        return false;
+    }
+    sqlite3_stmt* stmt;
+    static const std::string sql = "DELETE FROM idempotency_keys WHERE user_id = ? AND key = ? AND status = 0";
+    bool ok = prepareStatement(db, sql, &stmt);
+    if (ok) {
+        sqlite3_bind_int(stmt, 1, user_id);
+        sqlite3_bind_text(stmt, 2, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        finishStatement(stmt);
+    }
+    closeConnection(db);
+    return ok;
+}
+
+bool Database::saveIdempotentResponses(const std::vector<IdempotentResponse>& responses) {
+    sqlite3* db;
+    if (!openConnection(db_path_, &db)) {
+        return false;
+    }
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return false;
+    }
     sqlite3_stmt* stmt;
-    const char* sql = "DELETE FROM tasks WHERE id = ?";
+    // Ответ заменяет заглушку, записанную claimIdempotencyKey
+    static const std::string sql =
+        "INSERT OR REPLACE INTO idempotency_keys "
+        "(user_id, key, fingerprint, status, content_type, etag, body, created_ts) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
+    bool ok = prepareStatement(db, sql, &stmt);
+    if (ok) {
+        for (const auto& response : responses) {
+            sqlite3_bind_int(stmt, 1, response.user_id);
+            sqlite3_bind_text(stmt, 2, response.key.c_str(), static_cast<int>(response.key.size()), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 3, static_cast<int64_t>(response.fingerprint));
+            sqlite3_bind_int(stmt, 4, response.status);
+            sqlite3_bind_text(stmt, 5, response.content_type.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 6, response.etag.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_blob(stmt, 7, response.body.data(), static_cast<int>(response.body.size()), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 8, response.created_ts);
+            if (sqlite3_step(stmt) != SQLITE_DONE) {
+                ok = false;
+                break;
+            }
+            sqlite3_reset(stmt);
+        }
+        finishStatement(stmt);
+    }
+    sqlite3_exec(db, ok ? "COMMIT" : "ROLLBACK", nullptr, nullptr, nullptr);
+    closeConnection(db);
+    return ok;
+}
+
+int Database::purgeIdempotentResponses(int64_t before) {
+    sqlite3* db;
+    if (!openConnection(db_path_, &db)) {
+        return -1;
+    }
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "DELETE FROM idempotency_keys WHERE created_ts < ?", -1, &stmt, nullptr) != SQLITE_OK) {
+        closeConnection(db);
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, before);
+    int removed = sqlite3_step(stmt) == SQLITE_DONE ? sqlite3_changes(db) : -1;
+    sqlite3_finalize(stmt);
+    closeConnection(db);
+    return removed;
+}
+
+std::string Database::shardPath(int shard) {
+    if (shard == 0) {
+        return db_path_;
+    }
+    // data/tasks.db -> data/tasks-shard1.db
+    size_t slash = db_path_.find_last_of("/\\");
+    size_t dot = db_path_.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = db_path_.size();
+    }
+    return db_path_.substr(0, dot) + "-shard" + std::to_string(shard) + db_path_.substr(dot);
+}
+
+int Database::shardForUser(int user_id) {
+    return g_bucket_shard[userBucket(user_id)];
+}
+
+int Database::shardForTask(int64_t task_id) {
+    if (task_id > g_legacy_max_id) {
+        return g_bucket_shard[task_id & (kBuckets - 1)];
+    }
+    // Старые задачи лежат в шарде 0, пока утилита не перенесла их вместе с корзиной
+    if (!g_has_legacy_routes) {
+        return 0;
+    }
+    int shard = 0;
+    sqlite3* db;
+    if (openConnection(db_path_, &db)) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT shard FROM task_routes WHERE task_id = ?", -1, &stmt, nullptr) == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, task_id);
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                shard = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+        closeConnection(db);
+    }
+    return shard;
+}
+
+int Database::shardCount() {
+    return g_shard_count;
+}
+
+std::string Database::shardStatsJson(bool countRows) {
+    std::vector<int> buckets(g_shard_count, 0);
+    for (int shard : g_bucket_shard) {
+        buckets[shard]++;
+    }
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    std::ostringstream oss;
+    oss << "{\"count\":" << g_shard_count
+        << ",\"legacy_max_task_id\":" << g_legacy_max_id
+        << ",\"shards\":[";
+    for (int shard = 0; shard < g_shard_count; ++shard) {
+        if (shard > 0) {
+            oss << ",";
+        }
+        oss << "{\"shard\":" << shard << ",\"buckets\":" << buckets[shard];
+        if (countRows) {
+            sqlite3* db;
+            int64_t rows = -1;
+            if (openConnection(shardPath(shard), &db)) {
+                rows = queryInt(db, "SELECT COUNT(*) FROM tasks", -1);
+                sqlite3_close(db);
+            }
+            oss << ",\"tasks\":" << rows << ",\"path\":\"" << shardPath(shard) << "\"";
+        }
+        oss << "}";
+    }
+    oss << "]}";
+    return oss.str();
+}
+
+bool Database::splitShard(int shard, std::string& report) {
+    std::vector<int> moved;
+    for (int bucket = 0; bucket < kBuckets; ++bucket) {
+        if (g_bucket_shard[bucket] == shard) {
+            moved.push_back(bucket);
+        }
+    }
+    if (shard < 0 || shard >= g_shard_count || moved.size() < 2) {
+        report = "shard " + std::to_string(shard) + " has fewer than 2 buckets, nothing to split";
         return false;
     }
+    // Вторая половина корзин уезжает в новый шард
+    moved.erase(moved.begin(), moved.begin() + moved.size() / 2);
+    int target = g_shard_count;
+    std::string targetPath = shardPath(target);
     
-    sqlite3_bind_int(stmt, 1, task_id);
+    std::ostringstream bucketList;
+    for (size_t i = 0; i < moved.size(); ++i) {
+        bucketList << (i ? "," : "") << moved[i];
+    }
+    std::string inBuckets = "user_bucket(user_id) IN (" + bucketList.str() + ")";
+    std::string attach = "ATTACH DATABASE '" + targetPath + "' AS target;";
     
-    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    sqlite3* source;
+    if (!openConnection(shardPath(shard), &source)) {
+        report = "cannot open " + shardPath(shard);
+        return false;
+    }
+    sqlite3_create_function(source, "user_bucket", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                            nullptr, userBucketFunction, nullptr, nullptr);
+    int64_t sourceSeq = queryInt(source, "SELECT seq FROM sqlite_sequence WHERE name = 'tasks'");
     
-    return success;
+    // 1. Копия строк в новый файл. Повторный запуск после сбоя перезапишет те же строки.
+    std::string copySql = attach + "BEGIN IMMEDIATE;"
+        "INSERT OR REPLACE INTO target.tasks (" + std::string(kTaskCopyColumns) + ") "
+        "SELECT " + kTaskCopyColumns + " FROM main.tasks WHERE " + inBuckets + ";";
+    bool ok = initShardFile(targetPath, std::max<int64_t>(sourceSeq, g_legacy_max_id)) &&
+              sqlite3_exec(source, copySql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    int copied = sqlite3_changes(source);
+    std::string statsSql = "INSERT OR REPLACE INTO target.task_stats SELECT * FROM main.task_stats "
+                           "WHERE user_bucket(user_id) IN (" + bucketList.str() + ")";
+    ok = ok && sqlite3_exec(source, statsSql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK &&
+         raiseTaskSequence(source, "target", sourceSeq) &&
+         sqlite3_exec(source, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        report = std::string("copy failed: ") + sqlite3_errmsg(source);
+        sqlite3_exec(source, "ROLLBACK", nullptr, nullptr, nullptr);
+        sqlite3_close(source);
+        return false;
+    }
+    
+    // 2. Переключение корзин и маршрутов старых id в каталоге
+    sqlite3* directory;
+    ok = openConnection(db_path_, &directory);
+    if (ok) {
+        std::string routeSql = attach + "BEGIN IMMEDIATE;"
+            "INSERT OR REPLACE INTO task_routes (task_id, shard) SELECT id, " + std::to_string(target) +
+            " FROM target.tasks WHERE id <= " + std::to_string(g_legacy_max_id) + ";"
+            "UPDATE shard_map SET shard = " + std::to_string(target) +
+            " WHERE bucket IN (" + bucketList.str() + ");"
+            "COMMIT;";
+        ok = sqlite3_exec(directory, routeSql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+        if (!ok) {
+            report = std::string("directory update failed: ") + sqlite3_errmsg(directory);
+            sqlite3_exec(directory, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+        sqlite3_close(directory);
+    } else {
+        report = "cannot open " + db_path_;
+    }
+    if (!ok) {
+        sqlite3_close(source);
+        return false;
+    }
+    
+    for (int bucket : moved) {
+        g_bucket_shard[bucket] = target;
+    }
+    g_shard_count = target + 1;
+    g_has_legacy_routes = g_has_legacy_routes || g_legacy_max_id > 0;
+    sqlite3_close(source);
+    
+    std::ostringstream oss;
+    oss << "moved " << moved.size() << " buckets, " << copied << " tasks from shard " << shard
+        << " to shard " << target << " (" << targetPath << ")";
+    
+    // 3. Удаление перенесённых строк из исходного шарда. Корзины уже переключены,
+    // поэтому при сбое строки там недостижимы: их дочищает cleanupShard.
+    std::string cleanup;
+    ok = cleanupShard(shard, cleanup);
+    oss << "; " << cleanup;
+    if (!ok) {
+        oss << "; finish with: todomanager-rebalance <db_path> cleanup " << shard;
+    }
+    report = oss.str();
+    return ok;
 }
 
+bool Database::cleanupShard(int shard, std::string& report) {
+    if (shard < 0 || shard >= g_shard_count) {
+        report = "no shard " + std::to_string(shard);
+        return false;
+    }
+    std::ostringstream kept;
+    bool first = true;
+    for (int bucket = 0; bucket < kBuckets; ++bucket) {
+        if (g_bucket_shard[bucket] == shard) {
+            kept << (first ? "" : ",") << bucket;
+            first = false;
+        }
+    }
+    std::string foreign = "user_bucket(user_id) NOT IN (" + kept.str() + ")";
+    
+    sqlite3* db;
+    if (!openConnection(shardPath(shard), &db)) {
+        report = "cannot open " + shardPath(shard);
+        return false;
+    }
+    sqlite3_create_function(db, "user_bucket", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                            nullptr, userBucketFunction, nullptr, nullptr);
+    std::string tasksSql = "BEGIN IMMEDIATE; DELETE FROM tasks WHERE " + foreign + ";";
+    std::string statsSql = "DELETE FROM task_stats WHERE " + foreign + ";";
+    bool ok = sqlite3_exec(db, tasksSql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    int removed = sqlite3_changes(db);
+    ok = ok && sqlite3_exec(db, statsSql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK &&
+         sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (ok) {
+        report = "removed " + std::to_string(removed) + " moved tasks from shard " + std::to_string(shard);
+    } else {
+        report = "cleanup of shard " + std::to_string(shard) + " failed: " + sqlite3_errmsg(db);
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    sqlite3_close(db);
+    return ok;
+}
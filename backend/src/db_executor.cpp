@@ -0,0 +1,191 @@
+#include "../include/db_executor.h"
+#include "../include/db.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class JobQueue {
+public:
+    explicit JobQueue(std::string name) : name_(std::move(name)) {}
+
+    void start(int threads) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        shutdown_ = false;
+        for (int i = 0; i < threads; ++i) {
+            threads_.emplace_back([this] { work(); });
+        }
+        thread_count_ = threads;
+    }
+
+    // Потоки дорабатывают очередь до конца
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        cond_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+    bool enqueue(std::function<void()> fn) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (threads_.empty() || shutdown_) {
+                return false;
+            }
+            jobs_.push_back({std::move(fn), std::chrono::steady_clock::now()});
+            size_t depth = jobs_.size();
+            depth_ = depth;
+            if (depth > peak_depth_) {
+                peak_depth_ = depth;
+            }
+        }
+        cond_.notify_one();
+        return true;
+    }
+
+    void appendStats(std::ostringstream& oss) const {
+        unsigned long long jobs = jobs_done_.load();
+        oss << "\"" << name_ << "\":{"
+            << "\"threads\":" << thread_count_.load() << ","
+            << "\"depth\":" << depth_.load() << ","
+            << "\"peak_depth\":" << peak_depth_.load() << ","
+            << "\"jobs\":" << jobs << ","
+            << "\"avg_wait_us\":" << (jobs ? wait_us_.load() / jobs : 0) << ","
+            << "\"max_wait_us\":" << max_wait_us_.load() << ","
+            << "\"avg_exec_us\":" << (jobs ? exec_us_.load() / jobs : 0) << ","
+            << "\"max_exec_us\":" << max_exec_us_.load()
+            << "}";
+    }
+
+private:
+    struct Job {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point enqueued_at;
+    };
+
+    static void raise(std::atomic<unsigned long long>& max, unsigned long long value) {
+        unsigned long long current = max.load();
+        while (value > current && !max.compare_exchange_weak(current, value)) {
+        }
+    }
+
+    void work() {
+        Database::pinThreadConnections();
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [&] { return !jobs_.empty() || shutdown_; });
+                if (shutdown_ && jobs_.empty()) {
+                    break;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                depth_ = jobs_.size();
+            }
+            auto started = std::chrono::steady_clock::now();
+            job.fn();
+            auto finished = std::chrono::steady_clock::now();
+
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(started - job.enqueued_at).count();
+            auto exec = std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count();
+            wait_us_ += wait;
+            exec_us_ += exec;
+            raise(max_wait_us_, wait);
+            raise(max_exec_us_, exec);
+            jobs_done_++;
+        }
+        Database::releaseThreadConnections();
+    }
+
+    std::string name_;
+    bool shutdown_ = false;
+    std::vector<std::thread> threads_;
+    std::deque<Job> jobs_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    std::atomic<int> thread_count_{0};
+    std::atomic<size_t> depth_{0};
+    std::atomic<size_t> peak_depth_{0};
+    std::atomic<unsigned long long> jobs_done_{0};
+    std::atomic<unsigned long long> wait_us_{0};
+    std::atomic<unsigned long long> max_wait_us_{0};
+    std::atomic<unsigned long long> exec_us_{0};
+    std::atomic<unsigned long long> max_exec_us_{0};
+};
+
+// Писатель шарда N - g_writers[N]; число шардов не меняется, пока сервер работает
+std::vector<std::unique_ptr<JobQueue>> g_writers;
+JobQueue g_readers("readers");
+std::atomic<bool> g_enabled{false};
+
+}
+
+void DbExecutor::start(int readers) {
+    if (readers <= 0 || g_enabled) {
+        return;
+    }
+    // SQLite в WAL допускает одного писателя на файл: у каждого шарда свой поток записи,
+    // он не ждёт блокировку за другими записями, а шарды и читатели идут параллельно
+    if (g_writers.empty()) {
+        for (int shard = 0; shard < Database::shardCount(); ++shard) {
+            g_writers.push_back(std::make_unique<JobQueue>("shard" + std::to_string(shard)));
+        }
+    }
+    for (auto& writer : g_writers) {
+        writer->start(1);
+    }
+    g_readers.start(readers);
+    g_enabled = true;
+}
+
+void DbExecutor::stop() {
+    if (!g_enabled.exchange(false)) {
+        return;
+    }
+    g_readers.stop();
+    for (auto& writer : g_writers) {
+        writer->stop();
+    }
+}
+
+bool DbExecutor::enabled() {
+    return g_enabled;
+}
+
+bool DbExecutor::enqueue(bool write, std::function<void()> job, int shard) {
+    if (!write) {
+        return g_readers.enqueue(std::move(job));
+    }
+    if (shard < 0 || shard >= static_cast<int>(g_writers.size())) {
+        shard = 0;
+    }
+    return !g_writers.empty() && g_writers[shard]->enqueue(std::move(job));
+}
+
+std::string DbExecutor::statsJson() {
+    std::ostringstream oss;
+    oss << "{\"enabled\":" << (g_enabled ? "true" : "false") << ",";
+    oss << "\"writers\":{";
+    for (size_t shard = 0; shard < g_writers.size(); ++shard) {
+        oss << (shard ? "," : "");
+        g_writers[shard]->appendStats(oss);
+    }
+    oss << "},";
+    g_readers.appendStats(oss);
+    oss << "}";
+    return oss.str();
+}
@@ -0,0 +1,209 @@
+#include "../include/event_hub.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+size_t EventHub::max_subscribers_ = 64;
+size_t EventHub::buffer_events_ = 64;
+int EventHub::heartbeat_sec_ = 15;
+
+typedef std::shared_ptr<const std::string> Frame;
+
+struct EventSubscriber {
+    int user_id;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Frame> frames;
+    bool closed = false;
+};
+
+namespace {
+
+std::mutex g_mutex;
+std::unordered_map<int, std::vector<std::shared_ptr<EventSubscriber>>> g_subscribers;
+size_t g_count = 0;
+bool g_closed = false;    // после closeAll новые подписки не принимаются
+
+std::atomic<size_t> g_peak{0};
+std::atomic<unsigned long long> g_published{0};
+std::atomic<unsigned long long> g_delivered{0};
+std::atomic<unsigned long long> g_evicted{0};
+std::atomic<unsigned long long> g_rejected{0};
+
+// Клиент переподключится через retry мс, после переподключения он перечитывает список
+const Frame kHello = std::make_shared<const std::string>("retry: 3000\n\n");
+
+void close(EventSubscriber& subscriber) {
+    {
+        std::lock_guard<std::mutex> lock(subscriber.mutex);
+        subscriber.closed = true;
+        subscriber.frames.clear();
+    }
+    subscriber.cond.notify_all();
+}
+
+// Вызывается под g_mutex
+bool removeLocked(const std::shared_ptr<EventSubscriber>& subscriber) {
+    auto it = g_subscribers.find(subscriber->user_id);
+    if (it == g_subscribers.end()) {
+        return false;
+    }
+    auto& list = it->second;
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (list[i] == subscriber) {
+            list[i] = list.back();
+            list.pop_back();
+            if (list.empty()) {
+                g_subscribers.erase(it);
+            }
+            g_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+void EventHub::configure(size_t maxSubscribers, size_t bufferEvents, int heartbeatSec) {
+    max_subscribers_ = maxSubscribers;
+    buffer_events_ = bufferEvents > 0 ? bufferEvents : 1;
+    heartbeat_sec_ = heartbeatSec > 0 ? heartbeatSec : 1;
+}
+
+std::shared_ptr<EventSubscriber> EventHub::subscribe(int user_id) {
+    auto subscriber = std::make_shared<EventSubscriber>();
+    subscriber->user_id = user_id;
+    subscriber->frames.push_back(kHello);
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_closed || g_count >= max_subscribers_) {
+        g_rejected++;
+        return nullptr;
+    }
+    g_subscribers[user_id].push_back(subscriber);
+    g_count++;
+    if (g_count > g_peak) {
+        g_peak = g_count;
+    }
+    return subscriber;
+}
+
+void EventHub::unsubscribe(const std::shared_ptr<EventSubscriber>& subscriber) {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        removeLocked(subscriber);
+    }
+    close(*subscriber);
+}
+
+bool EventHub::next(const std::shared_ptr<EventSubscriber>& subscriber, std::string& out) {
+    std::deque<Frame> frames;
+    {
+        std::unique_lock<std::mutex> lock(subscriber->mutex);
+        subscriber->cond.wait_for(lock, std::chrono::seconds(heartbeat_sec_), [&] {
+            return subscriber->closed || !subscriber->frames.empty();
+        });
+        if (subscriber->closed) {
+            return false;
+        }
+        frames.swap(subscriber->frames);
+    }
+
+    if (frames.empty()) {
+        // Пинг не даёт прокси закрыть простаивающее соединение и выявляет отключившихся клиентов
+        out += ": ping\n\n";
+        return true;
+    }
+    for (const auto& frame : frames) {
+        out += *frame;
+    }
+    g_delivered += frames.size();
+    return true;
+}
+
+void EventHub::publish(int user_id, const char* event, const std::string& data) {
+    std::vector<std::shared_ptr<EventSubscriber>> slow;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        auto it = g_subscribers.find(user_id);
+        if (it == g_subscribers.end()) {
+            return;
+        }
+
+        std::string text;
+        text.reserve(data.size() + 32);
+        text.append("event: ").append(event).append("\ndata: ").append(data).append("\n\n");
+        Frame frame = std::make_shared<const std::string>(std::move(text));
+        g_published++;
+
+        for (const auto& subscriber : it->second) {
+            bool overflow = false;
+            {
+                std::lock_guard<std::mutex> subLock(subscriber->mutex);
+                if (subscriber->frames.size() >= buffer_events_) {
+                    overflow = true;
+                } else {
+                    subscriber->frames.push_back(frame);
+                }
+            }
+            if (overflow) {
+                slow.push_back(subscriber);
+            } else {
+                subscriber->cond.notify_one();
+            }
+        }
+        // Медленный клиент пропустил бы события - отключаем его, он переподключится
+        for (const auto& subscriber : slow) {
+            removeLocked(subscriber);
+        }
+    }
+
+    for (const auto& subscriber : slow) {
+        close(*subscriber);
+        g_evicted++;
+    }
+}
+
+void EventHub::closeAll() {
+    std::vector<std::shared_ptr<EventSubscriber>> all;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (auto& entry : g_subscribers) {
+            all.insert(all.end(), entry.second.begin(), entry.second.end());
+        }
+        g_subscribers.clear();
+        g_count = 0;
+        g_closed = true;
+    }
+    for (const auto& subscriber : all) {
+        close(*subscriber);
+    }
+}
+
+std::string EventHub::statsJson() {
+    size_t subscribers;
+    size_t users;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        subscribers = g_count;
+        users = g_subscribers.size();
+    }
+    std::ostringstream oss;
+    oss << "{"
+        << "\"subscribers\":" << subscribers << ","
+        << "\"peak_subscribers\":" << g_peak.load() << ","
+        << "\"users\":" << users << ","
+        << "\"max_subscribers\":" << max_subscribers_ << ","
+        << "\"published\":" << g_published.load() << ","
+        << "\"delivered\":" << g_delivered.load() << ","
+        << "\"evicted\":" << g_evicted.load() << ","
+        << "\"rejected\":" << g_rejected.load()
+        << "}";
+    return oss.str();
+}
@@ -0,0 +1,888 @@
+#include "../include/event_server.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Запрос без конца заголовков длиннее этого - ошибка клиента
+const size_t kMaxHeaderBytes = 64 * 1024;
+// Тело до этого размера накапливается до передачи в пул; большее (импорт)
+// и chunked воркер дочитывает сам по мере поступления
+const size_t kMaxBufferedBody = 1024 * 1024;
+// Непрочитанный воркером ввод, после которого event loop перестаёт читать сокет
+const size_t kMaxPendingInput = 4 * 1024 * 1024;
+const size_t kReadChunk = 64 * 1024;
+const size_t kHeldBytes = 16 * 1024;
+
+const char kUnavailable[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+const char kHeaderTooLarge[] =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+bool g_epoll = false;
+int g_loops = 0;
+std::atomic<long long> g_connections{0};
+std::atomic<long long> g_peak_connections{0};
+std::atomic<unsigned long long> g_accepted{0};
+std::atomic<unsigned long long> g_rejected{0};
+std::atomic<unsigned long long> g_requests{0};
+std::atomic<unsigned long long> g_queue_full{0};
+std::atomic<unsigned long long> g_idle_closed{0};
+std::atomic<unsigned long long> g_deferred{0};
+std::atomic<long long> g_parked{0};
+
+// Поток запроса, который сейчас обрабатывает этот поток пула (для defer/resumed)
+thread_local httplib::Stream* t_stream = nullptr;
+
+bool equalsIgnoreCase(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Сколько байт тела дождаться до передачи запроса в пул. Заголовки - [0, headerEnd)
+size_t bodyToBuffer(const std::string& in, size_t headerEnd) {
+    static const char kLength[] = "content-length:";
+    static const char kEncoding[] = "transfer-encoding:";
+    size_t pos = in.find("\r\n");
+    while (pos != std::string::npos && pos < headerEnd) {
+        size_t line = pos + 2;
+        size_t next = in.find("\r\n", line);
+        size_t length = (next == std::string::npos ? headerEnd : next) - line;
+        if (length > sizeof(kEncoding) - 1 && equalsIgnoreCase(in.data() + line, kEncoding, sizeof(kEncoding) - 1)) {
+            return 0;
+        }
+        if (length > sizeof(kLength) - 1 && equalsIgnoreCase(in.data() + line, kLength, sizeof(kLength) - 1)) {
+            unsigned long long value = std::strtoull(in.c_str() + line + sizeof(kLength) - 1, nullptr, 10);
+            return value <= kMaxBufferedBody ? static_cast<size_t>(value) : 0;
+        }
+        pos = next;
+    }
+    return 0;
+}
+
+}
+
+#ifdef __linux__
+
+struct EventServer::Connection {
+    int fd = -1;
+    Loop* loop = nullptr;
+    std::string remote_addr;
+    int remote_port = 0;
+    std::string local_addr;
+    int local_port = 0;
+    size_t requests = 0;
+    // Только поток event loop
+    size_t scanned = 0;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::string in;            // пришло и ещё не прочитано воркером
+    std::string out;           // ответ event loop (503, 431), ещё не отправленный
+    size_t out_offset = 0;
+    bool busy = false;         // запрос у воркера
+    bool eof = false;          // клиент закрыл свою сторону
+    bool broken = false;       // ошибка сокета, писать некуда
+    bool close_after_flush = false;
+    bool read_paused = false;
+    // Ответ отложен (defer): запрос вернулся в in и ждёт resume
+    bool parked = false;
+    std::shared_ptr<void> resumed;
+    std::chrono::steady_clock::time_point last_active;
+
+    size_t pending() const { return out.size() - out_offset; }
+    // В in есть заголовки запроса и та часть тела, которую dispatch ждёт до передачи воркеру
+    bool requestBuffered() const {
+        size_t headerEnd = in.find("\r\n\r\n");
+        return headerEnd != std::string::npos && in.size() >= headerEnd + 4 + bodyToBuffer(in, headerEnd);
+    }
+};
+
+struct EventServer::Loop {
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int listen_fd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+    std::vector<char> buffer;
+
+    // Соединения, которые воркер вернул или просит дочитать
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Connection>> completed;
+
+    void post(const std::shared_ptr<Connection>& conn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(conn);
+        }
+        wake();
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+};
+
+// Поток httplib поверх соединения event loop. Ввод забирается из Connection::in
+// целиком; ответ воркер пишет в сокет сам, пока запрос у него (event loop пишет
+// только свои готовые ответы 503/431 в Connection::out).
+class EventServer::ConnectionStream : public httplib::Stream {
+public:
+    ConnectionStream(EventServer& server, const std::shared_ptr<Connection>& conn,
+                     std::shared_ptr<void> resumed, time_t readTimeoutSec, time_t writeTimeoutSec)
+        : server_(server),
+          owner_(conn),
+          conn_(*conn),
+          resumed_(std::move(resumed)),
+          read_timeout_(std::chrono::seconds(readTimeoutSec)),
+          write_timeout_(std::chrono::seconds(writeTimeoutSec)),
+          start_(std::chrono::steady_clock::now()) {}
+
+    bool is_readable() const override { return pos_ < input_.size(); }
+
+    bool wait_readable() const override {
+        if (pos_ < input_.size()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(conn_.mutex);
+        conn_.cond.wait_for(lock, read_timeout_, [&] { return !conn_.in.empty() || conn_.eof || conn_.broken; });
+        return !conn_.in.empty();
+    }
+
+    bool wait_writable() const override {
+        pollfd fd{conn_.fd, POLLOUT, 0};
+        return !isBroken() && ::poll(&fd, 1, static_cast<int>(write_timeout_.count() * 1000)) > 0 &&
+               !(fd.revents & (POLLERR | POLLHUP));
+    }
+
+    ssize_t read(char* ptr, size_t size) override {
+        if (pos_ == input_.size() && !fill()) {
+            return eof_ ? 0 : -1;
+        }
+        size_t n = std::min(size, input_.size() - pos_);
+        std::memcpy(ptr, input_.data() + pos_, n);
+        pos_ += n;
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write(const char* ptr, size_t size) override {
+        if (deferred_) {
+            return static_cast<ssize_t>(size);
+        }
+        // Первая запись - блок заголовков: он уходит вместе с телом одним вызовом
+        if (++writes_ == 1 && size < kHeldBytes) {
+            held_.assign(ptr, size);
+            return static_cast<ssize_t>(size);
+        }
+        return send(ptr, size) ? static_cast<ssize_t>(size) : -1;
+    }
+
+    void get_remote_ip_and_port(std::string& ip, int& port) const override {
+        ip = conn_.remote_addr;
+        port = conn_.remote_port;
+    }
+
+    void get_local_ip_and_port(std::string& ip, int& port) const override {
+        ip = conn_.local_addr;
+        port = conn_.local_port;
+    }
+
+    socket_t socket() const override { return conn_.fd; }
+
+    time_t duration() const override {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+    }
+
+    // После process_request: отправить отложенные заголовки и вернуть непрочитанный
+    // ввод (следующие запросы конвейера). Отложенный запрос возвращается целиком
+    // для повторного прохода.
+    bool finish() {
+        bool ok = deferred_ || held_.empty() || send(nullptr, 0);
+        size_t keep = deferred_ ? 0 : pos_;
+        if (keep < input_.size()) {
+            std::lock_guard<std::mutex> lock(conn_.mutex);
+            conn_.in.insert(0, input_, keep, std::string::npos);
+        }
+        return ok;
+    }
+
+    // Повторить запрос можно, только если он весь пришёл одним куском ввода
+    // и ответ ещё не начали писать
+    bool defer() {
+        if (fills_ != 1 || writes_ > 0) {
+            return false;
+        }
+        deferred_ = true;
+        return true;
+    }
+
+    bool deferred() const { return deferred_; }
+    EventServer& server() const { return server_; }
+    const std::shared_ptr<Connection>& connection() const { return owner_; }
+    const std::shared_ptr<void>& resumedState() const { return resumed_; }
+
+private:
+    bool fill() {
+        std::unique_lock<std::mutex> lock(conn_.mutex);
+        conn_.cond.wait_for(lock, read_timeout_, [&] { return !conn_.in.empty() || conn_.eof || conn_.broken; });
+        if (conn_.in.empty()) {
+            eof_ = conn_.eof && !conn_.broken;
+            return false;
+        }
+        input_.swap(conn_.in);
+        conn_.in.clear();
+        pos_ = 0;
+        fills_++;
+        bool resume = conn_.read_paused;
+        lock.unlock();
+        if (resume) {
+            conn_.loop->post(owner_);
+        }
+        return true;
+    }
+
+    bool isBroken() const {
+        std::lock_guard<std::mutex> lock(conn_.mutex);
+        return conn_.broken;
+    }
+
+    // Пишет из потока воркера: соединение занято запросом, event loop в сокет не пишет.
+    // Тело не копируется, заголовки и тело уходят одним sendmsg.
+    bool send(const char* data, size_t size) {
+        if (isBroken()) {
+            return false;
+        }
+        iovec parts[2] = {{&held_[0], held_.size()}, {const_cast<char*>(data), size}};
+        int first = held_.empty() ? 1 : 0;
+        while (first < 2) {
+            msghdr message{};
+            message.msg_iov = parts + first;
+            message.msg_iovlen = static_cast<size_t>(2 - first);
+            ssize_t n = ::sendmsg(conn_.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // Медленный клиент: ждём его, как и обычный режим httplib
+                if (wait_writable()) {
+                    continue;
+                }
+                n = -1;
+            }
+            if (n < 0) {
+                std::lock_guard<std::mutex> lock(conn_.mutex);
+                conn_.broken = true;
+                return false;
+            }
+            size_t sent = static_cast<size_t>(n);
+            while (first < 2 && sent >= parts[first].iov_len) {
+                sent -= parts[first].iov_len;
+                first++;
+            }
+            if (first < 2) {
+                parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + sent;
+                parts[first].iov_len -= sent;
+            }
+        }
+        held_.clear();
+        return true;
+    }
+
+    EventServer& server_;
+    std::shared_ptr<Connection> owner_;
+    Connection& conn_;
+    std::shared_ptr<void> resumed_;
+    std::chrono::seconds read_timeout_;
+    std::chrono::seconds write_timeout_;
+    std::chrono::steady_clock::time_point start_;
+
+    std::string input_;
+    size_t pos_ = 0;
+    bool eof_ = false;
+    std::string held_;
+    size_t writes_ = 0;
+    size_t fills_ = 0;
+    bool deferred_ = false;
+};
+
+namespace {
+
+std::string addressToString(const sockaddr_storage& addr, int& port) {
+    char host[INET6_ADDRSTRLEN] = {0};
+    if (addr.ss_family == AF_INET) {
+        const auto& in4 = reinterpret_cast<const sockaddr_in&>(addr);
+        inet_ntop(AF_INET, &in4.sin_addr, host, sizeof(host));
+        port = ntohs(in4.sin_port);
+    } else if (addr.ss_family == AF_INET6) {
+        const auto& in6 = reinterpret_cast<const sockaddr_in6&>(addr);
+        inet_ntop(AF_INET6, &in6.sin6_addr, host, sizeof(host));
+        port = ntohs(in6.sin6_port);
+    }
+    return host;
+}
+
+// Свой слушающий сокет на каждый event loop: с SO_REUSEPORT ядро само раздаёт
+// соединения между ними (и между процессами в prefork-режиме)
+int createListener(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* rp = result; rp != nullptr; rp = rp->ai_next) {
+        fd = ::socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+        if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+}
+
+EventServer::EventServer() = default;
+
+EventServer::~EventServer() = default;
+
+void EventServer::configure(int loops, int maxConnections, int idleTimeoutSec) {
+    loop_count_ = loops;
+    max_connections_ = maxConnections > 0 ? maxConnections : 10000;
+    idle_timeout_sec_ = idleTimeoutSec > 0 ? idleTimeoutSec : 60;
+    if (loops > 0) {
+        // Клиент узнаёт срок простоя из заголовка Keep-Alive
+        keep_alive_timeout_sec_ = idle_timeout_sec_;
+    }
+}
+
+bool EventServer::supported() {
+    return true;
+}
+
+bool EventServer::run(const std::string& host, int port) {
+    if (loop_count_ <= 0) {
+        return listen(host, port);
+    }
+
+    queue_.reset(new_task_queue ? new_task_queue() : new httplib::ThreadPool(CPPHTTPLIB_THREAD_POOL_COUNT));
+    bool ok = true;
+    for (int i = 0; i < loop_count_ && ok; ++i) {
+        std::unique_ptr<Loop> loop(new Loop());
+        loop->buffer.resize(kReadChunk);
+        loop->listen_fd = createListener(host, port);
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ok = loop->listen_fd >= 0 && loop->epoll_fd >= 0 && loop->wake_fd >= 0;
+        if (ok) {
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = loop->listen_fd;
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &event);
+            event.data.fd = loop->wake_fd;
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+        }
+        loops_.push_back(std::move(loop));
+    }
+
+    if (ok) {
+        g_epoll = true;
+        g_loops = loop_count_;
+        // write_content_with_provider считает сервер остановленным, пока svr_sock_ невалиден
+        svr_sock_ = loops_[0]->listen_fd;
+        state_ = 1;
+        for (auto& loop : loops_) {
+            Loop* raw = loop.get();
+            loop->thread = std::thread([this, raw] { loopMain(*raw); });
+        }
+        for (auto& loop : loops_) {
+            loop->thread.join();
+        }
+    }
+
+    // Воркер будит свой event loop уже после того, как отпустил соединение,
+    // поэтому циклы освобождаются только после остановки пула
+    queue_->shutdown();
+    queue_.reset();
+    for (auto& loop : loops_) {
+        for (int fd : {loop->listen_fd, loop->epoll_fd, loop->wake_fd}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+    loops_.clear();
+    svr_sock_ = INVALID_SOCKET;
+    state_ = 2;
+    return ok;
+}
+
+void EventServer::shutdown() {
+    if (loop_count_ <= 0) {
+        wait_until_ready();
+        stop();
+        return;
+    }
+    while (state_ == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (state_ != 1 || stopping_.exchange(true)) {
+        return;
+    }
+    svr_sock_ = INVALID_SOCKET;
+    for (auto& loop : loops_) {
+        loop->wake();
+    }
+}
+
+void EventServer::loopMain(Loop& loop) {
+    const int kMaxEvents = 256;
+    epoll_event events[kMaxEvents];
+    auto nextSweep = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    bool draining = false;
+    for (;;) {
+        int n = epoll_wait(loop.epoll_fd, events, kMaxEvents, 1000);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == loop.listen_fd) {
+                acceptConnections(loop);
+                continue;
+            }
+            if (fd == loop.wake_fd) {
+                uint64_t value;
+                while (::read(loop.wake_fd, &value, sizeof(value)) > 0) {
+                }
+                std::vector<std::shared_ptr<Connection>> completed;
+                {
+                    std::lock_guard<std::mutex> lock(loop.mutex);
+                    completed.swap(loop.completed);
+                }
+                for (auto& conn : completed) {
+                    if (conn->closed) {
+                        continue;
+                    }
+                    readConnection(loop, conn);
+                }
+                continue;
+            }
+            auto it = loop.connections.find(fd);
+            if (it == loop.connections.end()) {
+                continue;
+            }
+            std::shared_ptr<Connection> conn = it->second;
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                std::lock_guard<std::mutex> lock(conn->mutex);
+                conn->broken = true;
+                conn->eof = true;
+                conn->cond.notify_all();
+            }
+            if (events[i].events & EPOLLOUT) {
+                flushConnection(loop, conn);
+            }
+            if (!conn->closed && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                readConnection(loop, conn);
+            }
+        }
+
+        if (stopping_ && !draining) {
+            // Новые соединения не принимаем, остальные закрываются по мере завершения запросов
+            draining = true;
+            epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, loop.listen_fd, nullptr);
+            ::close(loop.listen_fd);
+            loop.listen_fd = -1;
+            sweep(loop, true);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextSweep) {
+            sweep(loop, draining);
+            nextSweep = now + std::chrono::seconds(1);
+        }
+        if (draining && loop.connections.empty()) {
+            break;
+        }
+    }
+}
+
+void EventServer::acceptConnections(Loop& loop) {
+    for (;;) {
+        sockaddr_storage addr{};
+        socklen_t length = sizeof(addr);
+        int fd = accept4(loop.listen_fd, reinterpret_cast<sockaddr*>(&addr), &length,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EAGAIN - очередь пуста; EMFILE и т.п. - повторим на следующем событии
+            return;
+        }
+        if (g_connections.load() >= max_connections_ || stopping_) {
+            g_rejected++;
+            ::close(fd);
+            continue;
+        }
+        // Ответ уходит одним send, Nagle только задерживал бы его до ACK
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        auto conn = std::make_shared<Connection>();
+        conn->fd = fd;
+        conn->loop = &loop;
+        conn->remote_addr = addressToString(addr, conn->remote_port);
+        sockaddr_storage local{};
+        length = sizeof(local);
+        if (getsockname(fd, reinterpret_cast<sockaddr*>(&local), &length) == 0) {
+            conn->local_addr = addressToString(local, conn->local_port);
+        }
+        conn->last_active = std::chrono::steady_clock::now();
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            ::close(fd);
+            continue;
+        }
+        loop.connections[fd] = conn;
+        g_accepted++;
+        long long current = ++g_connections;
+        long long peak = g_peak_connections.load();
+        while (current > peak && !g_peak_connections.compare_exchange_weak(peak, current)) {
+        }
+    }
+}
+
+void EventServer::readConnection(Loop& loop, const std::shared_ptr<Connection>& conn) {
+    {
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        if (conn->read_paused && conn->in.size() < kMaxPendingInput / 2) {
+            conn->read_paused = false;
+        }
+        while (!conn->read_paused && !conn->eof) {
+            lock.unlock();
+            ssize_t n = ::recv(conn->fd, loop.buffer.data(), loop.buffer.size(), 0);
+            int error = errno;
+            lock.lock();
+            if (n > 0) {
+                conn->in.append(loop.buffer.data(), static_cast<size_t>(n));
+                conn->last_active = std::chrono::steady_clock::now();
+                if (conn->busy) {
+                    conn->cond.notify_all();
+                    conn->read_paused = conn->in.size() >= kMaxPendingInput;
+                }
+                continue;
+            }
+            if (n < 0 && error == EINTR) {
+                continue;
+            }
+            if (n < 0 && (error == EAGAIN || error == EWOULDBLOCK)) {
+                break;
+            }
+            conn->eof = true;
+            conn->broken = n < 0;
+            conn->cond.notify_all();
+        }
+        if (conn->busy) {
+            return;
+        }
+        // Клиент закрыл свою сторону (half-close после запроса или конвейера запросов):
+        // пришедшие целиком запросы ещё обслуживаются по одному, соединение закрывается
+        // после ответа на последний
+        bool drainInput = conn->eof && !conn->broken && !conn->close_after_flush &&
+                          conn->pending() == 0 && conn->requestBuffered();
+        if (!drainInput) {
+            if (conn->broken || ((conn->eof || conn->close_after_flush) && conn->pending() == 0)) {
+                lock.unlock();
+                closeConnection(loop, conn);
+                return;
+            }
+            if (conn->close_after_flush || conn->eof) {
+                return;
+            }
+        }
+    }
+    dispatch(loop, conn);
+}
+
+void EventServer::flushConnection(Loop& loop, const std::shared_ptr<Connection>& conn) {
+    bool close = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        while (conn->pending() > 0 && !conn->broken) {
+            ssize_t n = ::send(conn->fd, conn->out.data() + conn->out_offset, conn->pending(),
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                conn->out_offset += static_cast<size_t>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                conn->broken = true;
+            }
+        }
+        if (conn->pending() == 0) {
+            conn->out.clear();
+            conn->out_offset = 0;
+            conn->last_active = std::chrono::steady_clock::now();
+        }
+        conn->cond.notify_all();
+        close = !conn->busy &&
+                (conn->broken || ((conn->close_after_flush || conn->eof) && conn->pending() == 0));
+    }
+    if (close) {
+        closeConnection(loop, conn);
+    }
+}
+
+void EventServer::dispatch(Loop& loop, const std::shared_ptr<Connection>& conn) {
+    bool dispatched = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        size_t headerEnd = conn->in.find("\r\n\r\n", conn->scanned);
+        if (headerEnd == std::string::npos) {
+            conn->scanned = conn->in.size() > 3 ? conn->in.size() - 3 : 0;
+            if (conn->in.size() > kMaxHeaderBytes) {
+                conn->out.append(kHeaderTooLarge, sizeof(kHeaderTooLarge) - 1);
+                conn->close_after_flush = true;
+            } else {
+                return;
+            }
+        } else if (conn->in.size() < headerEnd + 4 + bodyToBuffer(conn->in, headerEnd)) {
+            conn->scanned = headerEnd;
+            return;
+        } else {
+            conn->scanned = 0;
+            conn->busy = true;
+            conn->requests++;
+            dispatched = true;
+        }
+    }
+    if (!dispatched) {
+        flushConnection(loop, conn);
+        return;
+    }
+
+    g_requests++;
+    std::shared_ptr<Connection> job = conn;
+    if (!queue_->enqueue([this, job] { handle(job); })) {
+        g_queue_full++;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            conn->busy = false;
+            conn->out.append(kUnavailable, sizeof(kUnavailable) - 1);
+            conn->close_after_flush = true;
+        }
+        flushConnection(loop, conn);
+    }
+}
+
+void EventServer::handle(const std::shared_ptr<Connection>& conn, std::shared_ptr<void> resumed) {
+    if (resumed) {
+        g_parked--;
+    }
+    ConnectionStream strm(*this, conn, std::move(resumed), read_timeout_sec_, write_timeout_sec_);
+    bool closeRequested = stopping_ || conn->requests >= keep_alive_max_count_;
+    bool connectionClosed = false;
+    t_stream = &strm;
+    bool ok = process_request(strm, conn->remote_addr, conn->remote_port, conn->local_addr,
+                              conn->local_port, closeRequested, connectionClosed, nullptr);
+    t_stream = nullptr;
+    ok = strm.finish() && ok;
+    if (strm.deferred()) {
+        // Соединение остаётся занятым; если обработчик уже успел закончить,
+        // повторный проход выполняется сразу в этом же потоке
+        std::shared_ptr<void> state;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            state.swap(conn->resumed);
+            conn->parked = !state;
+        }
+        if (state) {
+            handle(conn, std::move(state));
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->busy = false;
+        conn->last_active = std::chrono::steady_clock::now();
+        if (!ok || connectionClosed || closeRequested) {
+            conn->close_after_flush = true;
+        }
+    }
+    complete(conn);
+}
+
+void EventServer::complete(const std::shared_ptr<Connection>& conn) {
+    conn->loop->post(conn);
+}
+
+void EventServer::resume(const std::shared_ptr<Connection>& conn, std::shared_ptr<void> state) {
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (!conn->parked) {
+            // handle ещё не вернулся из process_request, он подхватит состояние сам
+            conn->resumed = std::move(state);
+            return;
+        }
+        conn->parked = false;
+    }
+    // Пока есть отложенные запросы, соединения заняты и пул не останавливается
+    auto job = std::make_shared<std::pair<std::shared_ptr<Connection>, std::shared_ptr<void>>>(conn, std::move(state));
+    if (!queue_->enqueue([this, job] { handle(job->first, std::move(job->second)); })) {
+        g_queue_full++;
+        handle(job->first, std::move(job->second));
+    }
+}
+
+EventServer::Resume EventServer::defer() {
+    auto* strm = static_cast<ConnectionStream*>(t_stream);
+    if (!strm || !strm->defer()) {
+        return {};
+    }
+    g_deferred++;
+    g_parked++;
+    EventServer* server = &strm->server();
+    std::shared_ptr<Connection> conn = strm->connection();
+    return [server, conn](std::shared_ptr<void> state) { server->resume(conn, std::move(state)); };
+}
+
+std::shared_ptr<void> EventServer::resumed() {
+    auto* strm = static_cast<ConnectionStream*>(t_stream);
+    return strm ? strm->resumedState() : nullptr;
+}
+
+void EventServer::closeConnection(Loop& loop, const std::shared_ptr<Connection>& conn) {
+    if (conn->closed) {
+        return;
+    }
+    conn->closed = true;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    loop.connections.erase(conn->fd);
+    g_connections--;
+}
+
+void EventServer::sweep(Loop& loop, bool draining) {
+    auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(idle_timeout_sec_);
+    std::vector<std::shared_ptr<Connection>> idle;
+    for (auto& entry : loop.connections) {
+        Connection& conn = *entry.second;
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        if (conn.busy || conn.pending() > 0) {
+            continue;
+        }
+        if (draining || conn.last_active < deadline) {
+            idle.push_back(entry.second);
+        }
+    }
+    for (auto& conn : idle) {
+        if (!draining) {
+            g_idle_closed++;
+        }
+        closeConnection(loop, conn);
+    }
+}
+
+#else
+
+struct EventServer::Connection {};
+struct EventServer::Loop {};
+
+EventServer::EventServer() = default;
+
+EventServer::~EventServer() = default;
+
+void EventServer::configure(int loops, int maxConnections, int idleTimeoutSec) {
+    if (loops > 0) {
+        std::cerr << "EVENT_LOOPS=" << loops << " ignored: the epoll engine needs Linux" << std::endl;
+    }
+    (void)maxConnections;
+    (void)idleTimeoutSec;
+}
+
+bool EventServer::supported() {
+    return false;
+}
+
+bool EventServer::run(const std::string& host, int port) {
+    return listen(host, port);
+}
+
+void EventServer::shutdown() {
+    wait_until_ready();
+    stop();
+}
+
+EventServer::Resume EventServer::defer() {
+    return {};
+}
+
+std::shared_ptr<void> EventServer::resumed() {
+    return nullptr;
+}
+
+#endif
+
+std::string EventServer::statsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"engine\":\"" << (g_epoll ? "epoll" : "threads") << "\"";
+    if (g_epoll) {
+        oss << ",\"loops\":" << g_loops
+            << ",\"connections\":" << g_connections.load()
+            << ",\"peak_connections\":" << g_peak_connections.load()
+            << ",\"accepted\":" << g_accepted.load()
+            << ",\"rejected\":" << g_rejected.load()
+            << ",\"requests\":" << g_requests.load()
+            << ",\"queue_full\":" << g_queue_full.load()
+            << ",\"idle_closed\":" << g_idle_closed.load()
+            << ",\"deferred\":" << g_deferred.load()
+            << ",\"parked\":" << g_parked.load();
+    }
+    oss << "}";
+    return oss.str();
+}
@@ -0,0 +1,341 @@
+#include "../include/idempotency.h"
+#include "../include/db_executor.h"
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const size_t kShardCount = 16;
+const size_t kMaxKeyLength = 255;
+// Устаревшие строки удаляются из базы попутно с каждым kPurgeEvery-м сбросом
+const unsigned long long kPurgeEvery = 256;
+// Заглушка в базе старше этого считается брошенной: занявший ключ процесс упал
+const int64_t kClaimTimeoutSec = 60;
+
+std::atomic<int> g_ttl_sec{86400};
+std::atomic<size_t> g_keys_per_shard{1024};
+
+std::atomic<unsigned long long> g_started{0};
+std::atomic<unsigned long long> g_replayed{0};
+std::atomic<unsigned long long> g_db_hits{0};
+std::atomic<unsigned long long> g_in_progress{0};
+std::atomic<unsigned long long> g_mismatched{0};
+std::atomic<unsigned long long> g_stored{0};
+std::atomic<unsigned long long> g_released{0};
+std::atomic<unsigned long long> g_persisted{0};
+std::atomic<unsigned long long> g_flushes{0};
+std::atomic<unsigned long long> g_evicted{0};
+std::atomic<unsigned long long> g_full{0};
+std::atomic<unsigned long long> g_persist_failures{0};
+std::atomic<unsigned long long> g_purged{0};
+
+struct Entry {
+    bool done;
+    IdempotentResponse response;
+    std::list<std::string>::iterator order;
+};
+
+struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> order; // front - самый новый ключ
+};
+
+Shard g_shards[kShardCount];
+
+int64_t nowSec() {
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+std::string entryId(int user_id, const std::string& key) {
+    return std::to_string(user_id) + ":" + key;
+}
+
+Shard& shardFor(const std::string& id) {
+    return g_shards[std::hash<std::string>()(id) % kShardCount];
+}
+
+void erase(Shard& shard, std::unordered_map<std::string, Entry>::iterator it) {
+    shard.order.erase(it->second.order);
+    shard.entries.erase(it);
+}
+
+// Под shard.mutex. Вытесняется самый старый готовый ключ: он останется в базе,
+// повтор найдёт его там. Выполняющиеся ключи не вытесняются, иначе повтор
+// запустил бы запись второй раз; false - в шарде только они, места нет.
+bool insert(Shard& shard, const std::string& id, Entry entry) {
+    if (shard.entries.size() >= g_keys_per_shard) {
+        auto victim = shard.order.end();
+        for (auto it = shard.order.rbegin(); it != shard.order.rend(); ++it) {
+            if (shard.entries.find(*it)->second.done) {
+                victim = std::prev(it.base());
+                break;
+            }
+        }
+        if (victim == shard.order.end()) {
+            g_full++;
+            return false;
+        }
+        shard.entries.erase(*victim);
+        shard.order.erase(victim);
+        g_evicted++;
+    }
+    shard.order.push_front(id);
+    entry.order = shard.order.begin();
+    shard.entries.emplace(id, std::move(entry));
+    return true;
+}
+
+// fingerprint 0 - тело ещё не прочитано, отпечаток сравнит вызывающий
+bool sameRequest(uint64_t stored, uint64_t fingerprint) {
+    return fingerprint == 0 || stored == fingerprint;
+}
+
+Idempotency::Outcome replayOrMismatch(const IdempotentResponse& stored, uint64_t fingerprint,
+                                      IdempotentResponse& response) {
+    if (!sameRequest(stored.fingerprint, fingerprint)) {
+        g_mismatched++;
+        return Idempotency::Outcome::Mismatch;
+    }
+    response = stored;
+    g_replayed++;
+    return Idempotency::Outcome::Replay;
+}
+
+// Ответы ждут записи в базу здесь. Пока задача сброса стоит в очереди потока
+// записи, новые ответы добавляются к ней: под нагрузкой одна транзакция
+// сохраняет сразу много ключей. Каждый finish ждёт сброса своего пакета.
+struct PendingBatch {
+    std::vector<IdempotentResponse> responses;
+    std::promise<void> saved;
+    std::shared_future<void> result;
+};
+
+std::mutex g_pending_mutex;
+std::shared_ptr<PendingBatch> g_pending;
+
+void flush() {
+    std::shared_ptr<PendingBatch> batch;
+    {
+        std::lock_guard<std::mutex> lock(g_pending_mutex);
+        batch.swap(g_pending);
+    }
+    if (!batch) {
+        return;
+    }
+    if (Database::saveIdempotentResponses(batch->responses)) {
+        g_persisted += batch->responses.size();
+    } else {
+        g_persist_failures += batch->responses.size();
+    }
+    batch->saved.set_value();
+    if (++g_flushes % kPurgeEvery == 0) {
+        int removed = Database::purgeIdempotentResponses(nowSec() - g_ttl_sec.load());
+        if (removed > 0) {
+            g_purged += removed;
+        }
+    }
+}
+
+}
+
+void Idempotency::configure(int ttlSec, size_t maxKeys) {
+    g_ttl_sec = std::max(0, ttlSec);
+    g_keys_per_shard = std::max<size_t>(1, maxKeys / kShardCount);
+}
+
+bool Idempotency::enabled() {
+    return g_ttl_sec.load() > 0;
+}
+
+bool Idempotency::validKey(const std::string& key) {
+    if (key.empty() || key.size() > kMaxKeyLength) {
+        return false;
+    }
+    return std::all_of(key.begin(), key.end(), [](char c) { return c > ' ' && c < 0x7f; });
+}
+
+uint64_t Idempotency::fingerprint(const std::string& method, const std::string& path, const std::string& body) {
+    return fingerprintFinish(fingerprintAppend(fingerprintStart(method, path), body.data(), body.size()));
+}
+
+uint64_t Idempotency::fingerprintStart(const std::string& method, const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = fingerprintFinish(fingerprintAppend(hash, method.data(), method.size()));
+    return fingerprintFinish(fingerprintAppend(hash, path.data(), path.size()));
+}
+
+uint64_t Idempotency::fingerprintAppend(uint64_t hash, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Разделитель после части, чтобы "PUT" + "/a" и "PU" + "T/a" различались
+uint64_t Idempotency::fingerprintFinish(uint64_t hash) {
+    return (hash ^ 0xff) * 1099511628211ull;
+}
+
+Idempotency::Outcome Idempotency::begin(int user_id, const std::string& key, uint64_t fingerprint,
+                                        IdempotentResponse& response) {
+    std::string id = entryId(user_id, key);
+    Shard& shard = shardFor(id);
+    int64_t since = nowSec() - g_ttl_sec.load();
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(id);
+        if (it != shard.entries.end()) {
+            if (!it->second.done) {
+                g_in_progress++;
+                return Outcome::InProgress;
+            }
+            if (it->second.response.created_ts >= since) {
+                return replayOrMismatch(it->second.response, fingerprint, response);
+            }
+            erase(shard, it);
+        }
+        Entry entry{false, IdempotentResponse(), {}};
+        entry.response.fingerprint = fingerprint;
+        if (!insert(shard, id, std::move(entry))) {
+            return Outcome::Busy;
+        }
+    }
+
+    // В памяти ключа нет, но его мог занять или завершить другой воркер или прошлый
+    // запуск. Ключ в памяти уже занят, параллельный повтор в этом процессе получит
+    // InProgress; в базе ключ занимается строкой-заглушкой в той же транзакции,
+    // что и проверка, поэтому из двух воркеров запрос выполнит только один.
+    IdempotentResponse stored;
+    int64_t now = nowSec();
+    IdempotencyClaim claim = DbExecutor::write([&] {
+        return Database::claimIdempotencyKey(user_id, key, fingerprint, now, since,
+                                             now - kClaimTimeoutSec, stored);
+    }).get();
+    if (claim == IdempotencyClaim::Claimed) {
+        g_started++;
+        return Outcome::Proceed;
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(id);
+    if (claim == IdempotencyClaim::Failed || stored.status == 0) {
+        // Ключ выполняет другой процесс (или база недоступна): своя запись в памяти
+        // не нужна, повтор снова спросит базу
+        if (it != shard.entries.end() && !it->second.done) {
+            erase(shard, it);
+        }
+        if (claim == IdempotencyClaim::Failed) {
+            return Outcome::Busy;
+        }
+        if (!sameRequest(stored.fingerprint, fingerprint)) {
+            g_mismatched++;
+            return Outcome::Mismatch;
+        }
+        g_in_progress++;
+        return Outcome::InProgress;
+    }
+    g_db_hits++;
+    if (it == shard.entries.end()) {
+        insert(shard, id, Entry{true, stored, {}});
+    } else {
+        it->second.done = true;
+        it->second.response = stored;
+    }
+    return replayOrMismatch(stored, fingerprint, response);
+}
+
+void Idempotency::finish(IdempotentResponse response) {
+    if (response.created_ts == 0) {
+        response.created_ts = nowSec();
+    }
+    std::string id = entryId(response.user_id, response.key);
+    Shard& shard = shardFor(id);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(id);
+        if (it == shard.entries.end()) {
+            insert(shard, id, Entry{true, response, {}});
+        } else {
+            it->second.done = true;
+            it->second.response = response;
+        }
+    }
+    g_stored++;
+
+    // Повторы в этом процессе уже получают ответ из памяти. Другим воркерам и
+    // следующему запуску он нужен в базе до ответа клиенту: иначе повтор после
+    // падения процесса найдёт только заглушку и через kClaimTimeoutSec выполнит
+    // запись второй раз.
+    bool enqueue;
+    std::shared_future<void> saved;
+    {
+        std::lock_guard<std::mutex> lock(g_pending_mutex);
+        enqueue = !g_pending;
+        if (enqueue) {
+            g_pending = std::make_shared<PendingBatch>();
+            g_pending->result = g_pending->saved.get_future().share();
+        }
+        g_pending->responses.push_back(std::move(response));
+        saved = g_pending->result;
+    }
+    if (enqueue && !DbExecutor::enqueue(true, flush)) {
+        flush();
+    }
+    saved.wait();
+}
+
+void Idempotency::release(int user_id, const std::string& key) {
+    if (key.empty()) {
+        return;
+    }
+    std::string id = entryId(user_id, key);
+    Shard& shard = shardFor(id);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(id);
+        if (it == shard.entries.end() || it->second.done) {
+            return;
+        }
+        erase(shard, it);
+        g_released++;
+    }
+    DbExecutor::write([&] { return Database::releaseIdempotencyKey(user_id, key); }).get();
+}
+
+std::string Idempotency::statsJson() {
+    size_t keys = 0;
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        keys += shard.entries.size();
+    }
+    std::ostringstream oss;
+    oss << "{"
+        << "\"ttl_sec\":" << g_ttl_sec.load() << ","
+        << "\"keys\":" << keys << ","
+        << "\"max_keys\":" << g_keys_per_shard.load() * kShardCount << ","
+        << "\"started\":" << g_started.load() << ","
+        << "\"replayed\":" << g_replayed.load() << ","
+        << "\"db_hits\":" << g_db_hits.load() << ","
+        << "\"in_progress\":" << g_in_progress.load() << ","
+        << "\"mismatched\":" << g_mismatched.load() << ","
+        << "\"stored\":" << g_stored.load() << ","
+        << "\"released\":" << g_released.load() << ","
+        << "\"persisted\":" << g_persisted.load() << ","
+        << "\"flushes\":" << g_flushes.load() << ","
+        << "\"evicted\":" << g_evicted.load() << ","
+        << "\"full\":" << g_full.load() << ","
+        << "\"persist_failures\":" << g_persist_failures.load() << ","
+        << "\"purged\":" << g_purged.load()
+        << "}";
+    return oss.str();
+}
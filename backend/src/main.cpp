@@ -1,6 +1,24 @@
 #include "../include/routes.h"
 #include "../include/db.h"
+#include "../include/admission.h"
+#include "../include/rate_limit.h"
+#include "../include/compression.h"
+#include "../include/scheduler.h"
+#include "../include/event_hub.h"
+#include "../include/backup.h"
+#include "../include/shutdown.h"
+#include "../include/prefork.h"
+#include "../include/task_events.h"
+#include "../include/static_assets.h"
+#include "../include/cors.h"
+#include "../include/event_server.h"
+#include "../include/db_executor.h"
+#include "../include/idempotency.h"
+#ifdef TODOMANAGER_HAVE_COROUTINES
+#include "../include/coro.h"
+#endif
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
 #include <string>
 
@@ -33,6 +51,9 @@ int getEnvInt(const std::string& key, int defaultValue) {
 }
 
 int main() {
+    // До запуска фоновых потоков, иначе сигнал может достаться любому из них
+    Shutdown::blockSignals();
+    
     std::string dbPath = getEnvVar("DB_PATH", "./data/tasks.db");
     std::string dataDir = dbPath.substr(0, dbPath.find_last_of("/\\"));
     if (dataDir.empty()) {
@@ -50,27 +71,163 @@ int main() {
         }
     #endif
     
-    if (!Database::initDatabase(dbPath)) {
+    int shards = getEnvInt("DB_SHARDS", 1);
+    if (!Database::initDatabase(dbPath, shards)) {
         std::cerr << "Failed to initialize database" << std::endl;
         return 1;
     }
     
-    std::cout << "Database initialized successfully at: " << dbPath << std::endl;
+    std::cout << "Database initialized successfully at: " << dbPath
+              << " (" << Database::shardCount() << " shard(s))" << std::endl;
+    if (Database::shardCount() != shards) {
+        std::cout << "DB_SHARDS=" << shards << " ignored: existing shard layout is kept, "
+                  << "use todomanager-rebalance to split shards" << std::endl;
+    }
+    
+    // Статика загружается до fork: страницы с файлами воркеры делят с супервизором
+    std::string staticDir = getEnvVar("STATIC_DIR", "");
+    if (!staticDir.empty()) {
+        if (StaticAssets::load(staticDir)) {
+            std::cout << "Serving static files from " << staticDir << ": "
+                      << StaticAssets::statsJson() << std::endl;
+        } else {
+            std::cerr << "STATIC_DIR=" << staticDir << " ignored: cannot read directory" << std::endl;
+        }
+    }
+    
+    // Prefork: схема создана один раз, соединения SQLite не должны переживать fork,
+    // поэтому каждый воркер открывает базу заново
+    int workers = getEnvInt("WORKERS", 1);
+    if (workers > 1) {
+        Database::closeDatabase();
+        if (!Prefork::run(workers)) {
+            // Супервизор: воркеры остановлены, переносим остаток WAL в основные файлы
+            bool checkpointed = Database::initDatabase(dbPath, shards) && Database::closeDatabase();
+            std::cout << (checkpointed ? "Shutdown complete" : "Shutdown complete, WAL checkpoint failed")
+                      << std::endl;
+            return 0;
+        }
+        if (!Database::initDatabase(dbPath, shards)) {
+            std::cerr << "Worker " << Prefork::workerIndex() << ": failed to open database" << std::endl;
+            return 1;
+        }
+    }
+    // Фоновые задачи на всю базу выполняет только первый воркер
+    bool primary = Prefork::workerIndex() == 0;
     
-    httplib::Server server;
-    setupRoutes(server);
+    if (primary) {
+        Database::startBackfill(getEnvInt("MIGRATION_BATCH_SIZE", 500),
+                                getEnvInt("MIGRATION_PAUSE_MS", 50));
+    }
+    
+    // Потоки БД: один писатель и DB_READERS читателей; 0 - запросы ходят в базу сами
+    DbExecutor::start(getEnvInt("DB_READERS", 0));
+    
+    int workerThreads = getEnvInt("WORKER_THREADS", static_cast<int>(CPPHTTPLIB_THREAD_POOL_COUNT));
+    int queueDepth = getEnvInt("QUEUE_DEPTH", 256);
+    AdmissionControl::configure(workerThreads,
+                                queueDepth,
+                                getEnvInt("QUEUE_SHED_DEPTH", queueDepth / 2),
+                                getEnvInt("QUEUE_MAX_WAIT_MS", 500),
+                                getEnvInt("RETRY_AFTER_SEC", 1));
+    
+    RateLimiter::configure(RateLimiter::RouteClass::Auth,
+                           getEnvInt("RATE_AUTH_PER_MIN", 30) / 60.0,
+                           getEnvInt("RATE_AUTH_BURST", 10));
+    RateLimiter::configure(RateLimiter::RouteClass::Read,
+                           getEnvInt("RATE_READ_PER_MIN", 1200) / 60.0,
+                           getEnvInt("RATE_READ_BURST", 40));
+    RateLimiter::configure(RateLimiter::RouteClass::Write,
+                           getEnvInt("RATE_WRITE_PER_MIN", 300) / 60.0,
+                           getEnvInt("RATE_WRITE_BURST", 20));
+    RateLimiter::setMaxKeys(getEnvInt("RATE_LIMIT_MAX_KEYS", 65536));
+    // За прокси (Railway, Render) remote_addr у всех анонимных клиентов один и тот же
+    std::string trustedProxies = getEnvVar("TRUSTED_PROXIES", "");
+    if (!RateLimiter::setTrustedProxies(trustedProxies)) {
+        std::cerr << "TRUSTED_PROXIES=" << trustedProxies << ": unrecognized entries ignored" << std::endl;
+    }
+    
+    // Ответы на записи с Idempotency-Key: IDEMPOTENCY_TTL_SEC=0 отключает заголовок
+    Idempotency::configure(getEnvInt("IDEMPOTENCY_TTL_SEC", 86400),
+                           getEnvInt("IDEMPOTENCY_MAX_KEYS", 16384));
+    
+    Cors::configure(getEnvVar("CORS_ORIGINS", "*"), getEnvInt("CORS_MAX_AGE_SEC", 7200));
+    
+    Compression::configure(getEnvInt("COMPRESSION_ENABLED", 1) != 0,
+                           getEnvInt("COMPRESSION_MIN_SIZE", 1024),
+                           getEnvInt("COMPRESSION_LEVEL", 6));
+    
+    // Каждый открытый стрем занимает поток пула, половина пула остаётся обычным запросам
+    EventHub::configure(getEnvInt("SSE_MAX_SUBSCRIBERS", std::max(1, workerThreads / 2)),
+                        getEnvInt("SSE_BUFFER_EVENTS", 64),
+                        getEnvInt("SSE_HEARTBEAT_SEC", 15));
+    DueScheduler::addListener([](const DueEvent& event) {
+        std::string data = "{\"id\":" + std::to_string(event.task_id) +
+                           ",\"due_date\":\"" + Task::formatDay(event.due_date) + "\"}";
+        EventHub::publish(event.user_id,
+                          event.kind == DueEvent::Kind::Overdue ? "task.overdue" : "task.reminder",
+                          data);
+    });
+    DueScheduler::start(getEnvInt("SCHEDULER_HORIZON_DAYS", 7),
+                        getEnvInt("REMINDER_LEAD_SEC", 86400));
+    
+    Backup::configure(getEnvVar("BACKUP_DIR", dataDir + "/backups"),
+                      primary ? getEnvInt("BACKUP_INTERVAL_SEC", 0) : 0,
+                      getEnvInt("BACKUP_RETENTION", 7),
+                      getEnvInt("BACKUP_PAGES_PER_STEP", 64),
+                      getEnvInt("BACKUP_PAUSE_MS", 10));
+    Backup::start();
+    Prefork::startWorker(metricsJson, TaskEvents::applyRemote);
+    
+    EventServer server;
+    server.new_task_queue = [] { return AdmissionControl::createQueue(); };
+    // Заголовки и тело уходят отдельными send: без TCP_NODELAY второй ждёт
+    // delayed ACK клиента (~40 мс на каждый keep-alive запрос)
+    server.set_tcp_nodelay(true);
+    // EVENT_LOOPS > 0 - фронтенд на epoll: простаивающие соединения не занимают пул
+    server.configure(getEnvInt("EVENT_LOOPS", 0),
+                     getEnvInt("MAX_CONNECTIONS", 10000),
+                     getEnvInt("IDLE_TIMEOUT_SEC", 60));
+    setupRoutes(server, getEnvVar("ADMIN_TOKEN", ""), getEnvInt("AUTH_FAILURE_DELAY_MS", 0));
     
     int port = getEnvInt("PORT", 8080);
     std::string host = getEnvVar("HOST", "0.0.0.0");
     
-    std::cout << "Starting server on http://" << host << ":" << port << std::endl;
-    std::cout << "Press Ctrl+C to stop the server" << std::endl;
+    // Остановка: закрываем слушающий сокет (keep-alive соединения закрываются после
+    // текущего запроса), будим SSE-стримы и ждём, пока пул дообработает очередь
+    Shutdown::start([&server] {
+        server.shutdown();
+        EventHub::closeAll();
+    }, getEnvInt("SHUTDOWN_TIMEOUT_SEC", 8));
     
-    if (!server.listen(host.c_str(), port)) {
+    if (Prefork::enabled()) {
+        std::cout << "Worker " << Prefork::workerIndex() << " starting on http://"
+                  << host << ":" << port << std::endl;
+    } else {
+        std::cout << "Starting server on http://" << host << ":" << port << std::endl;
+        std::cout << "Press Ctrl+C to stop the server" << std::endl;
+    }
+    
+    bool listened = server.run(host, port);
+    Shutdown::drained();
+    if (listened) {
+        std::cout << "Server stopped, in-flight requests drained" << std::endl;
+    } else {
         std::cerr << "Failed to start server" << std::endl;
-        return 1;
     }
     
-    return 0;
+    Prefork::stopWorker();
+    Backup::stop();
+    DueScheduler::stop();
+    EventHub::closeAll();
+#ifdef TODOMANAGER_HAVE_COROUTINES
+    Coro::stop();
+#endif
+    DbExecutor::stop();
+    // В prefork-режиме окончательный checkpoint делает супервизор после остановки всех воркеров
+    if (!Database::closeDatabase() && !Prefork::enabled()) {
+        std::cerr << "WAL checkpoint failed, the journal will be replayed on next start" << std::endl;
+    }
+    std::cout << "Shutdown complete" << std::endl;
+    return listened ? 0 : 1;
 }
-
@@ -0,0 +1,279 @@
+#include "../include/msgpack.h"
+#include <cstring>
+
+MsgpackWriter::MsgpackWriter(std::string& out) : out_(out) {
+}
+
+void MsgpackWriter::put8(uint8_t value) {
+    out_.push_back(static_cast<char>(value));
+}
+
+void MsgpackWriter::putBig(uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) {
+        out_.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+void MsgpackWriter::beginMap(uint32_t size) {
+    if (size < 16) {
+        put8(0x80 | size);
+    } else if (size <= 0xffff) {
+        put8(0xde);
+        putBig(size, 2);
+    } else {
+        put8(0xdf);
+        putBig(size, 4);
+    }
+}
+
+void MsgpackWriter::beginArray(uint32_t size) {
+    if (size < 16) {
+        put8(0x90 | size);
+    } else if (size <= 0xffff) {
+        put8(0xdc);
+        putBig(size, 2);
+    } else {
+        put8(0xdd);
+        putBig(size, 4);
+    }
+}
+
+void MsgpackWriter::string(const char* data, size_t size) {
+    if (size < 32) {
+        put8(0xa0 | static_cast<uint8_t>(size));
+    } else if (size <= 0xff) {
+        put8(0xd9);
+        putBig(size, 1);
+    } else if (size <= 0xffff) {
+        put8(0xda);
+        putBig(size, 2);
+    } else {
+        put8(0xdb);
+        putBig(size, 4);
+    }
+    out_.append(data, size);
+}
+
+void MsgpackWriter::string(const char* value) {
+    string(value, std::strlen(value));
+}
+
+void MsgpackWriter::string(const std::string& value) {
+    string(value.data(), value.size());
+}
+
+void MsgpackWriter::integer(int64_t value) {
+    if (value >= 0) {
+        if (value < 128) {
+            put8(static_cast<uint8_t>(value));
+        } else if (value <= 0xff) {
+            put8(0xcc);
+            putBig(value, 1);
+        } else if (value <= 0xffff) {
+            put8(0xcd);
+            putBig(value, 2);
+        } else if (value <= 0xffffffffLL) {
+            put8(0xce);
+            putBig(value, 4);
+        } else {
+            put8(0xcf);
+            putBig(value, 8);
+        }
+    } else if (value >= -32) {
+        put8(static_cast<uint8_t>(value));
+    } else if (value >= -128) {
+        put8(0xd0);
+        putBig(static_cast<uint64_t>(value), 1);
+    } else if (value >= -32768) {
+        put8(0xd1);
+        putBig(static_cast<uint64_t>(value), 2);
+    } else if (value >= -2147483648LL) {
+        put8(0xd2);
+        putBig(static_cast<uint64_t>(value), 4);
+    } else {
+        put8(0xd3);
+        putBig(static_cast<uint64_t>(value), 8);
+    }
+}
+
+void MsgpackWriter::boolean(bool value) {
+    put8(value ? 0xc3 : 0xc2);
+}
+
+void MsgpackWriter::nil() {
+    put8(0xc0);
+}
+
+namespace {
+
+struct Cursor {
+    const unsigned char* pos;
+    const unsigned char* end;
+
+    bool has(size_t n) const {
+        return static_cast<size_t>(end - pos) >= n;
+    }
+
+    bool readBig(int bytes, uint64_t& value) {
+        if (!has(bytes)) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value = (value << 8) | *pos++;
+        }
+        return true;
+    }
+};
+
+bool skipValue(Cursor& c, int depth);
+
+bool skipItems(Cursor& c, uint64_t count, int depth) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (!skipValue(c, depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool skipBytes(Cursor& c, uint64_t count) {
+    if (!c.has(count)) {
+        return false;
+    }
+    c.pos += count;
+    return true;
+}
+
+bool skipValue(Cursor& c, int depth) {
+    if (depth > 32 || !c.has(1)) {
+        return false;
+    }
+    uint8_t type = *c.pos++;
+    uint64_t n = 0;
+    if (type <= 0x7f || type >= 0xe0 || type == 0xc0 || type == 0xc2 || type == 0xc3) return true;
+    if ((type & 0xe0) == 0xa0) return skipBytes(c, type & 0x1f);
+    if ((type & 0xf0) == 0x80) return skipItems(c, (type & 0x0f) * 2ULL, depth);
+    if ((type & 0xf0) == 0x90) return skipItems(c, type & 0x0f, depth);
+    switch (type) {
+        case 0xcc: case 0xd0: return skipBytes(c, 1);
+        case 0xcd: case 0xd1: return skipBytes(c, 2);
+        case 0xce: case 0xd2: case 0xca: return skipBytes(c, 4);
+        case 0xcf: case 0xd3: case 0xcb: return skipBytes(c, 8);
+        case 0xd9: case 0xc4: return c.readBig(1, n) && skipBytes(c, n);
+        case 0xda: case 0xc5: return c.readBig(2, n) && skipBytes(c, n);
+        case 0xdb: case 0xc6: return c.readBig(4, n) && skipBytes(c, n);
+        case 0xdc: return c.readBig(2, n) && skipItems(c, n, depth);
+        case 0xdd: return c.readBig(4, n) && skipItems(c, n, depth);
+        case 0xde: return c.readBig(2, n) && skipItems(c, n * 2, depth);
+        case 0xdf: return c.readBig(4, n) && skipItems(c, n * 2, depth);
+        default: return false;
+    }
+}
+
+bool readString(Cursor& c, std::string& out) {
+    if (!c.has(1)) {
+        return false;
+    }
+    uint8_t type = *c.pos;
+    uint64_t size = 0;
+    if ((type & 0xe0) == 0xa0) {
+        c.pos++;
+        size = type & 0x1f;
+    } else if (type == 0xd9 || type == 0xda || type == 0xdb) {
+        c.pos++;
+        if (!c.readBig(type == 0xd9 ? 1 : (type == 0xda ? 2 : 4), size)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    if (!c.has(size)) {
+        return false;
+    }
+    out.assign(reinterpret_cast<const char*>(c.pos), size);
+    c.pos += size;
+    return true;
+}
+
+// Скаляр как строка, nil - пустая строка; вложенные контейнеры и прочие типы пропускаются
+bool readScalar(Cursor& c, std::string& out, bool& present) {
+    present = true;
+    uint8_t type = *c.pos;
+    uint64_t n = 0;
+    if ((type & 0xe0) == 0xa0 || type == 0xd9 || type == 0xda || type == 0xdb) {
+        return readString(c, out);
+    }
+    if (type <= 0x7f) {
+        c.pos++;
+        out = std::to_string(type);
+        return true;
+    }
+    if (type >= 0xe0) {
+        c.pos++;
+        out = std::to_string(static_cast<int8_t>(type));
+        return true;
+    }
+    switch (type) {
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            c.pos++;
+            if (!c.readBig(1 << (type - 0xcc), n)) return false;
+            out = std::to_string(n);
+            return true;
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+            int bytes = 1 << (type - 0xd0);
+            c.pos++;
+            if (!c.readBig(bytes, n)) return false;
+            int shift = 64 - bytes * 8;
+            int64_t value = shift ? static_cast<int64_t>(n << shift) >> shift : static_cast<int64_t>(n);
+            out = std::to_string(value);
+            return true;
+        }
+        case 0xc2: case 0xc3:
+            c.pos++;
+            out = type == 0xc3 ? "true" : "false";
+            return true;
+        case 0xc0:
+            // nil - как пустая строка в JSON: поле есть и очищается (due_date без срока)
+            c.pos++;
+            out.clear();
+            return true;
+        default:
+            present = false;
+            return skipValue(c, 0);
+    }
+}
+
+}
+
+bool MsgpackReader::readFlatMap(const std::string& data, std::map<std::string, std::string>& result) {
+    Cursor c{reinterpret_cast<const unsigned char*>(data.data()),
+             reinterpret_cast<const unsigned char*>(data.data()) + data.size()};
+    if (!c.has(1)) {
+        return false;
+    }
+    uint8_t type = *c.pos++;
+    uint64_t size = 0;
+    if ((type & 0xf0) == 0x80) {
+        size = type & 0x0f;
+    } else if (type == 0xde) {
+        if (!c.readBig(2, size)) return false;
+    } else if (type == 0xdf) {
+        if (!c.readBig(4, size)) return false;
+    } else {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < size; ++i) {
+        std::string key;
+        std::string value;
+        bool present = false;
+        if (!readString(c, key) || !c.has(1) || !readScalar(c, value, present)) {
+            return false;
+        }
+        if (present) {
+            result[key] = value;
+        }
+    }
+    return true;
+}
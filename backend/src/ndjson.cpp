@@ -0,0 +1,250 @@
+#include "../include/ndjson.h"
+#include <cstring>
+
+NdjsonReader::NdjsonReader(size_t maxLineBytes) : max_line_bytes_(maxLineBytes) {}
+
+bool NdjsonReader::emit(const char* data, size_t size, const LineHandler& onLine) {
+    line_++;
+    if (size > 0 && data[size - 1] == '\r') {
+        size--;
+    }
+    if (size == 0) {
+        return true;
+    }
+    return onLine(line_, data, size);
+}
+
+bool NdjsonReader::feed(const char* data, size_t size, const LineHandler& onLine) {
+    const char* end = data + size;
+    while (data < end) {
+        const char* newline = static_cast<const char*>(std::memchr(data, '\n', end - data));
+        if (!newline) {
+            if (pending_.size() + (end - data) > max_line_bytes_) {
+                line_too_long_ = true;
+                return false;
+            }
+            pending_.append(data, end);
+            return true;
+        }
+
+        bool ok;
+        if (pending_.empty()) {
+            // Строка целиком внутри куска - разбираем без копирования
+            if (static_cast<size_t>(newline - data) > max_line_bytes_) {
+                line_too_long_ = true;
+                return false;
+            }
+            ok = emit(data, newline - data, onLine);
+        } else {
+            if (pending_.size() + (newline - data) > max_line_bytes_) {
+                line_too_long_ = true;
+                return false;
+            }
+            pending_.append(data, newline);
+            ok = emit(pending_.data(), pending_.size(), onLine);
+            pending_.clear();
+        }
+        if (!ok) {
+            return false;
+        }
+        data = newline + 1;
+    }
+    return true;
+}
+
+bool NdjsonReader::finish(const LineHandler& onLine) {
+    if (pending_.empty()) {
+        return true;
+    }
+    bool ok = emit(pending_.data(), pending_.size(), onLine);
+    pending_.clear();
+    return ok;
+}
+
+namespace {
+
+void skipSpace(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+}
+
+bool readHex4(const char*& p, const char* end, unsigned& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; ++i, ++p) {
+        char c = *p;
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+void appendUtf8(std::string& out, unsigned cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// p указывает на открывающую кавычку
+bool readString(const char*& p, const char* end, std::string& out) {
+    p++;
+    while (p < end) {
+        // Обычные символы копируем пачкой до кавычки или обратной косой черты
+        const char* start = p;
+        while (p < end && *p != '"' && *p != '\\') {
+            if (static_cast<unsigned char>(*p) < 0x20) {
+                return false;
+            }
+            p++;
+        }
+        out.append(start, p);
+        if (p == end) {
+            return false;
+        }
+        if (*p == '"') {
+            p++;
+            return true;
+        }
+
+        if (++p == end) {
+            return false;
+        }
+        char c = *p++;
+        switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned cp;
+                if (!readHex4(p, end, cp)) {
+                    return false;
+                }
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    unsigned low;
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u') {
+                        return false;
+                    }
+                    p += 2;
+                    if (!readHex4(p, end, low) || low < 0xDC00 || low >= 0xE000) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp < 0xE000) {
+                    return false;
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+bool readLiteral(const char*& p, const char* end, const char* literal) {
+    size_t length = std::strlen(literal);
+    if (static_cast<size_t>(end - p) < length || std::memcmp(p, literal, length) != 0) {
+        return false;
+    }
+    p += length;
+    return true;
+}
+
+bool readScalar(const char*& p, const char* end, std::string& out) {
+    if (*p == '"') {
+        return readString(p, end, out);
+    }
+    if (*p == 't') {
+        out = "true";
+        return readLiteral(p, end, "true");
+    }
+    if (*p == 'f') {
+        out = "false";
+        return readLiteral(p, end, "false");
+    }
+    if (*p == 'n') {
+        return readLiteral(p, end, "null");
+    }
+    const char* start = p;
+    while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' ||
+                       *p == '.' || *p == 'e' || *p == 'E')) {
+        p++;
+    }
+    out.assign(start, p);
+    return p > start;
+}
+
+}
+
+bool NdjsonReader::readFlatObject(const char* data, size_t size,
+                                  std::map<std::string, std::string>& result) {
+    const char* p = data;
+    const char* end = data + size;
+
+    skipSpace(p, end);
+    if (p == end || *p != '{') {
+        return false;
+    }
+    p++;
+    skipSpace(p, end);
+    if (p < end && *p == '}') {
+        p++;
+    } else {
+        while (true) {
+            std::string key;
+            std::string value;
+            skipSpace(p, end);
+            if (p == end || *p != '"' || !readString(p, end, key)) {
+                return false;
+            }
+            skipSpace(p, end);
+            if (p == end || *p != ':') {
+                return false;
+            }
+            p++;
+            skipSpace(p, end);
+            if (p == end || !readScalar(p, end, value)) {
+                return false;
+            }
+            result[key] = std::move(value);
+            skipSpace(p, end);
+            if (p == end) {
+                return false;
+            }
+            if (*p == '}') {
+                p++;
+                break;
+            }
+            if (*p != ',') {
+                return false;
+            }
+            p++;
+        }
+    }
+    skipSpace(p, end);
+    return p == end;
+}
@@ -0,0 +1,361 @@
+#include "../include/prefork.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+namespace {
+
+const size_t kSnapshotBytes = 32 * 1024;
+const size_t kMaxMessageBytes = 512;
+
+// Слот воркера в общей памяти. Снимок пишется под seqlock: нечётный seq - идёт запись.
+struct WorkerSlot {
+    std::atomic<int> pid;
+    std::atomic<unsigned> restarts;
+    std::atomic<long long> started_at;
+    std::atomic<long long> updated_ms;
+    std::atomic<unsigned> seq;
+    unsigned length;
+    char snapshot[kSnapshotBytes];
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared memory slots need lock-free atomics");
+
+int g_workers = 0;    // 0 - однопроцессный режим
+int g_index = 0;
+WorkerSlot* g_slots = nullptr;
+// Датаграммы для воркера i пишутся в g_send_fds[i] и читаются из g_recv_fds[i]
+std::vector<int> g_send_fds;
+std::vector<int> g_recv_fds;
+
+std::thread g_thread;
+std::atomic<bool> g_stop{false};
+std::atomic<unsigned long long> g_sent{0};
+std::atomic<unsigned long long> g_received{0};
+std::atomic<unsigned long long> g_dropped{0};
+
+long long nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void writeSnapshot(WorkerSlot& slot, const std::string& snapshot) {
+    static const char kTooLarge[] = "{\"error\":\"snapshot too large\"}";
+    const char* data = snapshot.size() <= kSnapshotBytes ? snapshot.data() : kTooLarge;
+    size_t length = snapshot.size() <= kSnapshotBytes ? snapshot.size() : sizeof(kTooLarge) - 1;
+
+    slot.seq.fetch_add(1, std::memory_order_acq_rel);
+    std::memcpy(slot.snapshot, data, length);
+    slot.length = static_cast<unsigned>(length);
+    slot.seq.fetch_add(1, std::memory_order_release);
+    slot.updated_ms = nowMs();
+}
+
+bool readSnapshot(const WorkerSlot& slot, std::string& out) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        unsigned before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        unsigned length = slot.length;
+        if (length > kSnapshotBytes) {
+            continue;
+        }
+        out.assign(slot.snapshot, length);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) {
+            return length > 0;
+        }
+    }
+    return false;
+}
+
+#ifndef _WIN32
+
+void setupWorker(int index) {
+    g_index = index;
+    for (int i = 0; i < g_workers; ++i) {
+        if (i != index) {
+            close(g_recv_fds[i]);
+            g_recv_fds[i] = -1;
+        }
+    }
+#ifdef __linux__
+    // Воркер не должен пережить супервизор, убитый по SIGKILL
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+    // Своя группа процессов: Ctrl+C в терминале получает только супервизор,
+    // иначе воркер увидел бы сигнал дважды и не стал бы дожидаться запросов
+    setpgid(0, 0);
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_UNBLOCK, &chld, nullptr);
+
+    // Предыдущий воркер мог упасть посреди записи снимка
+    WorkerSlot& slot = g_slots[index];
+    slot.seq = 0;
+    slot.length = 0;
+    slot.pid = static_cast<int>(getpid());
+    slot.started_at = static_cast<long long>(std::time(nullptr));
+}
+
+pid_t spawn(int index) {
+    pid_t pid = fork();
+    if (pid > 0) {
+        g_slots[index].pid = static_cast<int>(pid);
+    }
+    return pid;
+}
+
+std::string describeExit(int status) {
+    if (WIFSIGNALED(status)) {
+        return "killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    return "exited with code " + std::to_string(WEXITSTATUS(status));
+}
+
+#endif
+
+}
+
+bool Prefork::run(int workers) {
+#ifdef _WIN32
+    if (workers > 1) {
+        std::cerr << "WORKERS=" << workers << " ignored: prefork mode is not supported on Windows" << std::endl;
+    }
+    return true;
+#else
+    if (workers <= 1) {
+        return true;
+    }
+
+    void* memory = mmap(nullptr, sizeof(WorkerSlot) * workers, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Prefork disabled: cannot map shared memory" << std::endl;
+        return true;
+    }
+    g_slots = static_cast<WorkerSlot*>(memory);
+    for (int i = 0; i < workers; ++i) {
+        new (&g_slots[i]) WorkerSlot();
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+            std::cerr << "Prefork disabled: cannot create worker sockets" << std::endl;
+            for (size_t j = 0; j < g_send_fds.size(); ++j) {
+                close(g_send_fds[j]);
+                close(g_recv_fds[j]);
+            }
+            g_send_fds.clear();
+            g_recv_fds.clear();
+            munmap(memory, sizeof(WorkerSlot) * workers);
+            g_slots = nullptr;
+            return true;
+        }
+        g_send_fds.push_back(fds[0]);
+        g_recv_fds.push_back(fds[1]);
+    }
+    g_workers = workers;
+
+    // Супервизор однопоточный и ждёт сигналов синхронно: fork из многопоточного
+    // процесса небезопасен
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    std::vector<pid_t> pids(workers, 0);
+    int alive = 0;
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = spawn(i);
+        if (pid == 0) {
+            setupWorker(i);
+            return true;
+        }
+        if (pid > 0) {
+            pids[i] = pid;
+            alive++;
+        } else {
+            std::cerr << "Failed to start worker " << i << std::endl;
+        }
+    }
+    std::cout << "Supervisor " << getpid() << " started " << alive << " worker(s)" << std::endl;
+
+    bool stopping = false;
+    while (alive > 0) {
+        int signal = 0;
+        if (sigwait(&signals, &signal) != 0) {
+            continue;
+        }
+        if (signal != SIGCHLD) {
+            std::cout << "Supervisor received signal " << signal
+                      << (stopping ? ", killing workers" : ", stopping workers") << std::endl;
+            for (pid_t pid : pids) {
+                if (pid > 0) {
+                    kill(pid, stopping ? SIGKILL : SIGTERM);
+                }
+            }
+            stopping = true;
+            continue;
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            int index = -1;
+            for (int i = 0; i < workers; ++i) {
+                if (pids[i] == pid) {
+                    index = i;
+                }
+            }
+            if (index < 0) {
+                continue;
+            }
+            pids[index] = 0;
+            alive--;
+            if (stopping) {
+                continue;
+            }
+
+            WorkerSlot& slot = g_slots[index];
+            std::cerr << "Worker " << index << " (pid " << pid << ") " << describeExit(status)
+                      << ", restarting" << std::endl;
+            // Падение сразу после старта - не перезапускаем чаще раза в секунду
+            if (std::time(nullptr) - slot.started_at.load() < 1) {
+                sleep(1);
+            }
+            slot.restarts++;
+            pid_t restarted = spawn(index);
+            if (restarted == 0) {
+                setupWorker(index);
+                return true;
+            }
+            if (restarted > 0) {
+                pids[index] = restarted;
+                alive++;
+            }
+        }
+    }
+    std::cout << "All workers stopped" << std::endl;
+    return false;
+#endif
+}
+
+bool Prefork::enabled() {
+    return g_workers > 0;
+}
+
+int Prefork::workerIndex() {
+    return g_index;
+}
+
+void Prefork::startWorker(std::function<std::string()> snapshot,
+                          std::function<void(const std::string&)> receiver) {
+#ifndef _WIN32
+    if (!enabled() || g_thread.joinable()) {
+        return;
+    }
+    g_stop = false;
+    g_thread = std::thread([snapshot, receiver] {
+        long long nextSnapshot = 0;
+        char buffer[kMaxMessageBytes];
+        pollfd fd{g_recv_fds[g_index], POLLIN, 0};
+        while (!g_stop) {
+            long long now = nowMs();
+            if (now >= nextSnapshot) {
+                writeSnapshot(g_slots[g_index], snapshot());
+                nextSnapshot = now + 1000;
+            }
+            if (poll(&fd, 1, static_cast<int>(nextSnapshot - now)) <= 0) {
+                continue;
+            }
+            ssize_t size;
+            while ((size = recv(fd.fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+                g_received++;
+                receiver(std::string(buffer, static_cast<size_t>(size)));
+            }
+        }
+    });
+#endif
+}
+
+void Prefork::stopWorker() {
+    g_stop = true;
+    if (g_thread.joinable()) {
+        g_thread.join();
+    }
+}
+
+void Prefork::broadcast(const std::string& message) {
+#ifndef _WIN32
+    if (!enabled() || message.size() > kMaxMessageBytes) {
+        return;
+    }
+    for (int i = 0; i < g_workers; ++i) {
+        if (i == g_index) {
+            continue;
+        }
+        if (send(g_send_fds[i], message.data(), message.size(), MSG_DONTWAIT) < 0) {
+            g_dropped++;
+        } else {
+            g_sent++;
+        }
+    }
+#endif
+}
+
+std::string Prefork::workersJson(const std::string& ownSnapshot) {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"worker\":" << g_index << ","
+        << "\"relay_sent\":" << g_sent.load() << ","
+        << "\"relay_received\":" << g_received.load() << ","
+        << "\"relay_dropped\":" << g_dropped.load() << ","
+        << "\"workers\":[";
+    long long now = nowMs();
+    for (int i = 0; i < g_workers; ++i) {
+        const WorkerSlot& slot = g_slots[i];
+        std::string snapshot;
+        long long age = 0;
+        if (i == g_index) {
+            snapshot = ownSnapshot;
+        } else if (readSnapshot(slot, snapshot)) {
+            age = now - slot.updated_ms.load();
+        } else {
+            snapshot = "null";
+        }
+        oss << (i > 0 ? "," : "") << "{"
+            << "\"index\":" << i << ","
+            << "\"pid\":" << slot.pid.load() << ","
+            << "\"restarts\":" << slot.restarts.load() << ","
+            << "\"uptime_sec\":" << (static_cast<long long>(std::time(nullptr)) - slot.started_at.load()) << ","
+            << "\"snapshot_age_ms\":" << age << ","
+            << "\"metrics\":" << snapshot
+            << "}";
+    }
+    oss << "]}";
+    return oss.str();
+}
@@ -0,0 +1,267 @@
+#include "../include/rate_limit.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+const size_t kShardCount = 16;
+
+struct Limit {
+    double rate;
+    double burst;
+};
+
+// Значения по умолчанию: вход/регистрация - дорогие, чтение - дешёвое
+Limit g_limits[static_cast<size_t>(RateLimiter::RouteClass::Count)] = {
+    {0.5, 10.0},
+    {20.0, 40.0},
+    {5.0, 20.0},
+};
+
+std::atomic<size_t> g_keys_per_shard{4096};
+std::atomic<unsigned long long> g_allowed{0};
+std::atomic<unsigned long long> g_limited{0};
+std::atomic<unsigned long long> g_evicted{0};
+
+using Clock = std::chrono::steady_clock;
+
+struct Bucket {
+    double tokens;
+    Clock::time_point last;
+    std::list<std::string>::iterator lru;
+};
+
+struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Bucket> buckets;
+    std::list<std::string> lru; // front - самый свежий ключ
+};
+
+Shard g_shards[kShardCount];
+
+// Адрес в сетевом порядке байт: 4 байта IPv4 или 16 байт IPv6
+struct Address {
+    int family = 0;
+    unsigned char bytes[16] = {};
+};
+
+struct Network {
+    Address address;
+    int prefix;
+};
+
+// Заполняются в setTrustedProxies до запуска сервера, дальше только читаются
+std::vector<Network> g_trusted;
+bool g_trust_any = false;
+
+std::string trim(const std::string& value) {
+    size_t begin = value.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = value.find_last_not_of(" \t");
+    return value.substr(begin, end - begin + 1);
+}
+
+bool parseAddress(const std::string& text, Address& address) {
+    if (inet_pton(AF_INET, text.c_str(), address.bytes) == 1) {
+        address.family = AF_INET;
+        return true;
+    }
+    if (inet_pton(AF_INET6, text.c_str(), address.bytes) == 1) {
+        address.family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+bool parseNetwork(const std::string& text, Network& network) {
+    size_t slash = text.find('/');
+    if (!parseAddress(text.substr(0, slash), network.address)) {
+        return false;
+    }
+    int bits = network.address.family == AF_INET ? 32 : 128;
+    network.prefix = bits;
+    if (slash == std::string::npos) {
+        return true;
+    }
+    std::string prefix = text.substr(slash + 1);
+    if (prefix.empty() || prefix.size() > 3 ||
+        prefix.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    network.prefix = std::stoi(prefix);
+    return network.prefix <= bits;
+}
+
+bool contains(const Network& network, const Address& address) {
+    if (network.address.family != address.family) {
+        return false;
+    }
+    int full = network.prefix / 8;
+    if (std::memcmp(network.address.bytes, address.bytes, full) != 0) {
+        return false;
+    }
+    int rest = network.prefix % 8;
+    if (rest == 0) {
+        return true;
+    }
+    unsigned char mask = static_cast<unsigned char>(0xff << (8 - rest));
+    return (network.address.bytes[full] & mask) == (address.bytes[full] & mask);
+}
+
+bool isTrusted(const std::string& text) {
+    Address address;
+    if (!parseAddress(text, address)) {
+        return false;
+    }
+    return std::any_of(g_trusted.begin(), g_trusted.end(),
+                       [&](const Network& network) { return contains(network, address); });
+}
+
+}
+
+void RateLimiter::configure(RouteClass routeClass, double ratePerSec, double burst) {
+    if (routeClass == RouteClass::Count) {
+        return;
+    }
+    // Нулевая скорость отключает ограничение для класса маршрутов
+    g_limits[static_cast<size_t>(routeClass)] = {std::max(0.0, ratePerSec), std::max(1.0, burst)};
+}
+
+void RateLimiter::setMaxKeys(size_t maxKeys) {
+    g_keys_per_shard = std::max<size_t>(1, maxKeys / kShardCount);
+}
+
+RateLimiter::Decision RateLimiter::check(RouteClass routeClass, const std::string& key) {
+    const Limit limit = g_limits[static_cast<size_t>(routeClass)];
+    if (limit.rate <= 0) {
+        return Decision{true, 0, 0, 0};
+    }
+    std::string fullKey;
+    fullKey.reserve(key.size() + 2);
+    fullKey += static_cast<char>('0' + static_cast<int>(routeClass));
+    fullKey += ':';
+    fullKey += key;
+
+    Shard& shard = g_shards[std::hash<std::string>()(fullKey) % kShardCount];
+    auto now = Clock::now();
+    Decision decision{true, static_cast<int>(limit.burst), 0, 0};
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.buckets.find(fullKey);
+    if (it == shard.buckets.end()) {
+        // Вытесняем самый давно не использованный ключ. Если он простоял
+        // дольше времени полного пополнения, это ничего не меняет для клиента.
+        if (shard.buckets.size() >= g_keys_per_shard) {
+            shard.buckets.erase(shard.lru.back());
+            shard.lru.pop_back();
+            g_evicted++;
+        }
+        shard.lru.push_front(fullKey);
+        it = shard.buckets.emplace(fullKey, Bucket{limit.burst, now, shard.lru.begin()}).first;
+    } else {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+    }
+
+    Bucket& bucket = it->second;
+    double elapsed = std::chrono::duration<double>(now - bucket.last).count();
+    bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.rate);
+    bucket.last = now;
+
+    if (bucket.tokens >= 1.0) {
+        bucket.tokens -= 1.0;
+        decision.remaining = static_cast<int>(bucket.tokens);
+        g_allowed++;
+    } else {
+        decision.allowed = false;
+        decision.retryAfterSec = static_cast<int>(std::ceil((1.0 - bucket.tokens) / limit.rate));
+        g_limited++;
+    }
+    return decision;
+}
+
+bool RateLimiter::setTrustedProxies(const std::string& proxies) {
+    g_trusted.clear();
+    g_trust_any = false;
+    bool valid = true;
+    std::stringstream list(proxies);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        item = trim(item);
+        if (item.empty()) {
+            continue;
+        }
+        if (item == "*") {
+            g_trust_any = true;
+            continue;
+        }
+        Network network;
+        if (parseNetwork(item, network)) {
+            g_trusted.push_back(network);
+        } else {
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+std::string RateLimiter::clientAddress(const std::string& remoteAddr, const std::string& forwardedFor) {
+    if ((!g_trust_any && g_trusted.empty()) || forwardedFor.empty() ||
+        !(g_trust_any || isTrusted(remoteAddr))) {
+        return remoteAddr;
+    }
+    std::vector<std::string> hops;
+    std::stringstream list(forwardedFor);
+    std::string hop;
+    while (std::getline(list, hop, ',')) {
+        hop = trim(hop);
+        if (!hop.empty()) {
+            hops.push_back(hop);
+        }
+    }
+    // Справа налево: каждый доверенный прокси дописывает адрес, от которого получил запрос.
+    // "*" доверяет только самому соединению, адреса в заголовке сверяются со списком.
+    for (auto it = hops.rbegin(); it != hops.rend(); ++it) {
+        if (!isTrusted(*it)) {
+            return *it;
+        }
+    }
+    // Все адреса - доверенные прокси: берём самый левый
+    return hops.empty() ? remoteAddr : hops.front();
+}
+
+std::string RateLimiter::statsJson() {
+    size_t keys = 0;
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        keys += shard.buckets.size();
+    }
+    std::ostringstream oss;
+    oss << "{"
+        << "\"keys\":" << keys << ","
+        << "\"max_keys\":" << g_keys_per_shard.load() * kShardCount << ","
+        << "\"trusted_proxies\":" << (g_trust_any ? 1 : g_trusted.size()) << ","
+        << "\"allowed\":" << g_allowed.load() << ","
+        << "\"limited\":" << g_limited.load() << ","
+        << "\"evicted\":" << g_evicted.load()
+        << "}";
+    return oss.str();
+}
@@ -3,12 +3,35 @@
 #include "../include/auth.h"
 #include "../include/task.h"
 #include "../include/user.h"
+#include "../include/admission.h"
+#include "../include/rate_limit.h"
+#include "../include/compression.h"
+#include "../include/scheduler.h"
+#include "../include/event_hub.h"
+#include "../include/backup.h"
+#include "../include/msgpack.h"
+#include "../include/ndjson.h"
+#include "../include/prefork.h"
+#include "../include/task_events.h"
+#include "../include/static_assets.h"
+#include "../include/cors.h"
+#include "../include/event_server.h"
+#include "../include/db_executor.h"
+#include "../include/idempotency.h"
+#ifdef TODOMANAGER_HAVE_COROUTINES
+#include "../include/coro.h"
+#endif
 #include <sstream>
+#include <cstdint>
 #include <regex>
 #include <map>
+#include <functional>
 #include <string>
 #include <algorithm>
 #include <cctype>
+#include <vector>
+#include <chrono>
+#include <thread>
 
 std::map<std::string, std::string> parseSimpleJson(const std::string& json) {
     std::map<std::string, std::string> result;
@@ -60,6 +83,13 @@ std::map<std::string, std::string> parseSimpleJson(const std::string& json) {
         }
     }
     
+    // null - пустое значение, как nil в MessagePack: поле очищается (due_date без срока)
+    std::regex nullPattern("\"([^\"]+)\":null");
+    std::sregex_iterator nullIter(processed.begin(), processed.end(), nullPattern);
+    for (; nullIter != end; ++nullIter) {
+        result[(*nullIter)[1].str()] = "";
+    }
+    
     std::regex numPattern("\"([^\"]+)\":(\\d+)");
     std::sregex_iterator numIter(processed.begin(), processed.end(), numPattern);
     for (; numIter != end; ++numIter) {
@@ -72,13 +102,231 @@ std::map<std::string, std::string> parseSimpleJson(const std::string& json) {
     return result;
 }
 
+static const char* kMsgpackType = "application/msgpack";
+
+bool isMsgpackType(const std::string& value) {
+    return value.find("application/msgpack") != std::string::npos ||
+           value.find("application/x-msgpack") != std::string::npos;
+}
+
+// Тело запроса в JSON или MessagePack, в зависимости от Content-Type
+std::map<std::string, std::string> parseRequestBody(const httplib::Request& req) {
+    if (isMsgpackType(req.get_header_value("Content-Type"))) {
+        std::map<std::string, std::string> result;
+        if (!MsgpackReader::readFlatMap(req.body, result)) {
+            result.clear();
+        }
+        return result;
+    }
+    return parseSimpleJson(req.body);
+}
+
+// Сильная метка версии задачи: "N"
+static std::string taskEtag(const Task& task) {
+    return "\"" + std::to_string(task.version) + "\"";
+}
+
+void sendTask(const httplib::Request& req, httplib::Response& res, const Task& task) {
+    res.set_header("ETag", taskEtag(task));
+    if (isMsgpackType(req.get_header_value("Accept"))) {
+        std::string body;
+        MsgpackWriter writer(body);
+        task.toMsgpack(writer);
+        res.set_content(std::move(body), kMsgpackType);
+    } else {
+        res.set_content(task.toJson(), "application/json");
+    }
+}
+
+void sendTasks(const httplib::Request& req, httplib::Response& res, const std::vector<Task>& tasks) {
+    if (isMsgpackType(req.get_header_value("Accept"))) {
+        std::string body;
+        body.reserve(tasks.size() * 160);
+        MsgpackWriter writer(body);
+        writer.beginArray(static_cast<uint32_t>(tasks.size()));
+        for (const auto& task : tasks) {
+            task.toMsgpack(writer);
+        }
+        res.set_content(std::move(body), kMsgpackType);
+        return;
+    }
+    
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < tasks.size(); i++) {
+        json << tasks[i].toJson();
+        if (i < tasks.size() - 1) json << ",";
+    }
+    json << "]";
+    res.set_content(json.str(), "application/json");
+}
+
+// Ячейка календаря: задачи со сроком в [start, start + длина ячейки)
+struct CalendarBucket {
+    int32_t start;
+    int count = 0;
+    int completed = 0;
+    int overdue = 0;
+};
+
+// tasks упорядочены по сроку, поэтому ячейки собираются за один проход
+// и в ответ попадают только непустые
+static std::vector<CalendarBucket> bucketTasks(const std::vector<Task>& tasks, bool weekly) {
+    std::vector<CalendarBucket> buckets;
+    for (const auto& task : tasks) {
+        int32_t start = weekly ? Task::weekStart(task.due_date) : task.due_date;
+        if (buckets.empty() || buckets.back().start != start) {
+            buckets.push_back(CalendarBucket{start});
+        }
+        CalendarBucket& bucket = buckets.back();
+        bucket.count++;
+        if (task.status == TaskStatus::Completed) {
+            bucket.completed++;
+        }
+        if (task.overdue) {
+            bucket.overdue++;
+        }
+    }
+    return buckets;
+}
+
+static void sendCalendar(const httplib::Request& req, httplib::Response& res, int32_t fromDay, int32_t toDay,
+                         bool weekly, const std::vector<Task>& tasks) {
+    std::vector<CalendarBucket> buckets = bucketTasks(tasks, weekly);
+    const char* bucketName = weekly ? "week" : "day";
+    if (isMsgpackType(req.get_header_value("Accept"))) {
+        std::string body;
+        body.reserve(tasks.size() * 160 + buckets.size() * 48);
+        MsgpackWriter writer(body);
+        writer.beginMap(5);
+        writer.string("from");
+        writer.string(Task::formatDay(fromDay));
+        writer.string("to");
+        writer.string(Task::formatDay(toDay));
+        writer.string("bucket");
+        writer.string(bucketName);
+        writer.string("buckets");
+        writer.beginArray(static_cast<uint32_t>(buckets.size()));
+        for (const auto& bucket : buckets) {
+            writer.beginMap(4);
+            writer.string("start");
+            writer.string(Task::formatDay(bucket.start));
+            writer.string("count");
+            writer.integer(bucket.count);
+            writer.string("completed");
+            writer.integer(bucket.completed);
+            writer.string("overdue");
+            writer.integer(bucket.overdue);
+        }
+        writer.string("tasks");
+        writer.beginArray(static_cast<uint32_t>(tasks.size()));
+        for (const auto& task : tasks) {
+            task.toMsgpack(writer);
+        }
+        res.set_content(std::move(body), kMsgpackType);
+        return;
+    }
+    
+    std::ostringstream json;
+    json << "{\"from\":\"" << Task::formatDay(fromDay) << "\""
+         << ",\"to\":\"" << Task::formatDay(toDay) << "\""
+         << ",\"bucket\":\"" << bucketName << "\""
+         << ",\"buckets\":[";
+    for (size_t i = 0; i < buckets.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"start\":\"" << Task::formatDay(buckets[i].start) << "\""
+             << ",\"count\":" << buckets[i].count
+             << ",\"completed\":" << buckets[i].completed
+             << ",\"overdue\":" << buckets[i].overdue << "}";
+    }
+    json << "],\"tasks\":[";
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (i > 0) json << ",";
+        json << tasks[i].toJson();
+    }
+    json << "]}";
+    res.set_content(json.str(), "application/json");
+}
+
+std::string metricsJson() {
+    std::ostringstream json;
+    json << "{\"server\":" << EventServer::statsJson()
+         << ",\"admission\":" << AdmissionControl::statsJson()
+         << ",\"rate_limit\":" << RateLimiter::statsJson()
+         << ",\"compression\":" << Compression::statsJson()
+         << ",\"cors\":" << Cors::statsJson()
+         << ",\"migration\":" << Database::migrationStatsJson()
+         << ",\"shards\":" << Database::shardStatsJson()
+         << ",\"db_executor\":" << DbExecutor::statsJson()
+         << ",\"idempotency\":" << Idempotency::statsJson()
+#ifdef TODOMANAGER_HAVE_COROUTINES
+         << ",\"coro\":" << Coro::statsJson()
+#endif
+         << ",\"scheduler\":" << DueScheduler::statsJson()
+         << ",\"events\":" << EventHub::statsJson()
+         << ",\"backup\":" << Backup::statsJson()
+         << ",\"static\":" << StaticAssets::statsJson() << "}";
+    return json.str();
+}
+
+static const char* kStreamPath = "/api/tasks/stream";
+
+static const size_t kExportChunkBytes = 64 * 1024;
+static const size_t kImportBatchSize = 20000;
+static const size_t kImportMaxLineBytes = 64 * 1024;
+static const size_t kImportMaxErrors = 20;
+static const int kNextDefault = 5;
+static const int kNextMax = 100;
+
+// Наибольшая длина диапазона календаря в днях: без предела один запрос
+// выбирает и отдаёт всю историю задач пользователя
+static const int32_t kCalendarMaxDays = 366;
+static const int32_t kCalendarMaxWeekDays = 5 * 366;
+
+// Задача из строки импорта: поля как у POST /api/tasks плюс status.
+// id, user_id, updated_at и overdue из экспорта не переносятся.
+static bool taskFromImport(std::map<std::string, std::string>& fields, int user_id,
+                           Task& task, const char*& error) {
+    task = Task(user_id, fields["title"], fields["description"], Task::kNoDate, TaskPriority::Medium);
+    if (!task.isValid()) {
+        error = "Title is required";
+        return false;
+    }
+    auto it = fields.find("priority");
+    if (it != fields.end() && !it->second.empty() && !Task::parsePriority(it->second, task.priority)) {
+        error = "Invalid priority";
+        return false;
+    }
+    it = fields.find("status");
+    if (it != fields.end() && !it->second.empty() && !Task::parseStatus(it->second, task.status)) {
+        error = "Invalid status";
+        return false;
+    }
+    it = fields.find("due_date");
+    if (it != fields.end() && !it->second.empty() && !Task::parseDay(it->second, task.due_date)) {
+        error = "Invalid due_date";
+        return false;
+    }
+    it = fields.find("created_at");
+    if (it != fields.end() && !it->second.empty() && !Task::parseTimestamp(it->second, task.created_at)) {
+        error = "Invalid created_at";
+        return false;
+    }
+    return true;
+}
+
 int getUserIdFromRequest(const httplib::Request& req) {
     auto authHeader = req.get_header_value("Authorization");
-    if (authHeader.empty()) {
+    std::string token;
+    if (!authHeader.empty()) {
+        token = Auth::extractTokenFromHeader(authHeader);
+    } else if (req.path == kStreamPath && req.has_param("token")) {
+        // EventSource в браузере не умеет передавать заголовки
+        token = req.get_param_value("token");
+    } else {
         return -1;
     }
     
-    std::string token = Auth::extractTokenFromHeader(authHeader);
     int user_id;
     std::string username;
     
@@ -89,183 +337,841 @@ int getUserIdFromRequest(const httplib::Request& req) {
     return user_id;
 }
 
-void setupRoutes(httplib::Server& server) {
-    // CORS middleware функция - проверяет, не установлены ли заголовки уже
-    auto addCorsHeaders = [](httplib::Response& res) {
-        // Проверяем и устанавливаем заголовки только если их еще нет
-        if (!res.has_header("Access-Control-Allow-Origin")) {
-            res.set_header("Access-Control-Allow-Origin", "*");
+// Ожидаемые версии из If-Match для Database::updateTask/deleteTask: без заголовка -
+// пустой список (любая), остальное - Task::ifMatchVersions
+static std::vector<int> ifMatchVersions(const httplib::Request& req) {
+    if (!req.has_header("If-Match")) {
+        return {};
+    }
+    return Task::ifMatchVersions(req.get_header_value("If-Match"));
+}
+
+// Ответ на неудачную запись задачи; false - запись прошла
+static bool sendWriteError(httplib::Response& res, TaskWriteResult result, const char* failure) {
+    switch (result) {
+        case TaskWriteResult::Ok:
+            return false;
+        case TaskWriteResult::NotFound:
+            res.status = 404;
+            res.set_content("{\"error\":\"Task not found\"}", "application/json");
+            break;
+        case TaskWriteResult::Forbidden:
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+            break;
+        case TaskWriteResult::PreconditionFailed:
+            res.status = 412;
+            res.set_content("{\"error\":\"Task was modified\"}", "application/json");
+            break;
+        case TaskWriteResult::Failed:
+            res.status = 500;
+            res.set_content(failure, "application/json");
+            break;
+    }
+    return true;
+}
+
+// Запрос с заголовком Idempotency-Key между Idempotency::begin и finish
+struct IdempotentCall {
+    int user_id = -1;
+    std::string key;
+    uint64_t fingerprint = 0;
+};
+
+// false - ответ уже записан: сохранённый ответ на повтор, 409 пока первый запрос
+// выполняется, 422 для ключа от другого запроса, 503 если ключ негде занять.
+// Без заголовка или без валидного токена (обработчик ответит 401) call остаётся
+// пустым. fingerprint 0 - тело читается потоком: перед повтором readFingerprint
+// дочитывает его и возвращает отпечаток запроса целиком.
+static bool beginIdempotent(const httplib::Request& req, httplib::Response& res, uint64_t fingerprint,
+                            const std::function<uint64_t()>& readFingerprint, IdempotentCall& call) {
+    if (!Idempotency::enabled() || !req.has_header("Idempotency-Key")) {
+        return true;
+    }
+    int user_id = getUserIdFromRequest(req);
+    if (user_id == -1) {
+        return true;
+    }
+    std::string key = req.get_header_value("Idempotency-Key");
+    if (!Idempotency::validKey(key)) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid Idempotency-Key\"}", "application/json");
+        return false;
+    }
+    IdempotentResponse stored;
+    Idempotency::Outcome outcome = Idempotency::begin(user_id, key, fingerprint, stored);
+    if (outcome == Idempotency::Outcome::Replay && fingerprint == 0 &&
+        readFingerprint() != stored.fingerprint) {
+        outcome = Idempotency::Outcome::Mismatch;
+    }
+    switch (outcome) {
+        case Idempotency::Outcome::Proceed:
+            call.user_id = user_id;
+            call.key = std::move(key);
+            call.fingerprint = fingerprint;
+            return true;
+        case Idempotency::Outcome::Replay:
+            res.status = stored.status;
+            if (!stored.etag.empty()) {
+                res.set_header("ETag", stored.etag);
+            }
+            res.set_header("Idempotent-Replayed", "true");
+            res.set_content(std::move(stored.body), stored.content_type);
+            return false;
+        case Idempotency::Outcome::InProgress:
+            res.status = 409;
+            res.set_header("Retry-After", "1");
+            res.set_content("{\"error\":\"Request with this Idempotency-Key is in progress\"}", "application/json");
+            return false;
+        case Idempotency::Outcome::Mismatch:
+            res.status = 422;
+            res.set_content("{\"error\":\"Idempotency-Key was used for a different request\"}", "application/json");
+            return false;
+        case Idempotency::Outcome::Busy:
+            res.status = 503;
+            res.set_header("Retry-After", "1");
+            res.set_content("{\"error\":\"Idempotency-Key cannot be reserved, try again later\"}", "application/json");
+            return false;
+    }
+    return true;
+}
+
+// Ответ сохраняется для повторов; после ошибки сервера ключ освобождается,
+// и повтор выполнит запрос заново
+static void finishIdempotent(const IdempotentCall& call, const httplib::Response& res) {
+    if (call.key.empty()) {
+        return;
+    }
+    if (res.status >= 500) {
+        Idempotency::release(call.user_id, call.key);
+        return;
+    }
+    IdempotentResponse response;
+    response.user_id = call.user_id;
+    response.key = call.key;
+    response.fingerprint = call.fingerprint;
+    // Обработчики без явного статуса оставляют -1, httplib отвечает 200
+    response.status = res.status == -1 ? 200 : res.status;
+    response.content_type = res.get_header_value("Content-Type");
+    response.etag = res.get_header_value("ETag");
+    response.body = res.body;
+    Idempotency::finish(std::move(response));
+}
+
+// Начало отпечатка запроса: метод, путь и If-Match - повтор PUT или DELETE с тем же
+// ключом, но другой ожидаемой версией - другой запрос (422), а не повтор первого.
+// Без If-Match совпадает с Idempotency::fingerprintStart.
+static uint64_t fingerprintStart(const httplib::Request& req) {
+    uint64_t hash = Idempotency::fingerprintStart(req.method, req.path);
+    if (req.has_header("If-Match")) {
+        std::string ifMatch = "If-Match:" + req.get_header_value("If-Match");
+        hash = Idempotency::fingerprintFinish(Idempotency::fingerprintAppend(hash, ifMatch.data(), ifMatch.size()));
+    }
+    return hash;
+}
+
+// Запись с Idempotency-Key выполняется один раз, повтор получает сохранённый ответ
+static httplib::Server::Handler idempotent(httplib::Server::Handler handler) {
+    return [handler](const httplib::Request& req, httplib::Response& res) {
+        IdempotentCall call;
+        uint64_t fingerprint = Idempotency::fingerprintFinish(
+            Idempotency::fingerprintAppend(fingerprintStart(req), req.body.data(), req.body.size()));
+        if (!beginIdempotent(req, res, fingerprint, [fingerprint] { return fingerprint; }, call)) {
+            return;
         }
-        if (!res.has_header("Access-Control-Allow-Methods")) {
-            res.set_header("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
+        try {
+            handler(req, res);
+        } catch (...) {
+            Idempotency::release(call.user_id, call.key);
+            throw;
+        }
+        finishIdempotent(call, res);
+    };
+}
+
+#ifdef TODOMANAGER_HAVE_COROUTINES
+// idempotent для обработчика на корутине: ключ занимается и ответ сохраняется один раз,
+// в самой корутине, а не при повторном проходе запроса, который только забирает ответ
+static Coro::Handler idempotentCoro(Coro::Handler handler) {
+    return [handler](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        IdempotentCall call;
+        uint64_t fingerprint = Idempotency::fingerprintFinish(
+            Idempotency::fingerprintAppend(fingerprintStart(req), req.body.data(), req.body.size()));
+        if (!beginIdempotent(req, res, fingerprint, [fingerprint] { return fingerprint; }, call)) {
+            co_return;
         }
-        if (!res.has_header("Access-Control-Allow-Headers")) {
-            res.set_header("Access-Control-Allow-Headers", "Content-Type, Authorization");
+        try {
+            co_await handler(req, res);
+        } catch (...) {
+            Idempotency::release(call.user_id, call.key);
+            throw;
         }
+        finishIdempotent(call, res);
     };
+}
+#endif
+
+// То же для потоковой загрузки: тело ещё не прочитано, поэтому ключ занимается без
+// отпечатка. Тело хешируется по мере чтения обработчиком и дочитывается до конца,
+// даже если обработчик остановился раньше (413), - сохраняется отпечаток всего
+// запроса. Повтор вычитывает тело, и при другом теле получает 422, а не итог первой загрузки.
+static httplib::Server::HandlerWithContentReader idempotent(httplib::Server::HandlerWithContentReader handler) {
+    return [handler](const httplib::Request& req, httplib::Response& res,
+                     const httplib::ContentReader& content_reader) {
+        uint64_t hash = fingerprintStart(req);
+        bool bodyRead = false;
+        httplib::ContentReader hashing(
+            [&](httplib::ContentReceiver receiver) {
+                bodyRead = true;
+                bool accepted = true;
+                bool read = content_reader([&](const char* data, size_t length) {
+                    hash = Idempotency::fingerprintAppend(hash, data, length);
+                    accepted = accepted && receiver(data, length);
+                    return true;
+                });
+                return read && accepted;
+            },
+            content_reader.formdata_reader_);
+        auto readFingerprint = [&] {
+            if (!bodyRead) {
+                hashing([](const char*, size_t) { return true; });
+            }
+            return Idempotency::fingerprintFinish(hash);
+        };
+        
+        IdempotentCall call;
+        if (!beginIdempotent(req, res, 0, readFingerprint, call)) {
+            readFingerprint();
+            return;
+        }
+        if (call.key.empty()) {
+            handler(req, res, content_reader);
+            return;
+        }
+        try {
+            handler(req, res, hashing);
+        } catch (...) {
+            Idempotency::release(call.user_id, call.key);
+            throw;
+        }
+        call.fingerprint = readFingerprint();
+        finishIdempotent(call, res);
+    };
+}
+
+// X-Forwarded-For для RateLimiter::clientAddress. httplib хранит заголовки без порядка,
+// поэтому при нескольких строках самый правый адрес не определить - заголовок
+// не используется, ключом остаётся адрес соединения.
+static std::string forwardedFor(const httplib::Request& req) {
+    if (req.get_header_value_count("X-Forwarded-For") != 1) {
+        return std::string();
+    }
+    return req.get_header_value("X-Forwarded-For");
+}
+
+// Сравнение без раннего выхода, чтобы время ответа не выдавало совпавший префикс
+static bool isAdminRequest(const httplib::Request& req, const std::string& adminToken) {
+    std::string token = req.get_header_value("X-Admin-Token");
+    if (adminToken.empty() || token.size() != adminToken.size()) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for (size_t i = 0; i < token.size(); ++i) {
+        diff |= static_cast<unsigned char>(token[i] ^ adminToken[i]);
+    }
+    return diff == 0;
+}
+
+// Логин и пароль из тела запроса регистрации или входа; false - ответ 400 уже записан
+static bool readCredentials(const httplib::Request& req, httplib::Response& res, bool checkLength,
+                            std::string& username, std::string& password) {
+    auto json = parseSimpleJson(req.body);
     
-    // Обработка preflight запросов
-    server.Options(".*", [addCorsHeaders](const httplib::Request&, httplib::Response& res) {
-        addCorsHeaders(res);
-        res.status = 200;
-    });
+    if (json.find("username") == json.end() || json.find("password") == json.end()) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Username and password are required\"}", "application/json");
+        return false;
+    }
     
-    // Добавляем CORS заголовки ко всем ответам через post-routing handler
-    server.set_post_routing_handler([addCorsHeaders](const httplib::Request&, httplib::Response& res) {
-        addCorsHeaders(res);
-    });
+    username = json["username"];
+    password = json["password"];
     
-    server.Post("/api/auth/register", [](const httplib::Request& req, httplib::Response& res) {
-        auto body = req.body;
-        auto json = parseSimpleJson(body);
-        
-        if (json.find("username") == json.end() || json.find("password") == json.end()) {
+    if (checkLength && (username.length() < 3 || password.length() < 3)) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Username and password must be at least 3 characters\"}", "application/json");
+        return false;
+    }
+    return true;
+}
+
+static void sendUserExists(httplib::Response& res) {
+    res.status = 409;
+    res.set_content("{\"error\":\"Username already exists\"}", "application/json");
+}
+
+static void sendRegistered(httplib::Response& res, bool created) {
+    if (created) {
+        res.status = 201;
+        res.set_content("{\"message\":\"User created successfully\"}", "application/json");
+    } else {
+        res.status = 500;
+        res.set_content("{\"error\":\"Failed to create user\"}", "application/json");
+    }
+}
+
+static void sendInvalidCredentials(httplib::Response& res) {
+    res.status = 401;
+    res.set_content("{\"error\":\"Invalid credentials\"}", "application/json");
+}
+
+static void sendLogin(httplib::Response& res, const User& user, const std::string& username) {
+    std::string token = Auth::generateToken(user.id, user.username);
+    
+    std::string escaped_username = username;
+    size_t pos = 0;
+    while ((pos = escaped_username.find('"', pos)) != std::string::npos) {
+        escaped_username.replace(pos, 1, "\\\"");
+        pos += 2;
+    }
+    
+    std::ostringstream response;
+    response << "{\"token\":\"" << token << "\",\"user_id\":" << user.id << ",\"username\":\"" << escaped_username << "\"}";
+    res.set_content(response.str(), "application/json");
+}
+
+// Разбор запросов и ответы маршрутов задач: общие для синхронных обработчиков
+// и обработчиков на корутинах, которые отличаются только ожиданием базы
+
+// Пользователь по токену; -1 - ответ 401 уже записан
+static int requireUser(const httplib::Request& req, httplib::Response& res) {
+    int user_id = getUserIdFromRequest(req);
+    if (user_id == -1) {
+        res.status = 401;
+        res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
+    }
+    return user_id;
+}
+
+// Фильтр по сроку: ?due_from=YYYY-MM-DD&due_to=YYYY-MM-DD (оба необязательны).
+// false - ответ 400 уже записан
+static bool readDueRange(const httplib::Request& req, httplib::Response& res, bool& filtered,
+                         int32_t& fromDay, int32_t& toDay) {
+    filtered = req.has_param("due_from") || req.has_param("due_to");
+    fromDay = INT32_MIN + 1;
+    toDay = INT32_MAX;
+    if ((req.has_param("due_from") && !Task::parseDay(req.get_param_value("due_from"), fromDay)) ||
+        (req.has_param("due_to") && !Task::parseDay(req.get_param_value("due_to"), toDay))) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid date range\"}", "application/json");
+        return false;
+    }
+    return true;
+}
+
+// ?k=N для /api/tasks/next; false - ответ 400 уже записан
+static bool readNextCount(const httplib::Request& req, httplib::Response& res, int& k) {
+    k = kNextDefault;
+    if (req.has_param("k")) {
+        std::string value = req.get_param_value("k");
+        if (value.empty() || value.size() > 3 ||
+            !std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; }) ||
+            (k = std::stoi(value)) < 1 || k > kNextMax) {
             res.status = 400;
-            res.set_content("{\"error\":\"Username and password are required\"}", "application/json");
-            return;
+            res.set_content("{\"error\":\"k must be between 1 and 100\"}", "application/json");
+            return false;
+        }
+    }
+    return true;
+}
+
+// ?from=YYYY-MM-DD&to=YYYY-MM-DD&bucket=day|week для календаря; false - ответ 400 уже записан
+static bool readCalendarRange(const httplib::Request& req, httplib::Response& res, int32_t& fromDay,
+                              int32_t& toDay, bool& weekly) {
+    std::string bucket = req.has_param("bucket") ? req.get_param_value("bucket") : "day";
+    if (!Task::parseDay(req.get_param_value("from"), fromDay) ||
+        !Task::parseDay(req.get_param_value("to"), toDay) || fromDay > toDay) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid date range\"}", "application/json");
+        return false;
+    }
+    if (bucket != "day" && bucket != "week") {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid bucket\"}", "application/json");
+        return false;
+    }
+    weekly = bucket == "week";
+    if (toDay - fromDay >= (weekly ? kCalendarMaxWeekDays : kCalendarMaxDays)) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Date range too long\"}", "application/json");
+        return false;
+    }
+    return true;
+}
+
+static void sendStats(httplib::Response& res, bool read, const TaskStats& stats) {
+    if (!read) {
+        res.status = 500;
+        res.set_content("{\"error\":\"Failed to read task stats\"}", "application/json");
+        return;
+    }
+    std::ostringstream oss;
+    oss << "{\"total\":" << stats.total
+        << ",\"by_status\":{\"pending\":" << stats.pending
+        << ",\"in_progress\":" << stats.in_progress
+        << ",\"completed\":" << stats.completed << "}"
+        << ",\"by_priority\":{\"low\":" << stats.priority_low
+        << ",\"medium\":" << stats.priority_medium
+        << ",\"high\":" << stats.priority_high << "}"
+        << ",\"overdue\":" << stats.overdue
+        << ",\"completed_this_week\":" << stats.completed_this_week
+        << "}";
+    res.set_content(oss.str(), "application/json");
+}
+
+// Новая задача из тела POST /api/tasks; false - ответ 400 уже записан
+static bool readNewTask(const httplib::Request& req, httplib::Response& res, int user_id, Task& task) {
+    auto json = parseRequestBody(req);
+    
+    if (json.find("title") == json.end()) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Title is required\"}", "application/json");
+        return false;
+    }
+    
+    std::string title = json["title"];
+    std::string description = json.find("description") != json.end() ? json["description"] : "";
+    
+    TaskPriority priority = TaskPriority::Medium;
+    if (json.find("priority") != json.end()) {
+        Task::parsePriority(json["priority"], priority);
+    }
+    
+    int32_t due_date = Task::kNoDate;
+    if (json.find("due_date") != json.end() && !json["due_date"].empty() &&
+        !Task::parseDay(json["due_date"], due_date)) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
+        return false;
+    }
+    
+    task = Task(user_id, title, description, due_date, priority);
+    if (!task.isValid()) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
+        return false;
+    }
+    
+    // Если указана дата создания (YYYY-MM-DD или с временем), используем её,
+    // иначе будет установлена автоматически
+    if (json.find("created_at") != json.end() && !json["created_at"].empty() &&
+        !Task::parseTimestamp(json["created_at"], task.created_at)) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
+        return false;
+    }
+    return true;
+}
+
+static void sendCreated(const httplib::Request& req, httplib::Response& res, Task& task, int64_t task_id) {
+    if (task_id > 0) {
+        task.id = task_id;
+        task.refreshStatus();
+        TaskEvents::changed("task.created", task);
+        res.status = 201;
+        sendTask(req, res, task);
+    } else {
+        res.status = 500;
+        res.set_content("{\"error\":\"Failed to create task\"}", "application/json");
+    }
+}
+
+// Изменяемые поля из тела PUT /api/tasks/{id}; false - ответ 400 уже записан
+static bool readTaskPatch(const httplib::Request& req, httplib::Response& res, TaskPatch& patch) {
+    auto json = parseRequestBody(req);
+    
+    bool valid = true;
+    if (json.find("title") != json.end()) {
+        patch.title = json["title"];
+        valid = !patch.title->empty() && valid;
+    }
+    if (json.find("description") != json.end()) {
+        patch.description = json["description"];
+    }
+    if (json.find("due_date") != json.end()) {
+        int32_t day = Task::kNoDate;
+        if (!json["due_date"].empty()) {
+            valid = Task::parseDay(json["due_date"], day) && valid;
+        }
+        patch.due_date = day;
+    }
+    if (json.find("priority") != json.end()) {
+        TaskPriority priority;
+        valid = Task::parsePriority(json["priority"], priority) && valid;
+        patch.priority = priority;
+    }
+    if (json.find("status") != json.end()) {
+        TaskStatus status;
+        valid = Task::parseStatus(json["status"], status) && valid;
+        patch.status = status;
+    }
+    
+    if (!valid) {
+        res.status = 400;
+        res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
+    }
+    return valid;
+}
+
+static void sendUpdated(const httplib::Request& req, httplib::Response& res, TaskWriteResult result,
+                        const Task& updated) {
+    if (sendWriteError(res, result, "{\"error\":\"Failed to update task\"}")) {
+        return;
+    }
+    TaskEvents::changed("task.updated", updated);
+    sendTask(req, res, updated);
+}
+
+static void sendDeleted(httplib::Response& res, TaskWriteResult result, int user_id, int64_t task_id) {
+    if (sendWriteError(res, result, "{\"error\":\"Failed to delete task\"}")) {
+        return;
+    }
+    TaskEvents::deleted(user_id, task_id);
+    res.status = 200;
+    res.set_content("{\"message\":\"Task deleted successfully\"}", "application/json");
+}
+
+void setupRoutes(httplib::Server& server, const std::string& adminToken, int authFailureDelayMs) {
+    std::chrono::milliseconds authFailureDelay(std::max(0, authFailureDelayMs));
+    
+    // Admission control и rate limiting до маршрутизации.
+    // При перегрузке отвечаем 503 до выполнения дорогих обработчиков.
+    // Дешёвые запросы (preflight и запросы без валидного токена) не отбрасываем.
+    server.set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        // Проверка забирает время ожидания в очереди, поэтому выполняется для
+        // каждого запроса, даже если он не будет отклонён
+        bool overloaded = AdmissionControl::shouldShed();
+        // Повторный проход отложенного запроса (Coro): лимиты уже проверены в первом
+        if (EventServer::resumed()) {
+            return httplib::Server::HandlerResponse::Unhandled;
+        }
+        // Preflight не доходит до маршрутизатора с его перебором регулярных выражений
+        if (req.method == "OPTIONS") {
+            Cors::preflight(req, res);
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        // Файлы фронтенда отдаются из памяти и не проходят admission control
+        if (StaticAssets::serve(req, res)) {
+            return httplib::Server::HandlerResponse::Handled;
         }
         
-        std::string username = json["username"];
-        std::string password = json["password"];
+        bool isTaskRoute = req.path.rfind("/api/tasks", 0) == 0;
+        int user_id = isTaskRoute ? getUserIdFromRequest(req) : -1;
+        bool cheap = isTaskRoute && user_id == -1;
+        if (!cheap && overloaded) {
+            AdmissionControl::recordShed();
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(AdmissionControl::retryAfterSeconds()));
+            res.set_content("{\"error\":\"Server is overloaded\"}", "application/json");
+            return httplib::Server::HandlerResponse::Handled;
+        }
         
-        if (username.length() < 3 || password.length() < 3) {
-            res.status = 400;
-            res.set_content("{\"error\":\"Username and password must be at least 3 characters\"}", "application/json");
-            return;
+        // Rate limiting: вход и регистрация - по IP, задачи - по пользователю
+        RateLimiter::RouteClass routeClass;
+        if (req.path.rfind("/api/auth/", 0) == 0) {
+            routeClass = RateLimiter::RouteClass::Auth;
+        } else if (isTaskRoute) {
+            routeClass = req.method == "GET" ? RateLimiter::RouteClass::Read : RateLimiter::RouteClass::Write;
+        } else {
+            return httplib::Server::HandlerResponse::Unhandled;
         }
         
-        User existingUser = Database::getUserByUsername(username);
-        if (existingUser.id != 0) {
+        std::string key = user_id != -1
+            ? "u" + std::to_string(user_id)
+            : "ip" + RateLimiter::clientAddress(req.remote_addr, forwardedFor(req));
+        auto decision = RateLimiter::check(routeClass, key);
+        if (decision.limit > 0) {
+            res.set_header("X-RateLimit-Limit", std::to_string(decision.limit));
+            res.set_header("X-RateLimit-Remaining", std::to_string(decision.remaining));
+        }
+        if (!decision.allowed) {
+            res.status = 429;
+            res.set_header("Retry-After", std::to_string(decision.retryAfterSec));
+            res.set_content("{\"error\":\"Too many requests\"}", "application/json");
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+    
+    // Post-routing handler вызывается и для ответов из pre-routing (503, 429, статика).
+    // Добавляем CORS заголовки ко всем ответам и сжимаем JSON
+    server.set_post_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        if (req.method != "OPTIONS") {
+            Cors::apply(req, res);
+        }
+        Compression::apply(req, res);
+    });
+    
+    // Метрики раскрывают внутреннее устройство (шарды, pid воркеров, резервные копии),
+    // поэтому, как и /api/admin/*, только с X-Admin-Token.
+    // В prefork-режиме ответ даёт один из воркеров; снимки остальных - в разделе prefork
+    server.Get("/api/metrics", [adminToken](const httplib::Request& req, httplib::Response& res) {
+        if (!isAdminRequest(req, adminToken)) {
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+            return;
+        }
+        std::string json = metricsJson();
+        if (Prefork::enabled()) {
+            json.insert(json.size() - 1, ",\"prefork\":" + Prefork::workersJson(json));
+        }
+        res.set_content(json, "application/json");
+    });
+    
+    // Снимок базы по запросу администратора; ход копирования - в GET /api/admin/backup
+    server.Post("/api/admin/backup", [adminToken](const httplib::Request& req, httplib::Response& res) {
+        if (!isAdminRequest(req, adminToken)) {
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+            return;
+        }
+        if (!Backup::requestSnapshot()) {
             res.status = 409;
-            res.set_content("{\"error\":\"Username already exists\"}", "application/json");
+            res.set_content("{\"error\":\"Backup is already in progress\"}", "application/json");
             return;
         }
-        
-        std::string password_hash = Auth::hashPassword(password);
-        if (Database::createUser(username, password_hash)) {
-            res.status = 201;
-            res.set_content("{\"message\":\"User created successfully\"}", "application/json");
-        } else {
+        res.status = 202;
+        res.set_content("{\"status\":\"started\"}", "application/json");
+    });
+    
+    server.Get("/api/admin/backup", [adminToken](const httplib::Request& req, httplib::Response& res) {
+        if (!isAdminRequest(req, adminToken)) {
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+            return;
+        }
+        res.set_content(Backup::statsJson(), "application/json");
+    });
+    
+    // Сверка task_stats с задачами: GET только считает расхождения, POST .../rebuild
+    // пересчитывает таблицу заново
+    server.Get("/api/admin/task-stats", [adminToken](const httplib::Request& req, httplib::Response& res) {
+        if (!isAdminRequest(req, adminToken)) {
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+            return;
+        }
+        std::string report;
+        if (!DbExecutor::read([&] { return Database::checkTaskStats(false, report); }).get()) {
             res.status = 500;
-            res.set_content("{\"error\":\"Failed to create user\"}", "application/json");
         }
+        res.set_content(report, "application/json");
     });
     
-    server.Post("/api/auth/login", [](const httplib::Request& req, httplib::Response& res) {
-        auto body = req.body;
-        auto json = parseSimpleJson(body);
-        
-        if (json.find("username") == json.end() || json.find("password") == json.end()) {
-            res.status = 400;
-            res.set_content("{\"error\":\"Username and password are required\"}", "application/json");
+    server.Post("/api/admin/task-stats/rebuild", [adminToken](const httplib::Request& req, httplib::Response& res) {
+        if (!isAdminRequest(req, adminToken)) {
+            res.status = 403;
+            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
             return;
         }
+        std::string report;
+        if (!DbExecutor::write([&] { return Database::checkTaskStats(true, report); }).get()) {
+            res.status = 500;
+        }
+        res.set_content(report, "application/json");
+    });
+    
+#ifdef TODOMANAGER_HAVE_COROUTINES
+    // Вход и регистрация ждут базу и задержку после неверного пароля, не занимая поток пула
+    Coro::post(server, "/api/auth/register", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        std::string username, password;
+        if (!readCredentials(req, res, true, username, password)) {
+            co_return;
+        }
         
-        std::string username = json["username"];
-        std::string password = json["password"];
+        User existingUser = co_await Coro::read([&] { return Database::getUserByUsername(username); });
+        if (existingUser.id != 0) {
+            sendUserExists(res);
+            co_return;
+        }
         
-        User user = Database::getUserByUsername(username);
-        if (user.id == 0) {
-            res.status = 401;
-            res.set_content("{\"error\":\"Invalid credentials\"}", "application/json");
-            return;
+        std::string password_hash = Auth::hashPassword(password);
+        sendRegistered(res, co_await Coro::write([&] { return Database::createUser(username, password_hash); }));
+    });
+    
+    Coro::post(server, "/api/auth/login", [authFailureDelay](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        std::string username, password;
+        if (!readCredentials(req, res, false, username, password)) {
+            co_return;
         }
         
-        if (!Auth::verifyPassword(password, user.password_hash)) {
-            res.status = 401;
-            res.set_content("{\"error\":\"Invalid credentials\"}", "application/json");
+        User user = co_await Coro::read([&] { return Database::getUserByUsername(username); });
+        if (user.id == 0 || !Auth::verifyPassword(password, user.password_hash)) {
+            co_await Coro::sleep(authFailureDelay);
+            sendInvalidCredentials(res);
+            co_return;
+        }
+        sendLogin(res, user, username);
+    });
+#else
+    server.Post("/api/auth/register", [](const httplib::Request& req, httplib::Response& res) {
+        std::string username, password;
+        if (!readCredentials(req, res, true, username, password)) {
             return;
         }
         
-        std::string token = Auth::generateToken(user.id, user.username);
-        
-        std::string escaped_username = username;
-        size_t pos = 0;
-        while ((pos = escaped_username.find('"', pos)) != std::string::npos) {
-            escaped_username.replace(pos, 1, "\\\"");
-            pos += 2;
+        User existingUser = DbExecutor::read([&] { return Database::getUserByUsername(username); }).get();
+        if (existingUser.id != 0) {
+            sendUserExists(res);
+            return;
         }
         
-        std::ostringstream response;
-        response << "{\"token\":\"" << token << "\",\"user_id\":" << user.id << ",\"username\":\"" << escaped_username << "\"}";
-        res.set_content(response.str(), "application/json");
+        std::string password_hash = Auth::hashPassword(password);
+        sendRegistered(res, DbExecutor::write([&] { return Database::createUser(username, password_hash); }).get());
     });
     
-    server.Get("/api/tasks", [](const httplib::Request& req, httplib::Response& res) {
-        int user_id = getUserIdFromRequest(req);
-        if (user_id == -1) {
-            res.status = 401;
-            res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
+    server.Post("/api/auth/login", [authFailureDelay](const httplib::Request& req, httplib::Response& res) {
+        std::string username, password;
+        if (!readCredentials(req, res, false, username, password)) {
             return;
         }
         
-        auto tasks = Database::getTasksByUserId(user_id);
-        std::ostringstream json;
-        json << "[";
-        for (size_t i = 0; i < tasks.size(); i++) {
-            json << tasks[i].toJson();
-            if (i < tasks.size() - 1) json << ",";
+        User user = DbExecutor::read([&] { return Database::getUserByUsername(username); }).get();
+        if (user.id == 0 || !Auth::verifyPassword(password, user.password_hash)) {
+            std::this_thread::sleep_for(authFailureDelay);
+            sendInvalidCredentials(res);
+            return;
         }
-        json << "]";
-        
-        res.set_content(json.str(), "application/json");
+        sendLogin(res, user, username);
     });
+#endif
     
-    server.Post("/api/tasks", [](const httplib::Request& req, httplib::Response& res) {
-        int user_id = getUserIdFromRequest(req);
+#ifdef TODOMANAGER_HAVE_COROUTINES
+    // Списки и сводка ждут поток чтения базы, не занимая поток пула
+    Coro::get(server, "/api/tasks", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        bool filtered;
+        int32_t fromDay;
+        int32_t toDay;
+        if (user_id == -1 || !readDueRange(req, res, filtered, fromDay, toDay)) {
+            co_return;
+        }
+        if (filtered) {
+            sendTasks(req, res, co_await Coro::read([&] {
+                return Database::getTasksByDueRange(user_id, fromDay, toDay);
+            }));
+            co_return;
+        }
+        sendTasks(req, res, co_await Coro::read([&] { return Database::getTasksByUserId(user_id); }));
+    });
+    
+    Coro::get(server, "/api/tasks/overdue", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
         if (user_id == -1) {
-            res.status = 401;
-            res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
+            co_return;
+        }
+        sendTasks(req, res, co_await Coro::read([&] { return Database::getOverdueTasks(user_id, Task::today()); }));
+    });
+    
+    // Что делать дальше: ?k=N первых невыполненных задач по приоритету и сроку.
+    // Читаются только k записей индекса idx_tasks_next, без выборки всего списка.
+    Coro::get(server, "/api/tasks/next", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        int k;
+        if (user_id == -1 || !readNextCount(req, res, k)) {
+            co_return;
+        }
+        sendTasks(req, res, co_await Coro::read([&] { return Database::getNextTasks(user_id, k); }));
+    });
+    
+    // Календарь: задачи диапазона читаются одним проходом по idx_tasks_user_due
+    // в порядке срока, счётчики ячеек считаются по тому же списку.
+    Coro::get(server, "/api/tasks/calendar", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        int32_t fromDay;
+        int32_t toDay;
+        bool weekly;
+        if (user_id == -1 || !readCalendarRange(req, res, fromDay, toDay, weekly)) {
+            co_return;
+        }
+        auto tasks = co_await Coro::read([&] { return Database::getTasksByDueRange(user_id, fromDay, toDay); });
+        sendCalendar(req, res, fromDay, toDay, weekly, tasks);
+    });
+    
+    // Сводка из task_stats: одна строка на пользователя вместо прохода по задачам
+    Coro::get(server, "/api/tasks/stats", [](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        if (user_id == -1) {
+            co_return;
+        }
+        TaskStats stats;
+        bool read = co_await Coro::read([&] { return Database::getTaskStats(user_id, stats); });
+        sendStats(res, read, stats);
+    });
+#else
+    server.Get("/api/tasks", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        bool filtered;
+        int32_t fromDay;
+        int32_t toDay;
+        if (user_id == -1 || !readDueRange(req, res, filtered, fromDay, toDay)) {
             return;
         }
-        
-        auto body = req.body;
-        auto json = parseSimpleJson(body);
-        
-        if (json.find("title") == json.end()) {
-            res.status = 400;
-            res.set_content("{\"error\":\"Title is required\"}", "application/json");
+        if (filtered) {
+            sendTasks(req, res, DbExecutor::read([&] {
+                return Database::getTasksByDueRange(user_id, fromDay, toDay);
+            }).get());
             return;
         }
-        
-        std::string title = json["title"];
-        std::string description = json.find("description") != json.end() ? json["description"] : "";
-        std::string due_date = json.find("due_date") != json.end() ? json["due_date"] : "";
-        std::string priority = json.find("priority") != json.end() ? json["priority"] : "medium";
-        std::string created_at = json.find("created_at") != json.end() ? json["created_at"] : "";
-        
-        if (priority != "high" && priority != "medium" && priority != "low") {
-            priority = "medium";
+        sendTasks(req, res, DbExecutor::read([&] { return Database::getTasksByUserId(user_id); }).get());
+    });
+    
+    server.Get("/api/tasks/overdue", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        if (user_id == -1) {
+            return;
         }
-        
-        Task task(user_id, title, description, due_date, priority);
-        if (!task.isValid()) {
-            res.status = 400;
-            res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
+        sendTasks(req, res, DbExecutor::read([&] { return Database::getOverdueTasks(user_id, Task::today()); }).get());
+    });
+    
+    // Что делать дальше: ?k=N первых невыполненных задач по приоритету и сроку.
+    // Читаются только k записей индекса idx_tasks_next, без выборки всего списка.
+    server.Get("/api/tasks/next", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        int k;
+        if (user_id == -1 || !readNextCount(req, res, k)) {
             return;
         }
-        
-        // Если указана дата создания, используем её, иначе будет установлена автоматически
-        if (!created_at.empty()) {
-            // Преобразуем дату в формат YYYY-MM-DD HH:MM:SS
-            if (created_at.length() == 10) { // YYYY-MM-DD
-                created_at += " 00:00:00";
-            }
-            task.created_at = created_at;
+        sendTasks(req, res, DbExecutor::read([&] { return Database::getNextTasks(user_id, k); }).get());
+    });
+    
+    // Календарь: задачи диапазона читаются одним проходом по idx_tasks_user_due
+    // в порядке срока, счётчики ячеек считаются по тому же списку.
+    server.Get("/api/tasks/calendar", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        int32_t fromDay;
+        int32_t toDay;
+        bool weekly;
+        if (user_id == -1 || !readCalendarRange(req, res, fromDay, toDay, weekly)) {
+            return;
         }
-        
-        int task_id = Database::createTask(task);
-        if (task_id > 0) {
-            task.id = task_id;
-            res.status = 201;
-            res.set_content(task.toJson(), "application/json");
-        } else {
-            res.status = 500;
-            res.set_content("{\"error\":\"Failed to create task\"}", "application/json");
+        auto tasks = DbExecutor::read([&] { return Database::getTasksByDueRange(user_id, fromDay, toDay); }).get();
+        sendCalendar(req, res, fromDay, toDay, weekly, tasks);
+    });
+    
+    // Сводка из task_stats: одна строка на пользователя вместо прохода по задачам
+    server.Get("/api/tasks/stats", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        if (user_id == -1) {
+            return;
         }
+        TaskStats stats;
+        bool read = DbExecutor::read([&] { return Database::getTaskStats(user_id, stats); }).get();
+        sendStats(res, read, stats);
     });
+#endif
     
-    server.Put("/api/tasks/(\\d+)", [](const httplib::Request& req, httplib::Response& res) {
+    // Server-Sent Events: изменения задач пользователя в реальном времени
+    server.Get(kStreamPath, [](const httplib::Request& req, httplib::Response& res) {
         int user_id = getUserIdFromRequest(req);
         if (user_id == -1) {
             res.status = 401;
@@ -273,85 +1179,235 @@ void setupRoutes(httplib::Server& server) {
             return;
         }
         
-        int task_id = std::stoi(req.matches[1]);
-        Task existingTask = Database::getTaskById(task_id);
+        auto subscriber = EventHub::subscribe(user_id);
+        if (!subscriber) {
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(AdmissionControl::retryAfterSeconds()));
+            res.set_content("{\"error\":\"Too many event streams\"}", "application/json");
+            return;
+        }
         
-        if (existingTask.id == 0) {
-            res.status = 404;
-            res.set_content("{\"error\":\"Task not found\"}", "application/json");
+        res.set_header("Cache-Control", "no-cache");
+        res.set_header("X-Accel-Buffering", "no");
+        res.set_chunked_content_provider("text/event-stream",
+            [subscriber](size_t, httplib::DataSink& sink) {
+                std::string frames;
+                if (!EventHub::next(subscriber, frames)) {
+                    sink.done();
+                    return true;
+                }
+                return sink.write(frames.data(), frames.size());
+            },
+            [subscriber](bool) {
+                EventHub::unsubscribe(subscriber);
+            });
+    });
+    
+    // NDJSON-выгрузка: строки пишутся из курсора пачками, память не зависит от числа задач
+    server.Get("/api/tasks/export", [](const httplib::Request& req, httplib::Response& res) {
+        int user_id = getUserIdFromRequest(req);
+        if (user_id == -1) {
+            res.status = 401;
+            res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
             return;
         }
         
-        if (existingTask.user_id != user_id) {
-            res.status = 403;
-            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+        res.set_header("Content-Disposition", "attachment; filename=\"tasks.ndjson\"");
+        res.set_chunked_content_provider("application/x-ndjson",
+            [user_id](size_t, httplib::DataSink& sink) {
+                std::string chunk;
+                chunk.reserve(kExportChunkBytes + 4096);
+                bool written = true;
+                // Курсор пишет прямо в сокет, поэтому экспорт остаётся в потоке HTTP:
+                // в исполнителе медленный клиент держал бы поток БД
+                bool ok = Database::exportTasks(user_id, [&](const Task& task) {
+                    chunk += task.toJson();
+                    chunk += '\n';
+                    if (chunk.size() >= kExportChunkBytes) {
+                        written = sink.write(chunk.data(), chunk.size());
+                        chunk.clear();
+                    }
+                    return written;
+                });
+                if (!written || !ok) {
+                    // Обрыв chunked-ответа: клиент увидит неполную выгрузку, а не короткий файл
+                    return false;
+                }
+                if (!chunk.empty() && !sink.write(chunk.data(), chunk.size())) {
+                    return false;
+                }
+                sink.done();
+                return true;
+            });
+    });
+    
+    // NDJSON-загрузка: тело разбирается по мере чтения, вставка пакетами
+    // по kImportBatchSize строк в одной транзакции. Принятые пакеты остаются
+    // в базе, даже если дальше импорт прервался.
+    server.Post("/api/tasks/import", idempotent([](const httplib::Request& req, httplib::Response& res,
+                                                    const httplib::ContentReader& content_reader) {
+        int user_id = getUserIdFromRequest(req);
+        if (user_id == -1) {
+            res.status = 401;
+            res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
             return;
         }
         
-        auto body = req.body;
-        auto json = parseSimpleJson(body);
+        NdjsonReader reader(kImportMaxLineBytes);
+        std::vector<Task> batch;
+        batch.reserve(kImportBatchSize);
+        std::map<std::string, std::string> fields;
+        std::ostringstream errors;
+        size_t imported = 0;
+        size_t rejected = 0;
+        bool dbFailed = false;
         
-        if (json.find("title") != json.end()) {
-            existingTask.title = json["title"];
-        }
-        if (json.find("description") != json.end()) {
-            existingTask.description = json["description"];
-        }
-        if (json.find("due_date") != json.end()) {
-            existingTask.due_date = json["due_date"];
-        }
-        if (json.find("priority") != json.end()) {
-            existingTask.priority = json["priority"];
-        }
-        if (json.find("status") != json.end()) {
-            existingTask.status = json["status"];
-        }
+        auto reject = [&](size_t line, const char* error) {
+            if (rejected++ < kImportMaxErrors) {
+                errors << (rejected > 1 ? "," : "") << "{\"line\":" << line
+                       << ",\"error\":\"" << error << "\"}";
+            }
+        };
+        auto flush = [&]() {
+            if (batch.empty()) {
+                return true;
+            }
+            if (!DbExecutor::write(Database::shardForUser(user_id), [&] { return Database::importTasks(user_id, batch); }).get()) {
+                dbFailed = true;
+                return false;
+            }
+            for (auto& task : batch) {
+                task.refreshStatus();
+                DueScheduler::onTaskChanged(task);
+            }
+            imported += batch.size();
+            batch.clear();
+            return true;
+        };
+        auto onLine = [&](size_t line, const char* data, size_t size) {
+            fields.clear();
+            if (!NdjsonReader::readFlatObject(data, size, fields)) {
+                reject(line, "Invalid JSON");
+                return true;
+            }
+            Task task;
+            const char* error = nullptr;
+            if (!taskFromImport(fields, user_id, task, error)) {
+                reject(line, error);
+                return true;
+            }
+            batch.push_back(std::move(task));
+            return batch.size() < kImportBatchSize || flush();
+        };
         
-        if (!existingTask.isValid()) {
-            res.status = 400;
-            res.set_content("{\"error\":\"Invalid task data\"}", "application/json");
-            return;
+        bool complete = content_reader([&](const char* data, size_t length) {
+            return reader.feed(data, length, onLine);
+        });
+        complete = complete && reader.finish(onLine) && flush();
+        
+        if (imported > 0) {
+            TaskEvents::imported(user_id, imported);
         }
         
-        if (Database::updateTask(existingTask)) {
-            existingTask = Database::getTaskById(task_id);
-            res.set_content(existingTask.toJson(), "application/json");
-        } else {
+        std::ostringstream json;
+        json << "{\"imported\":" << imported << ",\"rejected\":" << rejected
+             << ",\"errors\":[" << errors.str() << "]";
+        if (dbFailed) {
             res.status = 500;
-            res.set_content("{\"error\":\"Failed to update task\"}", "application/json");
+            json << ",\"error\":\"Failed to import tasks\"";
+        } else if (reader.lineTooLong()) {
+            res.status = 413;
+            json << ",\"error\":\"Line too long\"";
+        } else if (!complete) {
+            res.status = 400;
+            json << ",\"error\":\"Incomplete request body\"";
         }
-    });
+        json << "}";
+        res.set_content(json.str(), "application/json");
+    }));
     
-    server.Delete("/api/tasks/(\\d+)", [](const httplib::Request& req, httplib::Response& res) {
-        int user_id = getUserIdFromRequest(req);
-        if (user_id == -1) {
-            res.status = 401;
-            res.set_content("{\"error\":\"Unauthorized\"}", "application/json");
-            return;
+#ifdef TODOMANAGER_HAVE_COROUTINES
+    // Изменения ждут поток записи шарда, не занимая поток пула
+    Coro::post(server, "/api/tasks", idempotentCoro([](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        Task task;
+        if (user_id == -1 || !readNewTask(req, res, user_id, task)) {
+            co_return;
+        }
+        int64_t task_id = co_await Coro::write(Database::shardForUser(user_id), [&] { return Database::createTask(task); });
+        sendCreated(req, res, task, task_id);
+    }));
+    
+    Coro::put(server, "/api/tasks/(\\d{1,18})", idempotentCoro([](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        TaskPatch patch;
+        if (user_id == -1 || !readTaskPatch(req, res, patch)) {
+            co_return;
         }
         
-        int task_id = std::stoi(req.matches[1]);
-        Task existingTask = Database::getTaskById(task_id);
+        // Проверка владельца и версии, изменение и новая строка - один поход в поток записи шарда
+        int64_t task_id = std::stoll(req.matches[1]);
+        std::vector<int> versions = ifMatchVersions(req);
+        Task updated;
+        TaskWriteResult result = co_await Coro::write(Database::shardForTask(task_id), [&] {
+            return Database::updateTask(task_id, user_id, patch, versions, updated);
+        });
+        sendUpdated(req, res, result, updated);
+    }));
+    
+    Coro::del(server, "/api/tasks/(\\d{1,18})", idempotentCoro([](const httplib::Request& req, httplib::Response& res) -> CoTask<void> {
+        int user_id = requireUser(req, res);
+        if (user_id == -1) {
+            co_return;
+        }
         
-        if (existingTask.id == 0) {
-            res.status = 404;
-            res.set_content("{\"error\":\"Task not found\"}", "application/json");
+        int64_t task_id = std::stoll(req.matches[1]);
+        std::vector<int> versions = ifMatchVersions(req);
+        TaskWriteResult result = co_await Coro::write(Database::shardForTask(task_id), [&] {
+            return Database::deleteTask(task_id, user_id, versions);
+        });
+        sendDeleted(res, result, user_id, task_id);
+    }));
+#else
+    server.Post("/api/tasks", idempotent([](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        Task task;
+        if (user_id == -1 || !readNewTask(req, res, user_id, task)) {
             return;
         }
-        
-        if (existingTask.user_id != user_id) {
-            res.status = 403;
-            res.set_content("{\"error\":\"Forbidden\"}", "application/json");
+        int64_t task_id = DbExecutor::write(Database::shardForUser(user_id), [&] { return Database::createTask(task); }).get();
+        sendCreated(req, res, task, task_id);
+    }));
+    
+    server.Put("/api/tasks/(\\d{1,18})", idempotent([](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        TaskPatch patch;
+        if (user_id == -1 || !readTaskPatch(req, res, patch)) {
             return;
         }
         
-        if (Database::deleteTask(task_id)) {
-            res.status = 200;
-            res.set_content("{\"message\":\"Task deleted successfully\"}", "application/json");
-        } else {
-            res.status = 500;
-            res.set_content("{\"error\":\"Failed to delete task\"}", "application/json");
+        // Проверка владельца и версии, изменение и новая строка - один поход в поток записи шарда
+        int64_t task_id = std::stoll(req.matches[1]);
+        std::vector<int> versions = ifMatchVersions(req);
+        Task updated;
+        TaskWriteResult result = DbExecutor::write(Database::shardForTask(task_id), [&] {
+            return Database::updateTask(task_id, user_id, patch, versions, updated);
+        }).get();
+        sendUpdated(req, res, result, updated);
+    }));
+    
+    server.Delete("/api/tasks/(\\d{1,18})", idempotent([](const httplib::Request& req, httplib::Response& res) {
+        int user_id = requireUser(req, res);
+        if (user_id == -1) {
+            return;
         }
-    });
+        
+        int64_t task_id = std::stoll(req.matches[1]);
+        std::vector<int> versions = ifMatchVersions(req);
+        TaskWriteResult result = DbExecutor::write(Database::shardForTask(task_id), [&] {
+            return Database::deleteTask(task_id, user_id, versions);
+        }).get();
+        sendDeleted(res, result, user_id, task_id);
+    }));
+#endif
 }
-
@@ -0,0 +1,327 @@
+#include "../include/scheduler.h"
+#include "../include/db.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+const int kLevels = 4;
+const int kSlotBits = 6;
+const int kSlots = 1 << kSlotBits;
+const int64_t kSlotMask = kSlots - 1;
+
+struct Timer {
+    int64_t expires;
+    uint64_t generation;
+    DueEvent event;
+};
+
+// Иерархический timer wheel: вставка O(1), каждый таймер переносится
+// между уровнями не более kLevels раз
+class TimerWheel {
+public:
+    void reset(int64_t now) {
+        current_ = now;
+    }
+
+    void add(const Timer& timer) {
+        size_++;
+        place(timer);
+    }
+
+    void advance(int64_t now, std::vector<Timer>& expired) {
+        flush(due_, expired);
+        while (current_ < now) {
+            current_++;
+            for (int level = 1; level < kLevels; ++level) {
+                if ((current_ & ((1LL << (kSlotBits * level)) - 1)) != 0) {
+                    break;
+                }
+                std::vector<Timer> cascade;
+                cascade.swap(slots_[level][(current_ >> (kSlotBits * level)) & kSlotMask]);
+                for (const auto& timer : cascade) {
+                    place(timer);
+                }
+                if (level == kLevels - 1) {
+                    std::vector<Timer> overflow;
+                    overflow.swap(overflow_);
+                    for (const auto& timer : overflow) {
+                        place(timer);
+                    }
+                }
+            }
+            flush(slots_[0][current_ & kSlotMask], expired);
+            flush(due_, expired);
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    void place(const Timer& timer) {
+        int64_t delta = timer.expires - current_;
+        if (delta <= 0) {
+            due_.push_back(timer);
+            return;
+        }
+        for (int level = 0; level < kLevels; ++level) {
+            if (delta < (1LL << (kSlotBits * (level + 1)))) {
+                slots_[level][(timer.expires >> (kSlotBits * level)) & kSlotMask].push_back(timer);
+                return;
+            }
+        }
+        overflow_.push_back(timer);
+    }
+
+    void flush(std::vector<Timer>& slot, std::vector<Timer>& expired) {
+        size_ -= slot.size();
+        expired.insert(expired.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+
+    std::vector<Timer> slots_[kLevels][kSlots];
+    std::vector<Timer> overflow_;
+    std::vector<Timer> due_;
+    int64_t current_ = 0;
+    size_t size_ = 0;
+};
+
+std::mutex g_mutex;
+std::condition_variable g_cond;
+std::thread g_thread;
+bool g_running = false;
+bool g_stop = false;
+
+TimerWheel g_wheel;
+// Текущее поколение таймеров задачи; таймеры со старым поколением отменены
+std::unordered_map<int64_t, uint64_t> g_generations;
+uint64_t g_next_generation = 1;
+int32_t g_loaded_until = 0;    // задачи со сроком раньше этого дня уже в колесе
+int g_horizon_days = 7;
+int g_reminder_lead_sec = 86400;
+bool g_refilling = false;
+std::unordered_set<int64_t> g_changed_during_refill;
+std::vector<std::function<void(const DueEvent&)>> g_listeners;
+
+std::atomic<unsigned long long> g_fired_reminders{0};
+std::atomic<unsigned long long> g_fired_overdue{0};
+std::atomic<unsigned long long> g_cancelled{0};
+std::atomic<long long> g_last_lag_ms{0};
+std::atomic<long long> g_max_lag_ms{0};
+
+int64_t nowSeconds() {
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+// Вызывается под g_mutex
+void scheduleLocked(const Task& task) {
+    uint64_t generation = g_next_generation++;
+    g_generations[task.id] = generation;
+
+    DueEvent event{DueEvent::Kind::Reminder, task.id, task.user_id, task.due_date};
+    int64_t dueStart = static_cast<int64_t>(task.due_date) * 86400;
+    int64_t remindAt = dueStart - g_reminder_lead_sec;
+    if (remindAt > nowSeconds()) {
+        g_wheel.add(Timer{remindAt, generation, event});
+    }
+    event.kind = DueEvent::Kind::Overdue;
+    g_wheel.add(Timer{dueStart + 86400, generation, event});
+}
+
+bool isSchedulable(const Task& task) {
+    return task.status != TaskStatus::Completed && task.due_date != Task::kNoDate;
+}
+
+// Подгружает задачи со сроком в [g_loaded_until, today + horizon) из индекса
+void refill(std::unique_lock<std::mutex>& lock) {
+    int32_t until = Task::today() + g_horizon_days;
+    if (until <= g_loaded_until) {
+        return;
+    }
+    int32_t from = g_loaded_until;
+    g_loaded_until = until;
+    g_refilling = true;
+    g_changed_during_refill.clear();
+
+    lock.unlock();
+    std::vector<Task> tasks = Database::getPendingTasksDueBetween(from, until - 1);
+    lock.lock();
+
+    for (const auto& task : tasks) {
+        // Задачи, изменённые во время запроса, уже запланированы по свежим данным
+        if (g_changed_during_refill.count(task.id) == 0 && isSchedulable(task)) {
+            scheduleLocked(task);
+        }
+    }
+    g_refilling = false;
+    g_changed_during_refill.clear();
+}
+
+void dispatch(const std::vector<Timer>& expired) {
+    std::vector<DueEvent> events;
+    std::vector<std::function<void(const DueEvent&)>> listeners;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (const auto& timer : expired) {
+            auto it = g_generations.find(timer.event.task_id);
+            if (it == g_generations.end() || it->second != timer.generation) {
+                continue;
+            }
+            if (timer.event.kind == DueEvent::Kind::Overdue) {
+                g_generations.erase(it);
+            }
+            events.push_back(timer.event);
+
+            auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            long long lag = static_cast<long long>(nowMs - timer.expires * 1000);
+            g_last_lag_ms = lag;
+            if (lag > g_max_lag_ms) {
+                g_max_lag_ms = lag;
+            }
+        }
+        listeners = g_listeners;
+    }
+
+    for (const auto& event : events) {
+        if (event.kind == DueEvent::Kind::Overdue) {
+            g_fired_overdue++;
+        } else {
+            g_fired_reminders++;
+        }
+        for (const auto& listener : listeners) {
+            listener(event);
+        }
+    }
+}
+
+void run() {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_wheel.reset(nowSeconds());
+    g_loaded_until = Task::today();
+    refill(lock);
+
+    while (!g_stop) {
+        // Просыпаемся на границе секунды, чтобы задержка срабатывания была минимальной
+        g_cond.wait_until(lock, std::chrono::system_clock::time_point(
+            std::chrono::seconds(nowSeconds() + 1)));
+        if (g_stop) {
+            break;
+        }
+        refill(lock);
+
+        std::vector<Timer> expired;
+        g_wheel.advance(nowSeconds(), expired);
+        if (!expired.empty()) {
+            lock.unlock();
+            dispatch(expired);
+            lock.lock();
+        }
+    }
+}
+
+}
+
+void DueScheduler::start(int horizonDays, int reminderLeadSec) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_running) {
+        return;
+    }
+    g_reminder_lead_sec = std::max(0, reminderLeadSec);
+    // Горизонт должен покрывать напоминания, которые срабатывают раньше срока
+    g_horizon_days = std::max(horizonDays, g_reminder_lead_sec / 86400 + 2);
+    g_stop = false;
+    g_running = true;
+    g_thread = std::thread(run);
+}
+
+void DueScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (!g_running) {
+            return;
+        }
+        g_stop = true;
+    }
+    g_cond.notify_all();
+    g_thread.join();
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_running = false;
+}
+
+void DueScheduler::addListener(std::function<void(const DueEvent&)> listener) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_listeners.push_back(std::move(listener));
+}
+
+void DueScheduler::onTaskChanged(const Task& task) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_running) {
+        return;
+    }
+    if (g_refilling) {
+        g_changed_during_refill.insert(task.id);
+    }
+    if (g_generations.erase(task.id) > 0) {
+        g_cancelled++;
+    }
+    // Задачи за горизонтом подгрузятся из индекса, когда до них дойдёт очередь
+    if (isSchedulable(task) && task.due_date >= Task::today() && task.due_date < g_loaded_until) {
+        scheduleLocked(task);
+    }
+}
+
+void DueScheduler::onTaskDeleted(int64_t task_id) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_refilling) {
+        g_changed_during_refill.insert(task_id);
+    }
+    if (g_generations.erase(task_id) > 0) {
+        g_cancelled++;
+    }
+}
+
+void DueScheduler::reload() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_running) {
+        return;
+    }
+    // Старые таймеры отменяются лениво по поколению, горизонт перечитается на следующем тике
+    g_cancelled += g_generations.size();
+    g_generations.clear();
+    g_loaded_until = Task::today();
+}
+
+std::string DueScheduler::statsJson() {
+    size_t timers;
+    size_t tracked;
+    int32_t loadedUntil;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        timers = g_wheel.size();
+        tracked = g_generations.size();
+        loadedUntil = g_loaded_until;
+    }
+    std::ostringstream oss;
+    oss << "{"
+        << "\"pending_timers\":" << timers << ","
+        << "\"tracked_tasks\":" << tracked << ","
+        << "\"loaded_until\":\"" << Task::formatDay(loadedUntil) << "\","
+        << "\"fired_reminders\":" << g_fired_reminders.load() << ","
+        << "\"fired_overdue\":" << g_fired_overdue.load() << ","
+        << "\"cancelled\":" << g_cancelled.load() << ","
+        << "\"last_lag_ms\":" << g_last_lag_ms.load() << ","
+        << "\"max_lag_ms\":" << g_max_lag_ms.load()
+        << "}";
+    return oss.str();
+}
@@ -0,0 +1,111 @@
+#include "../include/shutdown.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace {
+
+std::mutex g_mutex;
+std::condition_variable g_cond;
+std::thread g_deadline;
+bool g_drained = false;
+std::atomic<bool> g_requested{false};
+std::function<void()> g_on_signal;
+int g_drain_timeout_sec = 8;
+
+#ifndef _WIN32
+sigset_t g_signals;
+#else
+volatile std::sig_atomic_t g_pending_signal = 0;
+
+void signalHandler(int signal) {
+    // На Windows обработчик сбрасывается после срабатывания
+    std::signal(signal, signalHandler);
+    g_pending_signal = signal;
+}
+#endif
+
+void handleSignal(int signal) {
+    if (g_requested.exchange(true)) {
+        std::cerr << "Signal " << signal << " received again, exiting immediately" << std::endl;
+        std::_Exit(1);
+    }
+    std::cout << "Signal " << signal << " received, draining in-flight requests (deadline "
+              << g_drain_timeout_sec << " s)" << std::endl;
+    g_on_signal();
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_drained) {
+        return;
+    }
+    g_deadline = std::thread([] {
+        std::unique_lock<std::mutex> lock(g_mutex);
+        if (!g_cond.wait_for(lock, std::chrono::seconds(g_drain_timeout_sec), [] { return g_drained; })) {
+            std::cerr << "Drain deadline exceeded, exiting with requests in flight" << std::endl;
+            std::_Exit(1);
+        }
+    });
+}
+
+}
+
+void Shutdown::blockSignals() {
+#ifndef _WIN32
+    sigemptyset(&g_signals);
+    sigaddset(&g_signals, SIGTERM);
+    sigaddset(&g_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &g_signals, nullptr);
+#endif
+}
+
+void Shutdown::start(std::function<void()> onSignal, int drainTimeoutSec) {
+    g_on_signal = std::move(onSignal);
+    g_drain_timeout_sec = drainTimeoutSec > 0 ? drainTimeoutSec : 1;
+
+    // Поток живёт до конца процесса: после остановки он ждёт повторного сигнала
+#ifndef _WIN32
+    std::thread([] {
+        for (;;) {
+            int signal = 0;
+            if (sigwait(&g_signals, &signal) == 0) {
+                handleSignal(signal);
+            }
+        }
+    }).detach();
+#else
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+    std::thread([] {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            int signal = g_pending_signal;
+            if (signal != 0) {
+                g_pending_signal = 0;
+                handleSignal(signal);
+            }
+        }
+    }).detach();
+#endif
+}
+
+void Shutdown::drained() {
+    std::thread deadline;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_drained = true;
+        deadline.swap(g_deadline);
+    }
+    g_cond.notify_all();
+    if (deadline.joinable()) {
+        deadline.join();
+    }
+}
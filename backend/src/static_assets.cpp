@@ -0,0 +1,274 @@
+#include "../include/static_assets.h"
+#include "../include/compression.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Variant {
+    std::string encoding;    // пусто - без сжатия
+    std::string data;
+    std::string etag;
+};
+
+struct Asset {
+    const char* content_type;
+    const char* cache_control;
+    std::vector<Variant> variants;    // [0] - исходный файл
+};
+
+// Заполняется один раз в load до запуска сервера, дальше только читается
+std::unordered_map<std::string, Asset> g_assets;
+const Asset* g_index = nullptr;
+bool g_enabled = false;
+size_t g_bytes = 0;
+size_t g_compressed_bytes = 0;
+
+std::atomic<unsigned long long> g_served{0};
+std::atomic<unsigned long long> g_not_modified{0};
+std::atomic<unsigned long long> g_fallbacks{0};
+
+const char* const kImmutable = "public, max-age=31536000, immutable";
+const char* const kRevalidate = "no-cache";
+
+bool endsWith(const std::string& value, const std::string& suffix) {
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+const char* contentTypeFor(const std::string& path) {
+    static const std::map<std::string, const char*> types = {
+        {".html", "text/html; charset=utf-8"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".mjs", "text/javascript; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".json", "application/json"},
+        {".map", "application/json"},
+        {".webmanifest", "application/manifest+json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".xml", "application/xml"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/x-icon"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".ttf", "font/ttf"},
+        {".wasm", "application/wasm"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+        auto it = types.find(path.substr(dot));
+        if (it != types.end()) {
+            return it->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Картинки и шрифты уже сжаты
+bool isCompressible(const std::string& contentType) {
+    return contentType.rfind("text/", 0) == 0 || contentType.rfind("application/", 0) == 0 ||
+           contentType.rfind("image/svg", 0) == 0 || contentType.rfind("image/x-icon", 0) == 0;
+}
+
+bool readFile(const std::filesystem::path& path, std::string& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+std::string contentHash(const std::string& data) {
+    // FNV-1a 64 + длина: достаточно для сильного ETag неизменяемого набора файлов
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "%016llx-%zx", static_cast<unsigned long long>(hash), data.size());
+    return buf;
+}
+
+bool etagMatches(const std::string& ifNoneMatch, const std::string& etag) {
+    std::istringstream stream(ifNoneMatch);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        size_t begin = item.find_first_not_of(" \t");
+        size_t end = item.find_last_not_of(" \t");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        item = item.substr(begin, end - begin + 1);
+        if (item == "*") {
+            return true;
+        }
+        // If-None-Match сравнивается слабо
+        if (item.rfind("W/", 0) == 0) {
+            item = item.substr(2);
+        }
+        if (item == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+bool StaticAssets::load(const std::string& rootDir) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_directory(rootDir, ec)) {
+        return false;
+    }
+
+    std::map<std::string, fs::path> files;
+    for (fs::recursive_directory_iterator it(rootDir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec)) {
+            files["/" + fs::relative(it->path(), rootDir, ec).generic_string()] = it->path();
+        }
+    }
+    if (ec) {
+        return false;
+    }
+
+    for (const auto& entry : files) {
+        const std::string& url = entry.first;
+        // Готовые сжатые копии (vite-plugin-compression и т.п.) - варианты исходного файла
+        if ((endsWith(url, ".br") || endsWith(url, ".gz")) && files.count(url.substr(0, url.size() - 3))) {
+            continue;
+        }
+
+        Asset asset;
+        std::string data;
+        if (!readFile(entry.second, data)) {
+            return false;
+        }
+        asset.content_type = contentTypeFor(url);
+        asset.cache_control = url.rfind("/assets/", 0) == 0 ? kImmutable : kRevalidate;
+        std::string hash = contentHash(data);
+
+        static const struct {
+            const char* encoding;
+            const char* suffix;
+            int level;
+        } kEncodings[] = {{"br", ".br", 11}, {"gzip", ".gz", 9}};
+        for (const auto& encoding : kEncodings) {
+            std::string compressed;
+            auto prebuilt = files.find(url + encoding.suffix);
+            if (prebuilt != files.end()) {
+                if (!readFile(prebuilt->second, compressed)) {
+                    continue;
+                }
+            } else if (!isCompressible(asset.content_type) ||
+                       !Compression::compress(encoding.encoding, data, compressed, encoding.level)) {
+                continue;
+            }
+            // Выигрыш меньше 10% не стоит отдельного варианта
+            if (compressed.size() >= data.size() / 10 * 9) {
+                continue;
+            }
+            g_compressed_bytes += compressed.size();
+            asset.variants.push_back({encoding.encoding, std::move(compressed),
+                                      "\"" + hash + "-" + encoding.encoding + "\""});
+        }
+
+        g_bytes += data.size();
+        asset.variants.insert(asset.variants.begin(), Variant{"", std::move(data), "\"" + hash + "\""});
+        g_assets[url] = std::move(asset);
+    }
+
+    auto index = g_assets.find("/index.html");
+    g_index = index != g_assets.end() ? &index->second : nullptr;
+    g_enabled = true;
+    return true;
+}
+
+bool StaticAssets::enabled() {
+    return g_enabled;
+}
+
+bool StaticAssets::serve(const httplib::Request& req, httplib::Response& res) {
+    if (!g_enabled || (req.method != "GET" && req.method != "HEAD") ||
+        req.path.rfind("/api/", 0) == 0 || req.path == "/api") {
+        return false;
+    }
+
+    std::string path = req.path;
+    if (path.empty() || path.back() == '/') {
+        path += "index.html";
+    }
+    const Asset* asset;
+    auto it = g_assets.find(path);
+    if (it != g_assets.end()) {
+        asset = &it->second;
+    } else {
+        // Маршрут клиентского роутера, а не отсутствующий файл: последний сегмент без расширения
+        if (!g_index || path.find('.', path.rfind('/')) != std::string::npos) {
+            return false;
+        }
+        asset = g_index;
+        g_fallbacks++;
+    }
+
+    const Variant* variant = &asset->variants[0];
+    if (asset->variants.size() > 1) {
+        std::string encoding = Compression::chooseEncoding(req.get_header_value("Accept-Encoding"));
+        for (const auto& candidate : asset->variants) {
+            if (!encoding.empty() && candidate.encoding == encoding) {
+                variant = &candidate;
+            }
+        }
+        res.set_header("Vary", "Accept-Encoding");
+    }
+
+    res.set_header("ETag", variant->etag);
+    res.set_header("Cache-Control", asset->cache_control);
+    res.set_header("X-Content-Type-Options", "nosniff");
+    if (etagMatches(req.get_header_value("If-None-Match"), variant->etag)) {
+        g_not_modified++;
+        res.status = 304;
+        return true;
+    }
+
+    if (!variant->encoding.empty()) {
+        res.set_header("Content-Encoding", variant->encoding);
+    }
+    // Тело отдаётся прямо из загруженного буфера, без копии в res.body
+    const std::string* data = &variant->data;
+    res.set_content_provider(data->size(), asset->content_type,
+        [data](size_t offset, size_t length, httplib::DataSink& sink) {
+            return sink.write(data->data() + offset, length);
+        });
+    g_served++;
+    return true;
+}
+
+std::string StaticAssets::statsJson() {
+    std::ostringstream oss;
+    oss << "{"
+        << "\"enabled\":" << (g_enabled ? "true" : "false") << ","
+        << "\"files\":" << g_assets.size() << ","
+        << "\"bytes\":" << g_bytes << ","
+        << "\"compressed_bytes\":" << g_compressed_bytes << ","
+        << "\"served\":" << g_served.load() << ","
+        << "\"not_modified\":" << g_not_modified.load() << ","
+        << "\"spa_fallbacks\":" << g_fallbacks.load()
+        << "}";
+    return oss.str();
+}
@@ -1,17 +1,327 @@
 #include "../include/task.h"
+#include "../include/msgpack.h"
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include <cctype>
 
-Task::Task() : id(0), user_id(0), priority("medium"), status("pending") {
+Task::Task()
+    : id(0), user_id(0), created_at(kNoTime), updated_at(kNoTime), due_date(kNoDate),
+      priority(TaskPriority::Medium), status(TaskStatus::Pending), overdue(false), version(1) {
 }
 
 Task::Task(int user_id, const std::string& title, const std::string& description,
-           const std::string& due_date, const std::string& priority)
+           int32_t due_date, TaskPriority priority)
     : id(0), user_id(user_id), title(title), description(description),
-      due_date(due_date), priority(priority), status("pending") {
+      created_at(kNoTime), updated_at(kNoTime), due_date(due_date),
+      priority(priority), status(TaskStatus::Pending), overdue(false), version(1) {
+}
+
+// Дни от 1970-01-01 для пролептического григорианского календаря (алгоритм H. Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+static void civilFromDays(int64_t z, int& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<int>(yoe + era * 400 + (m <= 2));
+}
+
+static bool readDigits(const char* p, int count, int& value) {
+    value = 0;
+    for (int i = 0; i < count; ++i) {
+        if (p[i] < '0' || p[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+const char* Task::priorityName(TaskPriority priority) {
+    switch (priority) {
+        case TaskPriority::Low: return "low";
+        case TaskPriority::High: return "high";
+        default: return "medium";
+    }
+}
+
+const char* Task::statusName(TaskStatus status) {
+    switch (status) {
+        case TaskStatus::InProgress: return "in_progress";
+        case TaskStatus::Completed: return "completed";
+        default: return "pending";
+    }
+}
+
+// Нижний регистр без пробелов по краям; значения короткие и помещаются в SSO-буфер
+static std::string lowerTrimmed(const std::string& value) {
+    size_t begin = 0;
+    size_t end = value.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(value[begin]))) begin++;
+    while (end > begin && std::isspace(static_cast<unsigned char>(value[end - 1]))) end--;
+    std::string result(value, begin, end - begin);
+    for (auto& c : result) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+std::string Task::normalizePriority(const std::string& value) {
+    std::string v = lowerTrimmed(value);
+    if (v == "high" || v == "medium" || v == "low") {
+        return v;
+    }
+    return "";
+}
+
+std::string Task::normalizeStatus(const std::string& value) {
+    std::string v = lowerTrimmed(value);
+    if (v == "in progress" || v == "in-progress") {
+        return "in_progress";
+    }
+    if (v == "pending" || v == "in_progress" || v == "completed") {
+        return v;
+    }
+    return "";
+}
+
+bool Task::parsePriority(const std::string& value, TaskPriority& out) {
+    std::string v = normalizePriority(value);
+    if (v.empty()) {
+        return false;
+    }
+    out = v[0] == 'h' ? TaskPriority::High : (v[0] == 'l' ? TaskPriority::Low : TaskPriority::Medium);
+    return true;
+}
+
+bool Task::parseStatus(const std::string& value, TaskStatus& out) {
+    std::string v = normalizeStatus(value);
+    if (v.empty()) {
+        return false;
+    }
+    out = v[0] == 'p' ? TaskStatus::Pending : (v[0] == 'i' ? TaskStatus::InProgress : TaskStatus::Completed);
+    return true;
+}
+
+// "YYYY-MM-DD" с необязательным временем " HH:MM[:SS[.дробь]]" или "THH:MM[:SS[.дробь]]"
+// и поясом "Z" или "+HH:MM"/"-HH:MM" (смещение - в offsetSec, дробь секунд отбрасывается).
+// Других символов после даты быть не может.
+// Разбор по фиксированным позициям, без std::get_time и локали.
+bool Task::parseDate(const std::string& dateString, std::tm& outTm, int& offsetSec) {
+    const size_t size = dateString.size();
+    const char* p = dateString.c_str();
+    if (size < 10 || p[4] != '-' || p[7] != '-') {
+        return false;
+    }
+    int y, m, d;
+    if (!readDigits(p, 4, y) || !readDigits(p + 5, 2, m) || !readDigits(p + 8, 2, d)) {
+        return false;
+    }
+    static const unsigned char kMonthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (m < 1 || m > 12 || d < 1 || d > kMonthDays[m - 1] + (m == 2 && leap ? 1 : 0)) {
+        return false;
+    }
+
+    int h = 0, mi = 0, sec = 0;
+    offsetSec = 0;
+    if (size > 10) {
+        const char* t = p + 10;
+        if ((*t != ' ' && *t != 'T') || size < 16 || t[3] != ':' ||
+            !readDigits(t + 1, 2, h) || !readDigits(t + 4, 2, mi)) {
+            return false;
+        }
+        size_t pos = 16;
+        if (pos < size && p[pos] == ':') {
+            if (size < 19 || !readDigits(p + 17, 2, sec)) {
+                return false;
+            }
+            pos = 19;
+            if (pos < size && p[pos] == '.') {
+                size_t digits = ++pos;
+                while (pos < size && p[pos] >= '0' && p[pos] <= '9') {
+                    ++pos;
+                }
+                if (pos == digits) {
+                    return false;
+                }
+            }
+        }
+        if (h > 23 || mi > 59 || sec > 60) {
+            return false;
+        }
+        if (pos < size && (p[pos] == 'Z' || p[pos] == 'z')) {
+            ++pos;
+        } else if (pos < size && (p[pos] == '+' || p[pos] == '-')) {
+            int oh, om;
+            if (size - pos != 6 || p[pos + 3] != ':' || !readDigits(p + pos + 1, 2, oh) ||
+                !readDigits(p + pos + 4, 2, om) || oh > 23 || om > 59) {
+                return false;
+            }
+            offsetSec = (p[pos] == '-' ? -1 : 1) * (oh * 3600 + om * 60);
+            pos = size;
+        }
+        if (pos != size) {
+            return false;
+        }
+    }
+
+    outTm = std::tm{};
+    outTm.tm_year = y - 1900;
+    outTm.tm_mon = m - 1;
+    outTm.tm_mday = d;
+    outTm.tm_hour = h;
+    outTm.tm_min = mi;
+    outTm.tm_sec = sec;
+    return true;
+}
+
+// Аналог timegm без обращения к часовому поясу процесса
+std::time_t Task::toUtcTimestamp(std::tm tm) {
+    int64_t days = daysFromCivil(tm.tm_year + 1900, static_cast<unsigned>(tm.tm_mon + 1),
+                                 static_cast<unsigned>(tm.tm_mday));
+    return static_cast<std::time_t>(days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec);
+}
+
+bool Task::parseDay(const std::string& value, int32_t& days) {
+    std::tm tm;
+    int offsetSec;
+    if (!parseDate(value, tm, offsetSec)) {
+        return false;
+    }
+    days = static_cast<int32_t>(daysFromCivil(tm.tm_year + 1900, static_cast<unsigned>(tm.tm_mon + 1),
+                                              static_cast<unsigned>(tm.tm_mday)));
+    return true;
+}
+
+bool Task::parseTimestamp(const std::string& value, int64_t& seconds) {
+    std::tm tm;
+    int offsetSec;
+    if (!parseDate(value, tm, offsetSec)) {
+        return false;
+    }
+    seconds = static_cast<int64_t>(toUtcTimestamp(tm)) - offsetSec;
+    return true;
+}
+
+int32_t Task::today() {
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    return static_cast<int32_t>(now >= 0 ? now / 86400 : (now - 86399) / 86400);
+}
+
+int32_t Task::weekStart(int32_t day) {
+    // 1970-01-01 - четверг
+    return day - ((day % 7 + 10) % 7);
+}
+
+// Одна метка If-Match без пробелов вокруг: версия или -1
+static int entityTagVersion(const std::string& tag) {
+    if (tag.size() < 3 || tag.front() != '"' || tag.back() != '"') {
+        return -1;
+    }
+    std::string value = tag.substr(1, tag.size() - 2);
+    size_t dash = value.find('-');
+    if (dash != std::string::npos) {
+        std::string encoding = value.substr(dash + 1);
+        if (encoding != "gzip" && encoding != "br" && encoding != "deflate") {
+            return -1;
+        }
+        value.resize(dash);
+    }
+    if (value.empty() || value.size() > 10) {
+        return -1;
+    }
+    int64_t version = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        version = version * 10 + (c - '0');
+    }
+    return version > 0 && version <= INT32_MAX ? static_cast<int>(version) : -1;
+}
+
+std::vector<int> Task::ifMatchVersions(const std::string& value) {
+    std::vector<int> versions;
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t comma = value.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = value.size();
+        }
+        std::string item = value.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t begin = item.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        item = item.substr(begin, item.find_last_not_of(" \t") - begin + 1);
+        if (item == "*") {
+            return {};
+        }
+        int version = entityTagVersion(item);
+        if (std::find(versions.begin(), versions.end(), version) == versions.end()) {
+            versions.push_back(version);
+        }
+    }
+    if (versions.empty()) {
+        versions.push_back(-1);
+    }
+    return versions;
+}
+
+std::string Task::currentTimestamp() {
+    return formatTimestamp(static_cast<int64_t>(std::time(nullptr)));
+}
+
+// Просрочка - производный признак, в БД не хранится: срок прошёл (по UTC),
+// а задача не выполнена. При keepCompleted == false учитываются и выполненные задачи.
+void Task::refreshStatus(bool keepCompleted) {
+    overdue = due_date != kNoDate && due_date < today() &&
+              (!keepCompleted || status != TaskStatus::Completed);
+}
+
+std::string Task::formatDay(int32_t days) {
+    if (days == kNoDate) {
+        return "";
+    }
+    int y;
+    unsigned m, d;
+    civilFromDays(days, y, m, d);
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%04d-%02u-%02u", y, m, d);
+    return buf;
+}
+
+std::string Task::formatTimestamp(int64_t seconds) {
+    if (seconds == kNoTime) {
+        return "";
+    }
+    int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    int64_t rem = seconds - days * 86400;
+    int y;
+    unsigned m, d;
+    civilFromDays(days, y, m, d);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02d:%02d:%02d", y, m, d,
+                  static_cast<int>(rem / 3600), static_cast<int>(rem / 60 % 60), static_cast<int>(rem % 60));
+    return buf;
 }
 
 static std::string escapeJson(const std::string& str) {
@@ -45,19 +355,45 @@ std::string Task::toJson() const {
         << "\"user_id\":" << user_id << ","
         << "\"title\":\"" << escapeJson(title) << "\","
         << "\"description\":\"" << escapeJson(description) << "\","
-        << "\"due_date\":\"" << escapeJson(due_date) << "\","
-        << "\"priority\":\"" << escapeJson(priority) << "\","
-        << "\"status\":\"" << escapeJson(status) << "\","
-        << "\"created_at\":\"" << escapeJson(created_at) << "\","
-        << "\"updated_at\":\"" << escapeJson(updated_at) << "\""
+        << "\"due_date\":\"" << formatDay(due_date) << "\","
+        << "\"priority\":\"" << priorityName(priority) << "\","
+        << "\"status\":\"" << statusName(status) << "\","
+        << "\"created_at\":\"" << formatTimestamp(created_at) << "\","
+        << "\"updated_at\":\"" << formatTimestamp(updated_at) << "\","
+        << "\"overdue\":" << (overdue ? "true" : "false") << ","
+        << "\"version\":" << version
         << "}";
     return oss.str();
 }
 
+void Task::toMsgpack(MsgpackWriter& writer) const {
+    writer.beginMap(11);
+    writer.string("id", 2);
+    writer.integer(id);
+    writer.string("user_id", 7);
+    writer.integer(user_id);
+    writer.string("title", 5);
+    writer.string(title);
+    writer.string("description", 11);
+    writer.string(description);
+    writer.string("due_date", 8);
+    writer.string(formatDay(due_date));
+    writer.string("priority", 8);
+    writer.string(priorityName(priority));
+    writer.string("status", 6);
+    writer.string(statusName(status));
+    writer.string("created_at", 10);
+    writer.string(formatTimestamp(created_at));
+    writer.string("updated_at", 10);
+    writer.string(formatTimestamp(updated_at));
+    writer.string("overdue", 7);
+    writer.boolean(overdue);
+    writer.string("version", 7);
+    writer.integer(version);
+}
+
 bool Task::isValid() const {
-    return !title.empty() && 
-           (priority == "high" || priority == "medium" || priority == "low") &&
-           (status == "pending" || status == "in_progress" || status == "completed");
+    return !title.empty();
 }
 
 Task Task::fromJson(const std::string& json) {
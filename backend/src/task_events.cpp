@@ -0,0 +1,68 @@
+#include "../include/task_events.h"
+#include "../include/db.h"
+#include "../include/event_hub.h"
+#include "../include/prefork.h"
+#include "../include/scheduler.h"
+#include <sstream>
+
+namespace {
+
+// "<событие> <user_id> <id задачи или число>"
+void relay(const char* event, int user_id, long long value) {
+    if (Prefork::enabled()) {
+        Prefork::broadcast(std::string(event) + " " + std::to_string(user_id) + " " + std::to_string(value));
+    }
+}
+
+std::string deletedJson(int64_t task_id) {
+    return "{\"id\":" + std::to_string(task_id) + "}";
+}
+
+std::string importedJson(size_t count) {
+    return "{\"count\":" + std::to_string(count) + "}";
+}
+
+}
+
+void TaskEvents::changed(const char* event, const Task& task) {
+    DueScheduler::onTaskChanged(task);
+    EventHub::publish(task.user_id, event, task.toJson());
+    relay(event, task.user_id, task.id);
+}
+
+void TaskEvents::deleted(int user_id, int64_t task_id) {
+    DueScheduler::onTaskDeleted(task_id);
+    EventHub::publish(user_id, "task.deleted", deletedJson(task_id));
+    relay("task.deleted", user_id, task_id);
+}
+
+void TaskEvents::imported(int user_id, size_t count) {
+    EventHub::publish(user_id, "tasks.imported", importedJson(count));
+    relay("tasks.imported", user_id, static_cast<long long>(count));
+}
+
+void TaskEvents::applyRemote(const std::string& message) {
+    std::istringstream in(message);
+    std::string event;
+    int user_id = 0;
+    long long value = 0;
+    if (!(in >> event >> user_id >> value)) {
+        return;
+    }
+
+    if (event == "task.created" || event == "task.updated") {
+        // Задача могла измениться ещё раз или исчезнуть, пока шло сообщение
+        Task task = Database::getTaskById(static_cast<int64_t>(value));
+        if (task.id <= 0) {
+            return;
+        }
+        DueScheduler::onTaskChanged(task);
+        EventHub::publish(user_id, event == "task.created" ? "task.created" : "task.updated", task.toJson());
+    } else if (event == "task.deleted") {
+        DueScheduler::onTaskDeleted(static_cast<int64_t>(value));
+        EventHub::publish(user_id, "task.deleted", deletedJson(static_cast<int64_t>(value)));
+    } else if (event == "tasks.imported") {
+        DueScheduler::reload();
+        EventHub::publish(user_id, "tasks.imported", importedJson(static_cast<size_t>(value)));
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// Проверки для тестов без фреймворка: неудачная печатается, тест идёт дальше,
+// main возвращает checkResult() - ненулевой код, если хоть одна не прошла
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed"   \
+                      << std::endl;                                                   \
+            checkFailures()++;                                                        \
+        }                                                                             \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                    \
+    do {                                                                              \
+        auto actual_ = (actual);                                                      \
+        auto expected_ = (expected);                                                  \
+        if (!(actual_ == expected_)) {                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #actual " == " << actual_ \
+                      << ", expected " << expected_ << std::endl;                     \
+            checkFailures()++;                                                        \
+        }                                                                             \
+    } while (0)
+
+inline int checkResult() {
+    if (checkFailures() > 0) {
+        std::cerr << checkFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Путь к базе в пустом временном каталоге name
+inline std::string freshDbPath(const std::string& name) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("todomanager-" + name);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return (dir / "tasks.db").string();
+}
+
+#endif
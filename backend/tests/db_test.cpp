@@ -0,0 +1,207 @@
+#include "check.h"
+#include "../include/db.h"
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+static int createUser(const std::string& username) {
+    CHECK(Database::createUser(username, "hash"));
+    return Database::getUserByUsername(username).id;
+}
+
+// PUT меняет только заданные поля, остальные остаются прежними (COALESCE в UPDATE)
+static void testPatchKeepsUnsetFields(int owner) {
+    int32_t due = 0;
+    CHECK(Task::parseDay("2030-01-02", due));
+    int64_t id = Database::createTask(Task(owner, "title", "description", due, TaskPriority::High));
+    CHECK(id > 0);
+    Task created = Database::getTaskById(id);
+
+    TaskPatch patch;
+    patch.status = TaskStatus::Completed;
+    Task updated;
+    CHECK(Database::updateTask(id, owner, patch, {}, updated) == TaskWriteResult::Ok);
+    CHECK_EQ(updated.id, id);
+    CHECK_EQ(updated.title, std::string("title"));
+    CHECK_EQ(updated.description, std::string("description"));
+    CHECK_EQ(updated.due_date, due);
+    CHECK(updated.priority == TaskPriority::High);
+    CHECK(updated.status == TaskStatus::Completed);
+    CHECK_EQ(updated.created_at, created.created_at);
+    CHECK_EQ(updated.version, created.version + 1);
+
+    // Пустая строка - значение, а не отсутствие поля; kNoDate убирает срок
+    int32_t noDate = Task::kNoDate;
+    patch = TaskPatch();
+    patch.description = std::string();
+    patch.due_date = noDate;
+    patch.priority = TaskPriority::Low;
+    CHECK(Database::updateTask(id, owner, patch, {updated.version}, updated) == TaskWriteResult::Ok);
+    CHECK_EQ(updated.title, std::string("title"));
+    CHECK_EQ(updated.description, std::string());
+    CHECK_EQ(updated.due_date, noDate);
+    CHECK(updated.priority == TaskPriority::Low);
+    CHECK(updated.status == TaskStatus::Completed);
+    CHECK_EQ(updated.version, created.version + 2);
+
+    Task stored = Database::getTaskById(id);
+    CHECK_EQ(stored.description, std::string());
+    CHECK_EQ(stored.due_date, noDate);
+    CHECK_EQ(stored.version, updated.version);
+}
+
+// Промах записи: задачи нет (404), она чужая (403) или версия не та (412)
+static void testMissResult(int owner, int stranger) {
+    int64_t id = Database::createTask(Task(owner, "mine", "", Task::kNoDate, TaskPriority::Medium));
+    CHECK(id > 0);
+    int version = Database::getTaskById(id).version;
+    int64_t missing = id + (1 << 20);
+
+    TaskPatch patch;
+    patch.title = std::string("changed");
+    Task updated;
+    CHECK(Database::updateTask(missing, owner, patch, {}, updated) == TaskWriteResult::NotFound);
+    CHECK(Database::updateTask(id, stranger, patch, {}, updated) == TaskWriteResult::Forbidden);
+    CHECK(Database::updateTask(id, stranger, patch, {version}, updated) == TaskWriteResult::Forbidden);
+    CHECK(Database::updateTask(id, owner, patch, {version + 1}, updated) == TaskWriteResult::PreconditionFailed);
+    CHECK_EQ(Database::getTaskById(id).title, std::string("mine"));
+
+    // Список версий из If-Match: подходит любая
+    CHECK(Database::updateTask(id, owner, patch, {version + 5, version}, updated) == TaskWriteResult::Ok);
+    CHECK(Database::updateTask(id, owner, patch, {version}, updated) == TaskWriteResult::PreconditionFailed);
+    CHECK(Database::updateTask(id, owner, patch, {-1}, updated) == TaskWriteResult::PreconditionFailed);
+
+    CHECK(Database::deleteTask(missing, owner, {}) == TaskWriteResult::NotFound);
+    CHECK(Database::deleteTask(id, stranger, {}) == TaskWriteResult::Forbidden);
+    CHECK(Database::deleteTask(id, owner, {version}) == TaskWriteResult::PreconditionFailed);
+    CHECK(Database::deleteTask(id, owner, {updated.version}) == TaskWriteResult::Ok);
+    CHECK(Database::deleteTask(id, owner, {}) == TaskWriteResult::NotFound);
+}
+
+static bool execRaw(const std::string& path, const char* sql) {
+    sqlite3* db = nullptr;
+    bool ok = sqlite3_open(path.c_str(), &db) == SQLITE_OK &&
+              sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+    sqlite3_close(db);
+    return ok;
+}
+
+// Ошибка базы при поиске задачи - Failed (500), а не NotFound
+static void testDatabaseErrorIsNotMiss(const std::string& path, int owner) {
+    int64_t id = Database::createTask(Task(owner, "broken", "", Task::kNoDate, TaskPriority::Medium));
+    CHECK(id > 0);
+    CHECK(execRaw(path, "ALTER TABLE tasks RENAME TO tasks_hidden"));
+    TaskPatch patch;
+    patch.title = std::string("changed");
+    Task updated;
+    CHECK(Database::updateTask(id, owner, patch, {}, updated) == TaskWriteResult::Failed);
+    CHECK(Database::deleteTask(id, owner, {}) == TaskWriteResult::Failed);
+    CHECK(execRaw(path, "ALTER TABLE tasks_hidden RENAME TO tasks"));
+    CHECK(Database::updateTask(id, owner, patch, {}, updated) == TaskWriteResult::Ok);
+}
+
+static long long queryRaw(const std::string& path, const char* sql) {
+    sqlite3* db = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    long long value = -1;
+    if (sqlite3_open(path.c_str(), &db) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return value;
+}
+
+// Строка статистики со вчерашнего дня: первое чтение досчитывает просроченные
+// и сохраняет сдвиг, следующие читают готовую строку
+static void testStatsRollover(const std::string& path) {
+    int user = createUser("rollover");
+    int32_t today = Task::today();
+    CHECK(Database::createTask(Task(user, "late", "", today - 1, TaskPriority::Low)) > 0);
+    CHECK(Database::createTask(Task(user, "later", "", today + 1, TaskPriority::Low)) > 0);
+    std::string back = "UPDATE task_stats SET overdue = 0, as_of_day = " + std::to_string(today - 2) +
+                       " WHERE user_id = " + std::to_string(user);
+    CHECK(execRaw(path, back.c_str()));
+
+    TaskStats stats;
+    CHECK(Database::getTaskStats(user, stats));
+    CHECK_EQ(stats.total, 2);
+    CHECK_EQ(stats.overdue, 1);
+    std::string asOf = "SELECT as_of_day * 10 + overdue FROM task_stats WHERE user_id = " + std::to_string(user);
+    CHECK_EQ(queryRaw(path, asOf.c_str()), static_cast<long long>(today) * 10 + 1);
+    CHECK(Database::getTaskStats(user, stats));
+    CHECK_EQ(stats.overdue, 1);
+}
+
+// Вставка расходует 64 номера, поэтому id переходит за 32 бита задолго до 2^31 вставок:
+// он не обрезается ни при создании, ни в чтении, изменении и удалении
+static void testWideTaskIds(const std::string& path, int owner) {
+    CHECK(execRaw(path, "UPDATE sqlite_sequence SET seq = 4294967296 WHERE name = 'tasks'"));
+    int64_t id = Database::createTask(Task(owner, "wide", "", Task::kNoDate, TaskPriority::Medium));
+    CHECK(id > INT32_MAX);
+    CHECK_EQ(Database::getTaskById(id).title, std::string("wide"));
+
+    TaskPatch patch;
+    patch.title = std::string("wider");
+    Task updated;
+    CHECK(Database::updateTask(id, owner, patch, {}, updated) == TaskWriteResult::Ok);
+    CHECK_EQ(updated.id, id);
+    CHECK(updated.toJson().find("\"id\":" + std::to_string(id) + ",") != std::string::npos);
+    CHECK(Database::deleteTask(id, owner, {}) == TaskWriteResult::Ok);
+    CHECK_EQ(Database::getTaskById(id).id, int64_t(0));
+}
+
+// Сбой удаления перенесённых строк - ошибка split, а дочистка запускается отдельно
+// и повторно; задачи всё это время читаются из нового шарда
+static void testSplitCleanup(const std::string& path) {
+    std::vector<int> users;
+    for (int i = 0; i < 16; ++i) {
+        int user = createUser("split" + std::to_string(i));
+        users.push_back(user);
+        CHECK(Database::createTask(Task(user, "t", "", Task::kNoDate, TaskPriority::Medium)) > 0);
+    }
+    long long before = queryRaw(path, "SELECT COUNT(*) FROM tasks");
+    CHECK(execRaw(path, "CREATE TRIGGER block_delete BEFORE DELETE ON tasks "
+                        "BEGIN SELECT RAISE(ABORT, 'blocked'); END"));
+    std::string report;
+    CHECK(!Database::splitShard(0, report));
+    CHECK(report.find("cleanup 0") != std::string::npos);
+    CHECK_EQ(Database::shardCount(), 2);
+    CHECK_EQ(queryRaw(path, "SELECT COUNT(*) FROM tasks"), before);
+    for (int user : users) {
+        CHECK_EQ(Database::getTasksByUserId(user).size(), size_t(1));
+    }
+
+    CHECK(!Database::cleanupShard(0, report));
+    CHECK(execRaw(path, "DROP TRIGGER block_delete"));
+    CHECK(Database::cleanupShard(0, report));
+    long long after = queryRaw(path, "SELECT COUNT(*) FROM tasks");
+    std::string shard1 = path.substr(0, path.size() - 3) + "-shard1.db";   // tasks.db -> tasks-shard1.db
+    long long moved = queryRaw(shard1, "SELECT COUNT(*) FROM tasks");
+    CHECK(moved > 0);
+    CHECK_EQ(after + moved, before);
+    CHECK(Database::cleanupShard(0, report));
+    CHECK_EQ(report, std::string("removed 0 moved tasks from shard 0"));
+    for (int user : users) {
+        CHECK_EQ(Database::getTasksByUserId(user).size(), size_t(1));
+    }
+}
+
+int main() {
+    std::string path = freshDbPath("db-test");
+    if (!Database::initDatabase(path)) {
+        std::cerr << "Failed to open database" << std::endl;
+        return 1;
+    }
+    int alice = createUser("alice");
+    int bob = createUser("bob");
+    testPatchKeepsUnsetFields(alice);
+    testMissResult(alice, bob);
+    testDatabaseErrorIsNotMiss(path, alice);
+    testStatsRollover(path);
+    testWideTaskIds(path, alice);
+    testSplitCleanup(path);
+    Database::closeDatabase();
+    return checkResult();
+}
@@ -0,0 +1,154 @@
+#include "check.h"
+#include "../include/db.h"
+#include "../include/idempotency.h"
+#include <ctime>
+#include <string>
+#include <vector>
+
+static IdempotentResponse responseFor(int user_id, const std::string& key, uint64_t fingerprint,
+                                      const std::string& body) {
+    IdempotentResponse response;
+    response.user_id = user_id;
+    response.key = key;
+    response.fingerprint = fingerprint;
+    response.status = 201;
+    response.content_type = "application/json";
+    response.etag = "\"1\"";
+    response.body = body;
+    response.created_ts = static_cast<int64_t>(std::time(nullptr));
+    return response;
+}
+
+// Proceed -> InProgress, пока запрос выполняется -> Replay или Mismatch после finish
+static void testBeginFinish() {
+    uint64_t fp = Idempotency::fingerprint("POST", "/api/tasks", "{\"title\":\"a\"}");
+    uint64_t other = Idempotency::fingerprint("POST", "/api/tasks", "{\"title\":\"b\"}");
+    CHECK(fp != other);
+    CHECK(fp != 0);
+
+    IdempotentResponse response;
+    CHECK(Idempotency::begin(1, "create-a", fp, response) == Idempotency::Outcome::Proceed);
+    CHECK(Idempotency::begin(1, "create-a", fp, response) == Idempotency::Outcome::InProgress);
+    CHECK(Idempotency::begin(1, "create-a", other, response) == Idempotency::Outcome::InProgress);
+    // Ключ действует в пределах пользователя
+    CHECK(Idempotency::begin(2, "create-a", fp, response) == Idempotency::Outcome::Proceed);
+    Idempotency::release(2, "create-a");
+
+    Idempotency::finish(responseFor(1, "create-a", fp, "{\"id\":1}"));
+    response = IdempotentResponse();
+    CHECK(Idempotency::begin(1, "create-a", fp, response) == Idempotency::Outcome::Replay);
+    CHECK_EQ(response.status, 201);
+    CHECK_EQ(response.body, std::string("{\"id\":1}"));
+    CHECK_EQ(response.etag, std::string("\"1\""));
+    CHECK(Idempotency::begin(1, "create-a", other, response) == Idempotency::Outcome::Mismatch);
+    // Тело ещё не прочитано: отпечаток сравнивает вызывающий по response.fingerprint
+    response = IdempotentResponse();
+    CHECK(Idempotency::begin(1, "create-a", 0, response) == Idempotency::Outcome::Replay);
+    CHECK_EQ(response.fingerprint, fp);
+
+    // Ответ записан в базу до возврата finish
+    IdempotentResponse stored;
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    CHECK(Database::claimIdempotencyKey(1, "create-a", fp, now, now - 3600, now - 60, stored) ==
+          IdempotencyClaim::Found);
+    CHECK_EQ(stored.status, 201);
+    CHECK_EQ(stored.body, std::string("{\"id\":1}"));
+}
+
+// release освобождает выполняющийся ключ в памяти и в базе; готовый ключ не трогает
+static void testRelease() {
+    uint64_t fp = Idempotency::fingerprint("PUT", "/api/tasks/1", "{}");
+    IdempotentResponse response;
+    CHECK(Idempotency::begin(1, "update-1", fp, response) == Idempotency::Outcome::Proceed);
+    Idempotency::release(1, "update-1");
+    CHECK(Idempotency::begin(1, "update-1", fp, response) == Idempotency::Outcome::Proceed);
+
+    Idempotency::finish(responseFor(1, "update-1", fp, "{}"));
+    Idempotency::release(1, "update-1");
+    CHECK(Idempotency::begin(1, "update-1", fp, response) == Idempotency::Outcome::Replay);
+
+    Idempotency::release(1, "");
+    Idempotency::release(1, "never-used");
+}
+
+// Ключ, занятый в базе другим воркером: свежая заглушка - InProgress или Mismatch,
+// брошенная (старше минуты) - ключ занимается заново
+static void testClaimedElsewhere() {
+    uint64_t fp = Idempotency::fingerprint("POST", "/api/tasks", "{\"title\":\"w\"}");
+    uint64_t other = Idempotency::fingerprint("POST", "/api/tasks", "{\"title\":\"x\"}");
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    IdempotentResponse stored;
+    CHECK(Database::claimIdempotencyKey(1, "worker-1", fp, now, now - 3600, now - 60, stored) ==
+          IdempotencyClaim::Claimed);
+
+    IdempotentResponse response;
+    CHECK(Idempotency::begin(1, "worker-1", fp, response) == Idempotency::Outcome::InProgress);
+    CHECK(Idempotency::begin(1, "worker-1", other, response) == Idempotency::Outcome::Mismatch);
+    // Отказ не оставляет ключ занятым в памяти этого процесса
+    CHECK(Idempotency::begin(1, "worker-1", fp, response) == Idempotency::Outcome::InProgress);
+
+    // Ответ другого воркера находится в базе
+    CHECK(Database::saveIdempotentResponses({responseFor(1, "worker-1", fp, "{\"id\":9}")}));
+    CHECK(Idempotency::begin(1, "worker-1", fp, response) == Idempotency::Outcome::Replay);
+    CHECK_EQ(response.body, std::string("{\"id\":9}"));
+
+    CHECK(Database::claimIdempotencyKey(1, "crashed", fp, now - 120, now - 3600, now - 180, stored) ==
+          IdempotencyClaim::Claimed);
+    CHECK(Idempotency::begin(1, "crashed", fp, response) == Idempotency::Outcome::Proceed);
+    Idempotency::release(1, "crashed");
+}
+
+// Память ограничена: готовые ключи вытесняются (повтор найдёт ответ в базе),
+// выполняющиеся - нет, и новый ключ получает Busy
+static void testBoundedMemory() {
+    Idempotency::configure(86400, 16);   // по ключу на шард
+    uint64_t fp = Idempotency::fingerprint("POST", "/api/tasks", "{}");
+    IdempotentResponse response;
+
+    std::vector<std::string> done;
+    for (int i = 0; i < 64; ++i) {
+        std::string key = "done-" + std::to_string(i);
+        CHECK(Idempotency::begin(3, key, fp, response) == Idempotency::Outcome::Proceed);
+        Idempotency::finish(responseFor(3, key, fp, key));
+        done.push_back(key);
+    }
+    for (const std::string& key : done) {
+        CHECK(Idempotency::begin(3, key, fp, response) == Idempotency::Outcome::Replay);
+        CHECK_EQ(response.body, key);
+    }
+
+    std::vector<std::string> running;
+    int busy = 0;
+    for (int i = 0; i < 64; ++i) {
+        std::string key = "running-" + std::to_string(i);
+        Idempotency::Outcome outcome = Idempotency::begin(3, key, fp, response);
+        CHECK(outcome == Idempotency::Outcome::Proceed || outcome == Idempotency::Outcome::Busy);
+        if (outcome == Idempotency::Outcome::Proceed) {
+            running.push_back(key);
+        } else {
+            busy++;
+        }
+    }
+    CHECK(running.size() <= 16);
+    CHECK(busy >= 48);
+    for (const std::string& key : running) {
+        CHECK(Idempotency::begin(3, key, fp, response) == Idempotency::Outcome::InProgress);
+        Idempotency::release(3, key);
+    }
+    CHECK(Idempotency::begin(3, "running-0", fp, response) == Idempotency::Outcome::Proceed);
+    Idempotency::release(3, "running-0");
+}
+
+int main() {
+    if (!Database::initDatabase(freshDbPath("idempotency-test"))) {
+        std::cerr << "Failed to open database" << std::endl;
+        return 1;
+    }
+    Idempotency::configure(86400, 1024);
+    testBeginFinish();
+    testRelease();
+    testClaimedElsewhere();
+    testBoundedMemory();
+    Database::closeDatabase();
+    return checkResult();
+}
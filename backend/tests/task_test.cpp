@@ -0,0 +1,202 @@
+#include "check.h"
+#include "../include/msgpack.h"
+#include "../include/task.h"
+#include <map>
+#include <string>
+
+// Понедельник недели, в том числе до эпохи: % для отрицательных дней отрицателен
+static void testWeekStart() {
+    int32_t day = 0;
+    CHECK(Task::parseDay("1970-01-01", day));   // четверг
+    CHECK_EQ(Task::formatDay(Task::weekStart(day)), std::string("1969-12-29"));
+    CHECK(Task::parseDay("1969-12-31", day));   // среда
+    CHECK_EQ(day, -1);
+    CHECK_EQ(Task::formatDay(Task::weekStart(day)), std::string("1969-12-29"));
+    CHECK(Task::parseDay("1969-12-28", day));   // воскресенье
+    CHECK_EQ(Task::formatDay(Task::weekStart(day)), std::string("1969-12-22"));
+    CHECK(Task::parseDay("1969-12-29", day));   // понедельник
+    CHECK_EQ(Task::weekStart(day), day);
+    CHECK(Task::parseDay("1900-03-04", day));   // воскресенье
+    CHECK_EQ(Task::formatDay(Task::weekStart(day)), std::string("1900-02-26"));
+    CHECK(Task::parseDay("2024-05-12", day));   // воскресенье
+    CHECK_EQ(Task::formatDay(Task::weekStart(day)), std::string("2024-05-06"));
+
+    // Для любого дня: понедельник не позже дня и не раньше чем за 6 дней
+    for (int32_t d = -800; d <= 800; ++d) {
+        int32_t monday = Task::weekStart(d);
+        CHECK(monday <= d && d - monday < 7);
+        CHECK_EQ(Task::weekStart(monday), monday);
+    }
+}
+
+// Задача, записанная MsgpackWriter, читается readFlatMap теми же значениями, что и в JSON
+static void testMsgpackRoundTrip() {
+    Task task(7, "Купить молоко", std::string(40, 'd'), 0, TaskPriority::High);
+    task.id = 300;
+    task.status = TaskStatus::InProgress;
+    task.created_at = 1700000000;
+    task.updated_at = 1700003600;
+    task.overdue = true;
+    task.version = 70000;
+    CHECK(Task::parseDay("2024-02-29", task.due_date));
+
+    std::string packed;
+    MsgpackWriter writer(packed);
+    task.toMsgpack(writer);
+
+    std::map<std::string, std::string> fields;
+    CHECK(MsgpackReader::readFlatMap(packed, fields));
+    CHECK_EQ(fields.size(), size_t(11));
+    CHECK_EQ(fields["id"], std::string("300"));
+    CHECK_EQ(fields["user_id"], std::string("7"));
+    CHECK_EQ(fields["title"], task.title);
+    CHECK_EQ(fields["description"], task.description);
+    CHECK_EQ(fields["due_date"], std::string("2024-02-29"));
+    CHECK_EQ(fields["priority"], std::string("high"));
+    CHECK_EQ(fields["status"], std::string("in_progress"));
+    CHECK_EQ(fields["created_at"], Task::formatTimestamp(task.created_at));
+    CHECK_EQ(fields["updated_at"], Task::formatTimestamp(task.updated_at));
+    CHECK_EQ(fields["overdue"], std::string("true"));
+    CHECK_EQ(fields["version"], std::string("70000"));
+
+    // Целые всех размеров и знаков
+    const int64_t values[] = {0, 127, 128, 255, 256, 65535, 65536, 4294967296LL,
+                              -1, -32, -33, -128, -129, -32768, -32769, -2147483649LL};
+    std::string out;
+    MsgpackWriter ints(out);
+    ints.beginMap(sizeof(values) / sizeof(values[0]));
+    for (int64_t value : values) {
+        ints.string("k" + std::to_string(value));
+        ints.integer(value);
+    }
+    fields.clear();
+    CHECK(MsgpackReader::readFlatMap(out, fields));
+    for (int64_t value : values) {
+        CHECK_EQ(fields["k" + std::to_string(value)], std::to_string(value));
+    }
+
+    // nil - поле есть, значение пустое (PUT очищает due_date, как "" или null в JSON)
+    std::string nils;
+    MsgpackWriter withNil(nils);
+    withNil.beginMap(2);
+    withNil.string("due_date");
+    withNil.nil();
+    withNil.string("title");
+    withNil.string("t");
+    fields.clear();
+    CHECK(MsgpackReader::readFlatMap(nils, fields));
+    CHECK(fields.count("due_date") == 1);
+    CHECK_EQ(fields["due_date"], std::string());
+    CHECK_EQ(fields["title"], std::string("t"));
+
+    // Обрезанный буфер - ошибка формата, а не чтение за его концом
+    for (size_t size = 0; size < packed.size(); ++size) {
+        fields.clear();
+        CHECK(!MsgpackReader::readFlatMap(packed.substr(0, size), fields));
+    }
+}
+
+static std::string versions(const std::string& ifMatch) {
+    std::string out;
+    for (int version : Task::ifMatchVersions(ifMatch)) {
+        out += (out.empty() ? "" : ",") + std::to_string(version);
+    }
+    return out;
+}
+
+// If-Match: своя сильная метка, в том числе сжатого ответа, даёт версию; "*" - любая
+// (пустой список); всё остальное - -1, такая метка не совпадёт ни с одной версией
+static void testIfMatchVersions() {
+    CHECK_EQ(versions("\"1\""), std::string("1"));
+    CHECK_EQ(versions("  \"42\"\t"), std::string("42"));
+    CHECK_EQ(versions("\"42-gzip\""), std::string("42"));
+    CHECK_EQ(versions("\"42-br\""), std::string("42"));
+    CHECK_EQ(versions("\"42-deflate\""), std::string("42"));
+    CHECK_EQ(versions("\"2147483647\""), std::string("2147483647"));
+    CHECK_EQ(versions("*"), std::string());
+    CHECK_EQ(versions(" * "), std::string());
+
+    CHECK_EQ(versions(""), std::string("-1"));
+    CHECK_EQ(versions("   "), std::string("-1"));
+    CHECK_EQ(versions("42"), std::string("-1"));
+    CHECK_EQ(versions("\"\""), std::string("-1"));
+    CHECK_EQ(versions("\"42"), std::string("-1"));
+    CHECK_EQ(versions("W/\"42\""), std::string("-1"));
+    CHECK_EQ(versions("\"0\""), std::string("-1"));
+    CHECK_EQ(versions("\"-1\""), std::string("-1"));
+    CHECK_EQ(versions("\"42-\""), std::string("-1"));
+    CHECK_EQ(versions("\"42-zstd\""), std::string("-1"));
+    CHECK_EQ(versions("\"42-gzip-gzip\""), std::string("-1"));
+    CHECK_EQ(versions("\"-gzip\""), std::string("-1"));
+    CHECK_EQ(versions("\"4a\""), std::string("-1"));
+    CHECK_EQ(versions("\"2147483648\""), std::string("-1"));
+    CHECK_EQ(versions("\"99999999999999999999\""), std::string("-1"));
+
+    // Список (RFC 9110): подходит любая метка, повторы версии схлопываются
+    CHECK_EQ(versions("\"3\", \"3-gzip\""), std::string("3"));
+    CHECK_EQ(versions("\"1\",\"2\""), std::string("1,2"));
+    CHECK_EQ(versions("W/\"1\", \"2\""), std::string("-1,2"));
+    CHECK_EQ(versions("\"1\", *"), std::string());
+    CHECK_EQ(versions(" , \"5\" ,"), std::string("5"));
+    CHECK_EQ(versions(",,"), std::string("-1"));
+}
+
+static bool timestamp(const std::string& value, int64_t& seconds) {
+    seconds = 0;
+    return Task::parseTimestamp(value, seconds);
+}
+
+// Время после даты: пояс учитывается, дробь секунд отбрасывается, остальное - ошибка
+static void testParseTimestamp() {
+    int64_t base = 0;
+    CHECK(timestamp("2030-01-02 10:00", base));
+    CHECK_EQ(Task::formatTimestamp(base), std::string("2030-01-02 10:00:00"));
+    int64_t seconds = 0;
+    CHECK(timestamp("2030-01-02T10:00:00", seconds));
+    CHECK_EQ(seconds, base);
+    CHECK(timestamp("2030-01-02T10:00Z", seconds));
+    CHECK_EQ(seconds, base);
+    CHECK(timestamp("2030-01-02T10:00:00.123Z", seconds));
+    CHECK_EQ(seconds, base);
+    CHECK(timestamp("2030-01-02T10:00:00.5", seconds));
+    CHECK_EQ(seconds, base);
+    CHECK(timestamp("2030-01-02T10:00+03:00", seconds));
+    CHECK_EQ(seconds, base - 3 * 3600);
+    CHECK(timestamp("2030-01-02T10:00:30.250-05:30", seconds));
+    CHECK_EQ(seconds, base + 30 + 5 * 3600 + 30 * 60);
+    CHECK(timestamp("2030-01-02T01:00+03:00", seconds));
+    CHECK_EQ(Task::formatTimestamp(seconds), std::string("2030-01-01 22:00:00"));
+    CHECK(timestamp("2030-01-02", seconds));
+    CHECK_EQ(Task::formatTimestamp(seconds), std::string("2030-01-02 00:00:00"));
+
+    const char* invalid[] = {
+        "2030-01-02Tgarbage", "2030-01-02T10:00garbage", "2030-01-02T10:00:00garbage",
+        "2030-01-02T10:00:00.", "2030-01-02T10:00:00.12x", "2030-01-02T10:00.5",
+        "2030-01-02T10:00+03", "2030-01-02T10:00+0300", "2030-01-02T10:00+24:00",
+        "2030-01-02T10:00+03:60", "2030-01-02T10:00+03:00Z", "2030-01-02T10:00ZZ",
+        "2030-01-02T10:00:", "2030-01-02T10:00 ", "2030-01-02 ", "2030-01-02x",
+        "2030-01-02T24:00", "2030-02-30"};
+    for (const char* value : invalid) {
+        if (timestamp(value, seconds)) {
+            std::cerr << "accepted: " << value << std::endl;
+            checkFailures()++;
+        }
+        int32_t day = 0;
+        CHECK(!Task::parseDay(value, day));
+    }
+
+    // День - из даты как она записана, пояс его не сдвигает
+    int32_t day = 0;
+    CHECK(Task::parseDay("2030-01-02T01:00+03:00", day));
+    CHECK_EQ(Task::formatDay(day), std::string("2030-01-02"));
+    CHECK(Task::parseDay("2030-01-02T10:00:00.123Z", day));
+    CHECK_EQ(Task::formatDay(day), std::string("2030-01-02"));
+}
+
+int main() {
+    testWeekStart();
+    testMsgpackRoundTrip();
+    testIfMatchVersions();
+    testParseTimestamp();
+    return checkResult();
+}
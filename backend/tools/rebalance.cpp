@@ -0,0 +1,52 @@
+#include "../include/db.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Утилита раскладки шардов. Запускать только при остановленном сервере:
+// сервер держит карту корзин в памяти и не увидит перенос.
+static int usage() {
+    std::cerr << "Usage:\n"
+              << "  todomanager-rebalance <db_path> status\n"
+              << "  todomanager-rebalance <db_path> split <shard>\n"
+              << "  todomanager-rebalance <db_path> cleanup <shard>   (finish a split whose cleanup failed)\n"
+              << "Stop the server before running split or cleanup." << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        return usage();
+    }
+    std::string dbPath = argv[1];
+    std::string command = argv[2];
+    
+    if (!Database::initDatabase(dbPath)) {
+        std::cerr << "Failed to open database: " << dbPath << std::endl;
+        return 1;
+    }
+    
+    if (command == "status") {
+        std::cout << Database::shardStatsJson(true) << std::endl;
+        return 0;
+    }
+    
+    if (command == "split" && argc == 4) {
+        std::string report;
+        bool ok = Database::splitShard(std::atoi(argv[3]), report);
+        (ok ? std::cout : std::cerr) << report << std::endl;
+        if (ok) {
+            std::cout << Database::shardStatsJson(true) << std::endl;
+        }
+        return ok ? 0 : 1;
+    }
+    
+    if (command == "cleanup" && argc == 4) {
+        std::string report;
+        bool ok = Database::cleanupShard(std::atoi(argv[3]), report);
+        (ok ? std::cout : std::cerr) << report << std::endl;
+        return ok ? 0 : 1;
+    }
+    
+    return usage();
+}
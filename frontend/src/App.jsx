@@ -1,13 +1,14 @@
 import { useState, useEffect } from 'react';
 import Login from './components/Login';
 import TaskList from './components/TaskList';
-import { authAPI, tasksAPI } from './services/api';
+import { authAPI, tasksAPI, isConflict } from './services/api';
 import './App.css';
 
 function App() {
 	const [isAuthenticated, setIsAuthenticated] = useState(false);
 	const [user, setUser] = useState(null);
 	const [tasks, setTasks] = useState([]);
+	const [stats, setStats] = useState(null);
 	const [loading, setLoading] = useState(true);
 
 	useEffect(() => {
@@ -20,6 +21,44 @@ function App() {
 		}
 	}, []);
 
+	// После (пере)подключения перечитываем список: события за время обрыва потеряны
+	useEffect(() => {
+		if (!isAuthenticated) {
+			return undefined;
+		}
+		let connected = false;
+		const upsert = (task) =>
+			setTasks((current) =>
+				current.some((t) => t.id === task.id)
+					? current.map((t) => (t.id === task.id ? task : t))
+					: [...current, task]
+			);
+		return tasksAPI.subscribe({
+			onOpen: () => {
+				if (connected) {
+					loadTasks();
+				}
+				connected = true;
+			},
+			onCreated: upsert,
+			onUpdated: upsert,
+			onDeleted: ({ id }) =>
+				setTasks((current) => current.filter((t) => t.id !== id)),
+			onImported: () => loadTasks(),
+		});
+	}, [isAuthenticated]);
+
+	// Сводка меняется вместе со списком: после любого изменения задач берём её с сервера
+	useEffect(() => {
+		if (!isAuthenticated) {
+			return;
+		}
+		tasksAPI
+			.getStats()
+			.then(setStats)
+			.catch((error) => console.error('Failed to load stats:', error));
+	}, [tasks, isAuthenticated]);
+
 	const loadTasks = async () => {
 		try {
 			const tasksData = await tasksAPI.getAll();
@@ -42,23 +81,38 @@ function App() {
 		setIsAuthenticated(false);
 		setUser(null);
 		setTasks([]);
+		setStats(null);
 	};
 
 	const handleCreateTask = async (taskData) => {
 		try {
 			const newTask = await tasksAPI.create(taskData);
-			setTasks([...tasks, newTask]);
+			setTasks((current) =>
+				current.some((t) => t.id === newTask.id) ? current : [...current, newTask]
+			);
 		} catch (error) {
 			console.error('Failed to create task:', error);
 			alert('Не удалось создать задачу');
 		}
 	};
 
+	const versionOf = (taskId) => tasks.find((task) => task.id === taskId)?.version;
+
+	// Задачу изменили в другом месте: показываем актуальную версию вместо перезаписи
+	const handleConflict = () => {
+		alert('Задача была изменена в другом окне, список обновлён');
+		loadTasks();
+	};
+
 	const handleUpdateTask = async (taskId, taskData) => {
 		try {
-			const updatedTask = await tasksAPI.update(taskId, taskData);
+			const updatedTask = await tasksAPI.update(taskId, taskData, versionOf(taskId));
 			setTasks(tasks.map((task) => (task.id === taskId ? updatedTask : task)));
 		} catch (error) {
+			if (isConflict(error)) {
+				handleConflict();
+				return;
+			}
 			console.error('Failed to update task:', error);
 			alert('Не удалось обновить задачу');
 		}
@@ -66,9 +120,13 @@ function App() {
 
 	const handleDeleteTask = async (taskId) => {
 		try {
-			await tasksAPI.delete(taskId);
+			await tasksAPI.delete(taskId, versionOf(taskId));
 			setTasks(tasks.filter((task) => task.id !== taskId));
 		} catch (error) {
+			if (isConflict(error)) {
+				handleConflict();
+				return;
+			}
 			console.error('Failed to delete task:', error);
 			alert('Не удалось удалить задачу');
 		}
@@ -103,6 +161,7 @@ function App() {
 			<main className='app-main'>
 				<TaskList
 					tasks={tasks}
+					stats={stats}
 					onCreate={handleCreateTask}
 					onUpdate={handleUpdateTask}
 					onDelete={handleDeleteTask}
@@ -4,7 +4,7 @@ import TaskForm from './TaskForm';
 import { isOverdue, isToday, isThisWeek } from '../utils/dateUtils';
 import './TaskList.css';
 
-const TaskList = ({ tasks, onUpdate, onDelete, onCreate }) => {
+const TaskList = ({ tasks, stats, onUpdate, onDelete, onCreate }) => {
 	const [showForm, setShowForm] = useState(false);
 	const [editingTask, setEditingTask] = useState(null);
 	const [filter, setFilter] = useState('all');
@@ -76,6 +76,22 @@ const TaskList = ({ tasks, onUpdate, onDelete, onCreate }) => {
 		return sorted;
 	}, [tasks, filter, dateFilter, sortBy, sortOrder, searchQuery]);
 
+	// Сводка с сервера; пока она не пришла, считаем по загруженному списку
+	const taskStats = useMemo(() => {
+		if (stats) {
+			return {
+				total: stats.total,
+				completed: stats.by_status.completed,
+				overdue: stats.overdue,
+			};
+		}
+		return {
+			total: tasks.length,
+			completed: tasks.filter((t) => t.status === 'completed').length,
+			overdue: 0,
+		};
+	}, [tasks, stats]);
+
 	const handleEdit = (task) => {
 		setEditingTask(task);
 		setShowForm(true);
@@ -178,13 +194,10 @@ const TaskList = ({ tasks, onUpdate, onDelete, onCreate }) => {
 			</div>
 
 			<div className='task-stats'>
-				<span>Всего: {tasks.length}</span>
-				<span>
-					Выполнено: {tasks.filter((t) => t.status === 'completed').length}
-				</span>
-				<span>
-					В ожидании: {tasks.filter((t) => t.status !== 'completed').length}
-				</span>
+				<span>Всего: {taskStats.total}</span>
+				<span>Выполнено: {taskStats.completed}</span>
+				<span>В ожидании: {taskStats.total - taskStats.completed}</span>
+				{taskStats.overdue > 0 && <span>Просрочено: {taskStats.overdue}</span>}
 			</div>
 
 			<div className='tasks-grid'>
@@ -97,6 +97,36 @@ export const authAPI = {
 	},
 };
 
+const ifMatch = (version) => (version ? { 'If-Match': `"${version}"` } : {});
+
+export const isConflict = (error) => error.response?.status === 412;
+
+const WRITE_TIMEOUT_MS = 10000;
+const WRITE_ATTEMPTS = 3;
+
+const newIdempotencyKey = () =>
+	typeof crypto !== 'undefined' && crypto.randomUUID
+		? crypto.randomUUID()
+		: `${Date.now()}-${Math.random().toString(36).slice(2)}`;
+
+// Запись с повтором после таймаута или обрыва сети. Все попытки идут с одним
+// Idempotency-Key: если первая всё же дошла, сервер вернёт её ответ, а не
+// создаст задачу второй раз. 409 - первая попытка ещё выполняется.
+const sendIdempotent = async (send) => {
+	const key = newIdempotencyKey();
+	for (let attempt = 1; ; attempt++) {
+		try {
+			return await send({ 'Idempotency-Key': key });
+		} catch (error) {
+			const retry = !error.response || error.response.status === 409;
+			if (!retry || attempt >= WRITE_ATTEMPTS) {
+				throw error;
+			}
+			await new Promise((resolve) => setTimeout(resolve, 500 * attempt));
+		}
+	}
+};
+
 export const tasksAPI = {
 	getAll: async () => {
 		const response = await api.get('/tasks');
@@ -104,19 +134,78 @@ export const tasksAPI = {
 	},
 
 	create: async (task) => {
-		const response = await api.post('/tasks', task);
+		const response = await sendIdempotent((headers) =>
+			api.post('/tasks', task, { headers, timeout: WRITE_TIMEOUT_MS })
+		);
+		return response.data;
+	},
+
+	// version - версия задачи, с которой работал пользователь: если задачу успели
+	// изменить (другая вкладка), сервер ответит 412 вместо перезаписи
+	update: async (id, task, version) => {
+		const response = await sendIdempotent((headers) =>
+			api.put(`/tasks/${id}`, task, {
+				headers: { ...headers, ...ifMatch(version) },
+				timeout: WRITE_TIMEOUT_MS,
+			})
+		);
+		return response.data;
+	},
+
+	delete: async (id, version) => {
+		const response = await sendIdempotent((headers) =>
+			api.delete(`/tasks/${id}`, {
+				headers: { ...headers, ...ifMatch(version) },
+				timeout: WRITE_TIMEOUT_MS,
+			})
+		);
 		return response.data;
 	},
 
-	update: async (id, task) => {
-		const response = await api.put(`/tasks/${id}`, task);
+	// Первые k невыполненных задач: выше приоритет, раньше срок
+	getNext: async (k = 5) => {
+		const response = await api.get('/tasks/next', { params: { k } });
 		return response.data;
 	},
 
-	delete: async (id) => {
-		const response = await api.delete(`/tasks/${id}`);
+	// Задачи со сроком в [from, to] ('YYYY-MM-DD') и счётчики по дням или неделям
+	getCalendar: async (from, to, bucket = 'day') => {
+		const response = await api.get('/tasks/calendar', {
+			params: { from, to, bucket },
+		});
 		return response.data;
 	},
+
+	// Счётчики по статусам и приоритетам, считаются на сервере
+	getStats: async () => {
+		const response = await api.get('/tasks/stats');
+		return response.data;
+	},
+
+	// Подписка на изменения задач через Server-Sent Events.
+	// EventSource не передаёт заголовки, поэтому токен идёт в query-параметре.
+	subscribe: (handlers) => {
+		const token = localStorage.getItem('token');
+		if (!token || typeof EventSource === 'undefined') {
+			return () => {};
+		}
+		const source = new EventSource(
+			`${API_BASE_URL}/tasks/stream?token=${encodeURIComponent(token)}`
+		);
+		const listen = (name, handler) => {
+			if (handler) {
+				source.addEventListener(name, (event) => handler(JSON.parse(event.data)));
+			}
+		};
+		listen('task.created', handlers.onCreated);
+		listen('task.updated', handlers.onUpdated);
+		listen('task.deleted', handlers.onDeleted);
+		listen('tasks.imported', handlers.onImported);
+		if (handlers.onOpen) {
+			source.addEventListener('open', handlers.onOpen);
+		}
+		return () => source.close();
+	},
 };
 
 export default api;